@@ -8,11 +8,20 @@
 /*      asciiImage                                                       */
 /*                                                                       */
 /*  DESCRIPTION:                                                         */
-/*      This program prints 24-bit .bmp image in ascii character format  */
+/*      This program prints .bmp image in ascii character format         */
+/*      ( 1, 4, 8 bit palette, RLE4, RLE8, 16, 24 and 32 bit images )    */
 /*                                                                       */
 /*  COMPILATION:                                                         */
-/*      /$ gcc -Wall -o asciiImage asciiImage.c -O2 -lm                  */
+/*      /$ gcc -Wall -o asciiImage asciiImage.c -O2 -lm -lpthread        */
 /*      ( on Windows WINDOWS constant must be defined )                  */
+/*      ( NO_SIMD constant disables SSSE3/AVX2 gray conversion )         */
+/*      ( USE_ZLIB constant enables --gzip output, link with -lz )       */
+/*      ( ASCII_LIBRARY constant builds library without main, see        */
+/*        asciiImage.h )                                                 */
+/*                                                                       */
+/*  BENCHMARK:                                                           */
+/*      /$ gcc -Wall -DBENCH -o asciiBench asciiImage.c -O2 -lm -lpthread */
+/*      /$ ./asciiBench [WIDTH HEIGHT [REPEATS]]                         */
 /*                                                                       */
 /*************************************************************************/
 
@@ -21,11 +30,46 @@
 /*                            INCLUDES                                   */                
 /*************************************************************************/
 
+#define _FILE_OFFSET_BITS	64		/* Files over 2 GB on 32-bit systems */
+
 #include <stdio.h>		
 #include <stdlib.h>			
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h> 
-#include <math.h>			/* Use -lm comipialtion flag */
+
+#include <time.h>			/* Stage timings */
+
+#if defined(BENCH) && defined(WINDOWS)
+	#error "BENCH build needs POSIX clock_gettime and dup2"
+#endif
+
+#ifndef WINDOWS
+	#include <fcntl.h>
+	#include <sys/mman.h>		/* Memory mapped image files */
+	#include <sys/stat.h>
+	#include <dirent.h>			/* Batch mode directories */
+	#include <sys/resource.h>	/* Peak memory for --stats */
+	#include <sys/socket.h>		/* --serve mode */
+	#include <sys/un.h>
+	#include <errno.h>
+	#include <poll.h>			/* --stream mode drops frames */
+	#include <sys/ioctl.h>		/* Terminal width for --cols auto */
+	#include <pthread.h>		/* Use -lpthread compilation flag */
+	#define USE_THREADS
+#endif
+
+#include "asciiImage.h"		/* Library interface */
+
+#ifdef USE_ZLIB
+	#include <zlib.h>			/* --gzip output, use -lz compilation flag */
+#endif
+
+/* SSSE3 / AVX2 gray conversion is selected at run time */
+#if !defined(NO_SIMD) && defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+	#define GRAY_SIMD_X86
+	#include <immintrin.h>
+#endif
 
 /*************************************************************************/
 /*                          MACROS AND CONSTANTS                         */                
@@ -38,11 +82,80 @@
 
 #define IMAGE_NAME_LEN		127
 
-/* For reading binary files */
+/* Gray conversion modes */
+#define GRAY_AVERAGE		0		/* (R + G + B) / 3 */
+#define GRAY_BT601			601		/* Weighted luma, ITU-R BT.601 */
+#define GRAY_BT709			709		/* Weighted luma, ITU-R BT.709 */
+
+/* Fixed-point weights ( sum is 256 ) for weighted luma */
+#define BT601_R				77
+#define BT601_G				150
+#define BT601_B				29
+#define BT709_R				54
+#define BT709_G				183
+#define BT709_B				19
+
+/* (sum * GRAY_DIV3_MUL) >> 16 equals sum / 3 for every sum of three bytes */
+#define GRAY_DIV3_MUL		21846
+
+/* Stats related - stages of rendering one image */
+#define STATS_HEADER		0		/* Opening file and parsing header */
+#define STATS_ALLOC			1		/* Allocation of pixel map and buffers */
+#define STATS_GRAY			2		/* Gray conversion ( fused with averaging in thread mode ) */
+#define STATS_CELLS			3		/* Averaging of symbols */
+#define STATS_EMIT			4		/* Building and writing output */
+#define STATS_NUM_STAGES	5
+
+#define STATS_TEXT			1
+#define STATS_JSON			2
+
+/* Stream mode related */
+#define STREAM_MAX_FRAME	(256L*1024*1024)	/* Largest accepted frame */
+#define STREAM_MERGE_GAP	6					/* Unchanged symbols printed instead of cursor move */
+#define STREAM_OUT_BUFFER	(1024*1024)
+
+/* Serve mode related */
+#define SERVE_CACHE_MB		64					/* Default memory limit of result cache */
+#define SERVE_HASH_BUCKETS	4096				/* Power of 2 */
+#define SERVE_LINE_LEN		128					/* Longest request line */
+#define SERVE_MAX_IMAGE		(256L*1024*1024)	/* Largest accepted image */
+#define SERVE_LATENCY_SAMPLES	4096			/* Percentiles of last requests */
+#define SERVE_BACKLOG		64
+
+#ifndef MSG_NOSIGNAL
+	#define MSG_NOSIGNAL	0					/* Closed client must not kill server */
+#endif
+
+/* Benchmark related */
+#define BENCH_WIDTH			1920	/* Default synthetic image size */
+#define BENCH_HEIGHT		1080
+#define BENCH_REPEATS		5		/* Best of repeats is reported */
+#define BENCH_HEADER_LOOPS	1000	/* Header parsing is timed in loop */
+
+/* Gray map cache related ( --grayCache ) */
+#define GRAY_CACHE_MB		512					/* Default size limit of cache directory */
+#define GRAY_CACHE_MAGIC	"AIGRAY1"			/* First bytes of cache file ( with zero ) */
+#define GRAY_CACHE_PATH_LEN	1024
+#define GRAY_CACHE_SAMPLES	64					/* Blocks of image hashed as content of file */
+#define GRAY_CACHE_SAMPLE_SIZE	4096
+#define GRAY_CACHE_TMP_AGE	600					/* Unfinished writes older than this ( s ) are removed */
+
+/* Band-parallel printing ( --threads ) */
+#define BAND_WINDOW_PER_WORKER	4		/* Reorder window lines for each worker */
+
+/* Memory related */
+#define CACHE_LINE_SIZE		64		/* Alignment of pixel lines and arena blocks */
+#define MEMORY_LIMIT_MB		1024	/* Larger images are printed one band at a time */
+
+/* For reading binary files ( 64-bit offsets ) */
 #ifdef WINDOWS
 	#define READ_BINARY_FILE	"rb"
+	#define FILE_SEEK( filePtr , fileOffset )	_fseeki64( filePtr , fileOffset , SEEK_SET )
+	#define FILE_SIZE( filePtr )	( _fseeki64( filePtr , 0 , SEEK_END ) == 0 ? _ftelli64( filePtr ) : -1 )
 #else
 	#define READ_BINARY_FILE	"r"
+	#define FILE_SEEK( filePtr , fileOffset )	fseeko( filePtr , (off_t) (fileOffset) , SEEK_SET )
+	#define FILE_SIZE( filePtr )	( fseeko( filePtr , 0 , SEEK_END ) == 0 ? (int64_t) ftello( filePtr ) : -1 )
 #endif
 
 /* Bmp file related */
@@ -53,6 +166,22 @@
 #define BMP_H_WIDTH			0x12
 #define BMP_H_HEIGHT		0x16
 #define BMP_H_RAW_SIZE		0x22
+#define BMP_H_INFO_SIZE		0x0E		/* Size of info header ( 40, V4 108, V5 124 ) */
+#define BMP_H_BIT_DEPTH		0x1C
+#define BMP_H_COMPRESSION	0x1E
+#define BMP_H_NUM_COLORS	0x2E
+#define BMP_H_MASKS			0x36		/* Red, green and blue masks of BMP_BITFIELDS image */
+
+#define BMP_FILE_HEADER_SIZE	14
+#define BMP_INFO_HEADER_MIN		40		/* Older OS/2 header is not supported */
+#define BMP_INFO_HEADER_MAX		124		/* V5 header */
+#define BMP_MAX_COLORS			256
+
+/* Compression of pixel array */
+#define BMP_RGB				0
+#define BMP_RLE8			1
+#define BMP_RLE4			2
+#define BMP_BITFIELDS		3
 
 /* Html file related */
 #define HTML_F_FAMILY		"font-family: Courier, 'Courier New', monospace;"
@@ -60,6 +189,59 @@
 #define HTML_F_WEIGHT		"font-weight: bold;"
 #define HTML_W_SPACE		"white-space: pre;"
 
+/* Header is built from parts - charset ( UTF-8 symbols ) and palette classes ( 256 colors ) are optional */
+#define HTML_HEAD_START		"<!DOCTYPE html>\n<html>\n<head>\n"
+#define HTML_CHARSET		"<meta charset=\"utf-8\">\n"
+#define HTML_STYLE			"<style>\n.a{" HTML_W_SPACE HTML_F_FAMILY HTML_F_SIZE HTML_F_WEIGHT "}\n"
+#define HTML_BODY_START		"</style>\n</head>\n<body>\n<div class=a>\n"
+#define HTML_HEADER			HTML_HEAD_START HTML_STYLE HTML_BODY_START
+#define HTML_CLASS_MAX		21			/* Longest palette class line ( .c231{color:#ffffff} ) */
+#define HTML_FOOTER			"</div>\n</body>\n</html>"
+#define HTML_ESCAPE_MAX		5			/* Longest escaped symbol ( &amp; ) */
+
+/* Output related */
+#define OUTPUT_BUFFER_MAX	(16*1024*1024)	/* Larger frames are written in parts */
+#define GZIP_CHUNK			(64*1024)		/* Compressed data is written in chunks ( --gzip ) */
+
+/* Resampled output ( --cols, --rows ) */
+#define RESAMPLE_AUTO		(-1)		/* Columns from terminal width */
+#define RESAMPLE_MAX		65535		/* Most columns or rows */
+#define RESAMPLE_ASPECT		200			/* Default symbol height / width in percent */
+#define TERMINAL_WIDTH		80			/* Columns when terminal width is not known */
+
+/* Size pyramid ( --size all or list ) - each level is 2 x 2 box filter of previous one */
+#define PYRAMID_ALL_SIZES	0x7FE		/* Bits of sizes 1 - 10 */
+#define PYRAMID_MAX_DEPTH	4			/* Coarsest level has 16 x 16 image pixels in each pixel */
+
+/* Shape matching ( --shape ) - symbol is split to regions, mean of each region has 2 bits */
+#define SHAPE_COLS			2
+#define SHAPE_ROWS			3
+#define SHAPE_REGIONS		6			/* SHAPE_COLS * SHAPE_ROWS */
+#define SHAPE_LEVELS		4
+#define SHAPE_TABLE_SIZE	4096		/* SHAPE_LEVELS ^ SHAPE_REGIONS signatures */
+#define GLYPH_BITMAP_WIDTH	4			/* Coverage bitmaps of symbols ( glyphBitmaps ) */
+#define GLYPH_BITMAP_HEIGHT	6
+
+/* Sub-pixel symbols ( --braille, --blocks ) - light sub-pixel sets one bit of mask */
+#define MASK_NONE			0
+#define MASK_BRAILLE		1			/* 2 x 4 dots */
+#define MASK_BLOCKS			2			/* 2 x 2 quadrant blocks */
+#define MASK_COLS			2
+#define MASK_ROWS_MAX		4
+#define MASK_SYMBOL_BYTES	3			/* Longest UTF-8 symbol */
+
+/* Dithering of symbol levels ( --dither ) */
+#define DITHER_NONE			0
+#define DITHER_FS			1			/* Floyd-Steinberg error diffusion */
+#define DITHER_BAYER		2			/* Ordered, 4 x 4 Bayer matrix */
+
+/* Color output ( --color ) */
+#define COLOR_NONE			0
+#define COLOR_TRUE			24			/* ANSI 24-bit escapes */
+#define COLOR_256			256			/* ANSI 256-color palette ( 6x6x6 cube ) */
+#define COLOR_ESCAPE_MAX	35			/* Longest color change ( <span style=color:#rrggbb> and </span> ) */
+#define COLOR_CUBE_START	16			/* First cube entry of 256-color palette */
+
 /*************************************************************************/
 /*                             GLOBALS                                   */                
 /*************************************************************************/
@@ -69,22 +251,299 @@ struct userInputStruct {
 	int infoFlag;
 	int invertFlag ;              		
 	int sizeMode;
+	int sizeLevels;						/* --size all or list - bit of each size, 0 for one size */
 	int bitGraphic;
 	int htmlMode;
+	int bandMode;
+	int grayMode;
+	int integralMode;
+	int numOfThreads;
+	int batchMode;
+	char *asciiRamp;					/* User symbols, first for black or NULL */
+	unsigned char glyphTable[256];		/* Symbol for each gray value ( initGlyphTable ) */
+	int ditherMode;						/* DITHER_NONE, DITHER_FS or DITHER_BAYER */
+	int shapeMode;						/* --shape symbols matched to regions of symbol */
+	unsigned char shapeTable[SHAPE_TABLE_SIZE];	/* Symbol for each region signature ( initShapeTable ) */
+	int maskMode;						/* MASK_NONE, MASK_BRAILLE or MASK_BLOCKS */
+	unsigned char maskTable[256][4];	/* UTF-8 symbol for each sub-pixel mask, length in last byte */
+	int colorMode;						/* COLOR_NONE, COLOR_TRUE or COLOR_256 */
+	unsigned char colorLevels[256];		/* 256-color cube level of each channel value ( initColorTable ) */
+	struct renderStatsStruct *renderStats;	/* --stats or NULL */
+	char *servePath;					/* --serve socket or NULL */
+	int streamMode;						/* --stream frames from stdin */
+	int cacheSizeMb;					/* Memory limit of --serve result cache */
+	int memoryLimitMb;					/* Larger images are printed in bands, 0 for no limit */
+	int gzipMode;						/* --gzip html or batch file */
+	int outCols;						/* --cols ( RESAMPLE_AUTO for terminal width ) or 0 */
+	int outRows;						/* --rows or 0 */
+	int cellAspect;						/* Symbol height / width in percent ( --aspect ) */
+	char *grayCacheDir;					/* --grayCache directory or NULL */
+	int grayCacheMb;					/* Size limit of --grayCache directory */
 } typedef userInput_s;
 
 /* Structure for holding image data */
 struct imageDataStruct {
-	int imgFileSize;
+	int64_t imgFileSize;
 	int imgWidth;
 	int imgHeight;
-	int imgRawSize;
-	int pixelOffset;
+	int64_t imgRawSize;
+	int64_t pixelOffset;
 	int paddedBytes;
-	int imgWidthInBytes;
+	int imgWidthInBytes;			/* Stored line ( decoded line of RLE image ) */
+	int bitDepth;					/* Bits per pixel */
+	int compression;				/* BMP_RGB, BMP_RLE8, BMP_RLE4 or BMP_BITFIELDS */
+	int topDown;					/* First line of image is first in file ( negative height ) */
+	int numOfColors;				/* Palette entries */
+	int outCols;					/* Resampled output size ( setResampleSize ) or 0 */
+	int outRows;
+	int levelScale;					/* Pyramid level - image pixels per level pixel on each axis ( 1 for full image ) */
+	const struct bmpFormatStruct *bmpFormat;		/* Decode kernels of pixel format */
+	unsigned char palette[BMP_MAX_COLORS][3];		/* B, G, R of each palette index */
+	unsigned char paletteGray[3][BMP_MAX_COLORS];	/* Gray of each palette index ( average, 601, 709 ) */
 	char imgName[IMAGE_NAME_LEN+1];
 } typedef imageData_s;
 
+/* Structure for coverage bitmap of one symbol ( --shape ) */
+struct glyphBitmapStruct {
+	char glyph;
+	uint32_t bitmap;				/* GLYPH_BITMAP_WIDTH bits per line, first line in highest bits */
+} typedef glyphBitmap_s;
+
+/* Structure for one pixel format of .bmp - one line is decoded with one call */
+struct bmpFormatStruct {
+	int bitDepth;
+	int compression;
+	uint32_t colorMasks[3];			/* Red, green, blue ( compared for BMP_BITFIELDS ) */
+	void (*lineToGray)( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , 
+						int grayMode , imageData_s *imageData );
+	void (*lineToBgr)( unsigned char *linePixels , unsigned char *bgrLine , int widthInPix , 
+						imageData_s *imageData );		/* NULL for 24-bit ( used in place ) */
+} typedef bmpFormat_s;
+
+/* Structure for gray pixel map - all lines in one continuous block */
+struct pixelMapStruct {
+	unsigned char *pixels;			/* First pixel of first line */
+	int width;
+	int height;
+	int stride;						/* Bytes between lines, multiple of CACHE_LINE_SIZE */
+} typedef pixelMap_s;
+
+/* Address of first pixel in line */
+#define PIXEL_MAP_LINE( map , line )	( (map)->pixels + (size_t) (line) * (map)->stride )
+
+/* Structure for summed-area table ( integral image ) of gray pixel map */
+struct integralImageStruct {
+	uint32_t *sums32;				/* Used when sum of all pixels fits to 32 bits */
+	uint64_t *sums64;				/* Used for very large images */
+	int width;						/* Map width + 1 ( first column is zero ) */
+	int height;						/* Map height + 1 ( first line is zero ) */
+} typedef integralImage_s;
+
+/* Structure for one output line summed directly from decoded image lines */
+struct cellLineStruct {
+	uint32_t *cellSums;				/* Sum of gray pixels of each symbol in line */
+	unsigned char *grayLine;		/* One decoded gray line, reused for every line */
+	uint16_t *colorColumns;			/* Color mode - sum of each byte column of band or NULL */
+	uint32_t *cellColors;			/* Color mode - color of each symbol ( 0xRRGGBB or palette index ) */
+	unsigned char *bgrLine;			/* Color mode - line expanded to B, G, R bytes ( not 24-bit image ) */
+	int numOfCells;
+	int symbolWidth;
+	int symbolHeight;
+} typedef cellLine_s;
+
+/* Structure for resampled output line - fixed-point area weights of source pixels in each symbol */
+struct resampleLineStruct {
+	int numOfCols;
+	int numOfRows;
+	int *cellFirstPix;				/* First source pixel of each symbol */
+	int *weightStart;				/* First weight of each symbol ( numOfCols + 1 entries ) */
+	uint32_t *pixWeights;			/* Overlap of source pixel and symbol ( 1 / numOfCols pixel units ) */
+	uint64_t cellArea;				/* Sum of weights of one symbol ( width * height of image ) */
+	uint64_t *rowSums;				/* Gray of source lines weighted by vertical overlap */
+	uint64_t *colorSums;			/* Color mode - same for B, G, R bytes or NULL */
+	unsigned char *grayLine;		/* Decoded gray of loadedLine */
+	unsigned char *colorPixels;		/* Color mode - B, G, R bytes of loadedLine */
+	unsigned char *bgrLine;			/* Color mode - line expanded to B, G, R bytes ( not 24-bit image ) */
+	uint32_t *cellColors;			/* Color mode - color of each symbol or NULL */
+	int loadedLine;					/* Source line in grayLine ( line on edge of two symbols is read once ) */
+} typedef resampleLine_s;
+
+/* Structure for memory arena - one allocation for all buffers of one image */
+struct memArenaStruct {
+	unsigned char *memBlock;		/* Allocated memory */
+	unsigned char *memStart;		/* Aligned start of memory */
+	size_t memSize;
+	size_t memUsed;
+} typedef memArena_s;
+
+/* Structure for dithering of one image ( --dither ) - lines are dithered in output order */
+struct ditherStruct {
+	int ditherMode;					/* DITHER_NONE, DITHER_FS or DITHER_BAYER */
+	int lineNum;					/* Output line ( row of Bayer matrix ) */
+	int invertFlag;
+	const char *asciiRamp;			/* Symbols from black to white */
+	int numOfLevels;				/* Symbols in ramp */
+	int lineSize;					/* Entries in error lines */
+	int *lineErrors;				/* Error diffusion - error carried to current line ( 1/16 units ) */
+	int *nextErrors;				/* Error diffusion - error carried to next line */
+} typedef dither_s;
+
+/* Structure for output - frame is built in memory and written at once */
+struct outputBufferStruct {
+	char *bufData;
+	size_t bufSize;
+	size_t bufUsed;
+	int htmlMode;					/* Symbols are escaped */
+	int colorMode;					/* COLOR_NONE, COLOR_TRUE or COLOR_256 */
+	int spanOpen;					/* Html color span is open, it can go over end of line */
+	uint32_t spanColor;				/* Color of open span */
+	void *gzipStream;				/* z_stream of --gzip file or NULL */
+	long outWritten;				/* All written bytes */
+	FILE *outFilePtr;				/* stdout or created file */
+	char outFilePath[IMAGE_NAME_LEN + 16];		/* Image name, pyramid size and extension */
+} typedef outputBuffer_s;
+
+/* Structure for --stats - sums of all rendered images */
+struct renderStatsStruct {
+	int statsFormat;				/* STATS_TEXT or STATS_JSON */
+	int numOfImages;
+	double stageTime[STATS_NUM_STAGES];		/* Wall time in seconds */
+	long bytesRead[STATS_NUM_STAGES];
+	long bytesWritten[STATS_NUM_STAGES];
+	long numOfAllocs[STATS_NUM_STAGES];		/* Heap allocations */
+#ifdef USE_THREADS
+	pthread_mutex_t statsLock;				/* Batch workers add to same stats */
+#endif
+} typedef renderStats_s;
+
+/* Structure for header of --grayCache file - gray pixel map follows, file can be used mapped */
+struct grayCacheHeaderStruct {
+	char cacheMagic[8];				/* GRAY_CACHE_MAGIC */
+	uint64_t contentHash;			/* Sampled blocks of image file */
+	int64_t fileSize;				/* Size of image file */
+	int64_t fileTime;				/* Modification time of image file in ns */
+	int32_t width;
+	int32_t height;
+	int32_t stride;
+	int32_t grayMode;
+	unsigned char headerPadding[CACHE_LINE_SIZE - 48];	/* Pixel lines start on cache line */
+} typedef grayCacheHeader_s;
+
+/* Structure for gray map cache entry of one image */
+struct grayCacheStruct {
+	char cachePath[GRAY_CACHE_PATH_LEN];	/* Cache file of image ( name is hash of image identity ) */
+	grayCacheHeader_s cacheHeader;	/* Expected header of cache file */
+	void *mapData;					/* Mapped cache file on hit or NULL */
+	size_t mapSize;
+} typedef grayCache_s;
+
+/* Structure for one file of cache directory ( eviction ) */
+struct grayCacheFileStruct {
+	time_t fileTime;				/* Last use */
+	int64_t fileSize;
+	char fileName[64];
+} typedef grayCacheFile_s;
+
+/* Structure for holding opened image file */
+struct imageFileStruct {
+	unsigned char *fileData;		/* Whole file mapped to memory or NULL */
+	int64_t fileSize;
+	FILE *filePtr;					/* Used when file cannot be mapped */
+	unsigned char *pixelData;		/* Decoded RLE image ( bmpDecodeRle ) or NULL */
+} typedef imageFile_s;
+
+/* Structure for list of images in batch mode */
+struct batchListStruct {
+	char **imagePaths;
+	int numOfImages;
+	int listSize;
+} typedef batchList_s;
+
+#ifdef USE_THREADS
+
+/* Structure shared by all workers of batch mode */
+struct batchJobStruct {
+	batchList_s *batchList;
+	userInput_s *userInput;
+	int nextImage;
+	int numOfFailed;
+	pthread_mutex_t jobLock;
+} typedef batchJob_s;
+
+/* Structure for options that change output of --serve mode ( --ramp is same for whole server ) */
+struct cacheKeyStruct {
+	int sizeMode;
+	int bitGraphic;
+	int invertFlag;					/* 0 or 1 */
+	int htmlMode;					/* 0 or 1 */
+	int grayMode;
+} typedef cacheKey_s;
+
+/* Structure for one cached result of --serve mode */
+struct cacheEntryStruct {
+	uint64_t imageHash;				/* Content hash of .bmp bytes */
+	unsigned char *imageData;		/* Copy of .bmp bytes, compared on hit */
+	long imageSize;
+	cacheKey_s cacheKey;			/* Validated rendering options */
+	char *outData;
+	size_t outLen;
+	struct cacheEntryStruct *lruPrev;		/* Toward most recently used */
+	struct cacheEntryStruct *lruNext;
+	struct cacheEntryStruct *hashNext;
+} typedef cacheEntry_s;
+
+/* Structure for LRU result cache shared by all connections */
+struct resultCacheStruct {
+	cacheEntry_s *hashTable[SERVE_HASH_BUCKETS];
+	cacheEntry_s *lruFirst;			/* Most recently used */
+	cacheEntry_s *lruLast;			/* Evicted first */
+	size_t memUsed;
+	size_t memLimit;
+	int numOfEntries;
+	long numOfHits;
+	long numOfMisses;
+	long numOfRequests;
+	long numOfLatencies;
+	double latencies[SERVE_LATENCY_SAMPLES];	/* Ring of last request times in seconds */
+	pthread_mutex_t cacheLock;
+} typedef resultCache_s;
+
+/* Structure for one client connection */
+struct serveJobStruct {
+	int clientFd;
+	resultCache_s *resultCache;
+	userInput_s *userInput;
+} typedef serveJob_s;
+
+/* Structure for one worker of band-parallel printing */
+struct bandWorkerStruct {
+	pthread_t threadId;
+	struct bandJobStruct *bandJob;
+} typedef bandWorker_s;
+
+/* Structure shared by all workers of band-parallel printing */
+struct bandJobStruct {
+	imageFile_s *imageFile;
+	userInput_s *userInput;
+	imageData_s *imageData;
+	int symbolWidth;
+	int symbolHeight;
+	int numOfBands;					/* One band is one output line */
+	int lineSize;
+	int windowLines;				/* Lines in reorder window */
+	char *outputLines;				/* Reorder window - line of band is in slot band % windowLines */
+	int *lineDone;					/* Symbols in line of slot + 1, 0 while line is not done */
+	int nextBand;					/* Next band taken by worker */
+	int printedBands;				/* Bands printed by calling thread ( slots before are free ) */
+	int errorFlag;
+	pthread_mutex_t doneLock;
+	pthread_cond_t doneCond;
+	int numOfWorkers;
+	bandWorker_s *workers;
+} typedef bandJob_s;
+
+#endif
+
 
 /*************************************************************************/
 /*                           PROTOTYPING                                 */                
@@ -94,37 +553,233 @@ struct imageDataStruct {
 int isBmpFormat( unsigned char *imgHeader);
 int bmpGetWidth( unsigned char *imgHeader );
 int bmpGetHeight( unsigned char *imgHeader );
-int bmpGetOffset( unsigned char *imgHeader );
-int bmpGetRawSize( unsigned char *imgHeader );
-int bmpGetFileSize( unsigned char *imgHeader );
-
-int bmpGetPaddedBytes ( int pixelWidth );
-int bmpGetWidthInBytes( int pixelWidth );
-
-int storeBmpImageData( char *imagePath , imageData_s *imageData );
+int64_t bmpGetOffset( unsigned char *imgHeader );
+int64_t bmpGetRawSize( unsigned char *imgHeader );
+int64_t bmpGetFileSize( unsigned char *imgHeader );
+
+int bmpGetBitDepth( unsigned char *imgHeader );
+int bmpGetCompression( unsigned char *imgHeader );
+
+int bmpGetPaddedBytes ( int pixelWidth , int bitDepth );
+int bmpGetWidthInBytes( int pixelWidth , int bitDepth );
+
+int storeBmpImageData( imageFile_s *imageFile , char *imagePath , imageData_s *imageData );
+int parseBmpHeader( imageFile_s *imageFile , imageData_s *imageData );
+const bmpFormat_s * bmpFindFormat( int bitDepth , int compression , uint32_t *colorMasks );
+int bmpReadPalette( imageFile_s *imageFile , imageData_s *imageData , int64_t paletteOffset , int numOfColors );
+int bmpDecodeRle( imageFile_s *imageFile , imageData_s *imageData );
+unsigned char * bmpReadLines( imageFile_s *imageFile , imageData_s *imageData , int firstLine , int numOfLines , 
+					unsigned char *readBuffer );
+
+/* Decode kernels of pixel formats ( bmpFormats ) */
+void bmpLineToGray24( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode , imageData_s *imageData );
+void bmpLineToGrayDirect( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode , imageData_s *imageData );
+void bmpLineToGrayPal8( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode , imageData_s *imageData );
+void bmpLineToGrayPal4( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode , imageData_s *imageData );
+void bmpLineToGrayPal1( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode , imageData_s *imageData );
+void bmpLineToBgr32( unsigned char *linePixels , unsigned char *bgrLine , int widthInPix , imageData_s *imageData );
+void bmpLineToBgr565( unsigned char *linePixels , unsigned char *bgrLine , int widthInPix , imageData_s *imageData );
+void bmpLineToBgr555( unsigned char *linePixels , unsigned char *bgrLine , int widthInPix , imageData_s *imageData );
+void bmpLineToBgrPal8( unsigned char *linePixels , unsigned char *bgrLine , int widthInPix , imageData_s *imageData );
+void bmpLineToBgrPal4( unsigned char *linePixels , unsigned char *bgrLine , int widthInPix , imageData_s *imageData );
+void bmpLineToBgrPal1( unsigned char *linePixels , unsigned char *bgrLine , int widthInPix , imageData_s *imageData );
+static inline int grayTableIndex( int grayMode );
 
 /* Image processing functions */
-inline unsigned char getAsciiSymbol( unsigned char grayValue , int bitGraphic  , int invertMode );
-inline unsigned char pixelToGray( unsigned char redPix , unsigned char greenPix , unsigned char bluePix );
+void initGlyphTable( userInput_s *userInput );
+void initShapeTable( userInput_s *userInput );
+void initMaskTable( userInput_s *userInput );
+char * getBuiltinRamp( int bitGraphic );
+int ditherInit( dither_s *dither , int lineSize , userInput_s *userInput );
+void ditherLine( dither_s *dither , char *asciiLine , int lineLen );
+void ditherDestroy( dither_s *dither );
+static inline unsigned char pixelToGray( unsigned char redPix , unsigned char greenPix , unsigned char bluePix );
+
+void bmpLineToGray( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode );
+void bmpLineToGrayScalar( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode );
+#ifdef GRAY_SIMD_X86
+int bmpLineToGraySsse3( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode );
+int bmpLineToGrayAvx2( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode );
+#endif
 
-int makeGrayPixelMap( unsigned char **grayImageMap , imageData_s *imageData );
-int printAsciiImage( unsigned char **grayImageMap, userInput_s *userInput, imageData_s *imageData );
+void initColorTable( userInput_s *userInput );
+void colorAddLine( unsigned char *lineBytes , uint16_t *columnSums , int numOfBytes );
+void colorAddLineScalar( unsigned char *lineBytes , uint16_t *columnSums , int numOfBytes );
+#ifdef GRAY_SIMD_X86
+int colorAddLineSse2( unsigned char *lineBytes , uint16_t *columnSums , int numOfBytes );
+int colorAddLineAvx2( unsigned char *lineBytes , uint16_t *columnSums , int numOfBytes );
+#endif
+void makeCellColors( cellLine_s *cellLine , userInput_s *userInput );
+
+int makeGrayPixelMap( pixelMap_s *grayImageMap , memArena_s *memArena , imageFile_s *imageFile , 
+					userInput_s *userInput , imageData_s *imageData );
+int readBandCells( imageFile_s *imageFile , cellLine_s *cellLine , unsigned char *bandBuffer ,
+					int firstLine , userInput_s *userInput , imageData_s *imageData );
+int printAsciiImage( pixelMap_s *grayImageMap, integralImage_s *integralImage , memArena_s *memArena , 
+					userInput_s *userInput, imageData_s *imageData );
+int printAsciiImageBanded( imageFile_s *imageFile , userInput_s *userInput, imageData_s *imageData );
+int printAsciiPyramid( pixelMap_s *grayImageMap , memArena_s *memArena , userInput_s *userInput, imageData_s *imageData );
+void reducePixelMap( pixelMap_s *sourceMap , pixelMap_s *levelMap );
+int getLevelDepth( userInput_s *userInput );
+void setPyramidLevel( imageData_s *levelData , imageData_s *imageData , int levelDepth );
+size_t pyramidSize( userInput_s *userInput , imageData_s *imageData );
+int printAsciiImageResampled( imageFile_s *imageFile , userInput_s *userInput, imageData_s *imageData );
+int readResampleLine( imageFile_s *imageFile , resampleLine_s *resampleLine , unsigned char *lineBuffer ,
+					int outLine , userInput_s *userInput , imageData_s *imageData );
+#ifdef USE_THREADS
+int printAsciiImageParallel( imageFile_s *imageFile , userInput_s *userInput, imageData_s *imageData , int lowMemory );
+void * bandWorkerThread( void *workerArg );
+int bandWorkerTakeBand( bandWorker_s *bandWorker );
+#endif
+int makeAsciiLine( pixelMap_s *grayImageMap , int firstLine , int symbolWidth , int symbolHeight ,
+					char *bufferedLine , userInput_s *userInput , imageData_s *imageData );
+int makeAsciiLineCells( cellLine_s *cellLine , char *bufferedLine , userInput_s *userInput );
+int makeAsciiLineShape( pixelMap_s *grayImageMap , integralImage_s *integralImage , int firstLine , 
+					int symbolWidth , int symbolHeight , char *bufferedLine , userInput_s *userInput , 
+					imageData_s *imageData );
+int makeAsciiLineMask( pixelMap_s *grayImageMap , integralImage_s *integralImage , int firstLine , 
+					int symbolWidth , int symbolHeight , char *bufferedLine , userInput_s *userInput , 
+					imageData_s *imageData );
+int makeAsciiLineResampled( resampleLine_s *resampleLine , char *bufferedLine , userInput_s *userInput );
+int makeAsciiLineIntegral( integralImage_s *integralImage , int firstLine , int symbolWidth , int symbolHeight ,
+					char *bufferedLine , userInput_s *userInput , imageData_s *imageData );
+int getSymbolWidth( int sizeMode );
+int getAsciiLineSize( userInput_s *userInput , imageData_s *imageData );
+int setResampleSize( userInput_s *userInput , imageData_s *imageData );
+int getTerminalWidth( void );
 
 void printImageInfo( imageData_s *imageData );
 
 /* Other function prototypes */
 
-unsigned char ** createPixelMap( int heightInPix , int widthInPix );
-void destroyPixelMap( unsigned char **grayPixelMap, int heightInPix );
+int createPixelMap( pixelMap_s *pixelMap , memArena_s *memArena , int heightInPix , int widthInPix );
+size_t pixelMapSize( int heightInPix , int widthInPix );
+
+int createCellLine( cellLine_s *cellLine , memArena_s *memArena , int symbolWidth , imageData_s *imageData );
+size_t cellLineSize( int symbolWidth , imageData_s *imageData );
+int createCellColors( cellLine_s *cellLine , memArena_s *memArena , imageData_s *imageData );
+size_t cellColorsSize( int symbolWidth , imageData_s *imageData );
+int createResampleLine( resampleLine_s *resampleLine , memArena_s *memArena , userInput_s *userInput , 
+					imageData_s *imageData );
+size_t resampleLineSize( userInput_s *userInput , imageData_s *imageData );
+
+int createIntegralImage( integralImage_s *integralImage , memArena_s *memArena , pixelMap_s *grayImageMap );
+size_t integralImageSize( int heightInPix , int widthInPix );
+static inline uint64_t integralRectSum( integralImage_s *integralImage , int xAxe , int yAxe , int rectWidth , int rectHeight );
+
+void arenaInit( memArena_s *memArena );
+void arenaAttach( memArena_s *memArena , void *memBlock , size_t memSize );
+int arenaCreate( memArena_s *memArena , size_t memSize );
+int arenaReserve( memArena_s *memArena , size_t memSize );
+void * arenaAlloc( memArena_s *memArena , size_t allocSize );
+size_t arenaBlockSize( size_t allocSize );
+void arenaDestroy( memArena_s *memArena );
+
+void htmlFilePrintFooter( outputBuffer_s *outBuffer );
+void htmlFilePrintHeader( outputBuffer_s *outBuffer , int utf8Flag );
+
+int openAsciiOutput( outputBuffer_s *outBuffer , int numOfLines , userInput_s *userInput, imageData_s *imageData );
+int closeAsciiOutput( outputBuffer_s *outBuffer , userInput_s *userInput );
+int outputAppendLine( outputBuffer_s *outBuffer , char *asciiLine , int lineLen );
+int outputAppendColorLine( outputBuffer_s *outBuffer , char *asciiLine , uint32_t *cellColors , int lineLen );
+static inline char * outputPutSymbol( char *outPtr , char asciiSymbol , int htmlMode );
+static inline char * outputPutColor( char *outPtr , uint32_t cellColor , int colorMode , int htmlMode );
+int outputAppendText( outputBuffer_s *outBuffer , char *outText );
+int outputAppendData( outputBuffer_s *outBuffer , const char *outData , size_t dataLen );
+int outputFlush( outputBuffer_s *outBuffer );
+#ifdef USE_ZLIB
+int outputGzipWrite( outputBuffer_s *outBuffer , int flushMode );
+#endif
+int getAsciiNumOfLines( userInput_s *userInput , imageData_s *imageData );
+
+int64_t byteToInt( unsigned char *dataArray , int dataOffset , int numOfBytes );
+size_t sizeMultiply( size_t firstSize , size_t secondSize );
+size_t sizeAdd( size_t firstSize , size_t secondSize );
 
-void htmlFilePrintFooter( FILE *htmlFilePtr );
-void htmlFilePrintHeader( FILE *htmlFilePtr );
+int imageFileOpen( char *imagePath , imageFile_s *imageFile );
+unsigned char * imageFileRead( imageFile_s *imageFile , int64_t dataOffset , int64_t dataSize , unsigned char *readBuffer );
+void imageFileClose( imageFile_s *imageFile );
 
-int byteToInt( unsigned char *dataArray , int dataOffset , int numOfBytes );
+int printImageFile( char *imagePath , memArena_s *memArena , userInput_s *userInput );
 
+/* Batch mode */
+int printBatch( batchList_s *batchList , userInput_s *userInput );
+#ifdef USE_THREADS
+void * batchWorkerThread( void *jobArg );
+#endif
+int batchListAddPath( batchList_s *batchList , char *imagePath );
+int batchListAddImage( batchList_s *batchList , char *imagePath );
+int batchListAddDirectory( batchList_s *batchList , char *dirPath );
+int batchListAddStream( batchList_s *batchList , FILE *listFilePtr );
+void batchListDestroy( batchList_s *batchList );
+
+int isOptionWithValue( char *optionArg );
+int parseSizeLevels( char *sizeArg );
 void initUserInput( userInput_s *userInput );
 void helpFunction(void);
 
+/* Stats */
+double getWallTime( void );
+void statsInit( renderStats_s *renderStats , int statsFormat );
+void statsAddStage( userInput_s *userInput , int statsStage , double startTime , long bytesRead , 
+					long bytesWritten , long numOfAllocs );
+void statsPrint( renderStats_s *renderStats );
+void statsDestroy( renderStats_s *renderStats );
+
+/* Gray map cache */
+#ifndef WINDOWS
+int grayCacheFind( grayCache_s *grayCache , char *imagePath , imageFile_s *imageFile , userInput_s *userInput , 
+					imageData_s *imageData , pixelMap_s *grayImageMap );
+int grayCacheStore( grayCache_s *grayCache , pixelMap_s *grayImageMap , userInput_s *userInput );
+void grayCacheRelease( grayCache_s *grayCache );
+void grayCacheEvict( char *cacheDir , int64_t sizeLimit );
+uint64_t grayCacheContentHash( imageFile_s *imageFile );
+int fileWriteAll( int fileDesc , const void *dataBuffer , size_t dataSize );
+int compareCacheFiles( const void *firstArg , const void *secondArg );
+#endif
+
+/* Stream mode */
+#ifndef WINDOWS
+int streamImages( userInput_s *userInput );
+long streamReadFrame( int inputFd , unsigned char **frameBuffer , size_t *bufferSize );
+long streamReadAll( int inputFd , unsigned char *dataBuffer , size_t dataSize );
+void streamDrawDelta( outputBuffer_s *outBuffer , char *newFrame , char *oldFrame , int numOfLines , int numOfCells );
+#endif
+
+/* Serve mode */
+#ifdef USE_THREADS
+int serveImages( char *socketPath , userInput_s *userInput );
+void * serveConnection( void *jobArg );
+int serveRender( resultCache_s *resultCache , unsigned char *imageBuffer , long imageSize , asciiOptions_s *options , 
+					char **responseBuffer , size_t *responseSize , size_t *outLen , int *cacheHit );
+int socketReadLine( int socketFd , char *lineBuffer , int lineSize );
+int socketReadAll( int socketFd , void *dataBuffer , size_t dataSize );
+int socketWriteAll( int socketFd , const void *dataBuffer , size_t dataSize );
+void cacheInit( resultCache_s *resultCache , size_t memLimit );
+cacheEntry_s * cacheFind( resultCache_s *resultCache , uint64_t imageHash , unsigned char *imageBuffer , long imageSize , 
+							cacheKey_s *cacheKey );
+void cacheInsert( resultCache_s *resultCache , uint64_t imageHash , unsigned char *imageBuffer , long imageSize , 
+					cacheKey_s *cacheKey , 
+					char *outData , size_t outLen );
+void cacheRemove( resultCache_s *resultCache , cacheEntry_s *cacheEntry );
+int cacheBucket( uint64_t imageHash , cacheKey_s *cacheKey );
+int cacheKeyEqual( cacheKey_s *firstKey , cacheKey_s *secondKey );
+void cacheAddLatency( resultCache_s *resultCache , double requestTime );
+void cacheFormatStats( resultCache_s *resultCache , char *statsLine , int lineSize );
+int compareDoubles( const void *firstArg , const void *secondArg );
+#endif
+uint64_t hashBytes64( const unsigned char *dataPtr , size_t dataSize );
+
+/* Library */
+int libraryInputFromOptions( const asciiOptions_s *options , userInput_s *userInput );
+
+/* Benchmark */
+#ifdef BENCH
+int benchWriteBmp( char *bmpPath , int widthInPix , int heightInPix );
+void benchPutInt( unsigned char *dataArray , int dataOffset , int numOfBytes , long dataValue );
+int benchImage( char *bmpPath , int numOfRepeats );
+#endif
+
 /*************************************************************************/
 /*                            FUNCTIONS                                  */                
 /*************************************************************************/
@@ -136,18 +791,18 @@ void helpFunction(void);
  *  Description: main program function
  ********************************************************************************/
 
-
+#if !defined(BENCH) && !defined(ASCII_LIBRARY)
 int main(int argc, char *argv[])
 {
 	int i;	
-	int retVal;
+	int statsFormat = 0;
 
 	char *imagePath = "null";
-	unsigned char **grayPixelMap;
 
-
-	imageData_s imageData;
+	memArena_s memArena;
+	batchList_s batchList;
 	userInput_s userArgs;
+	renderStats_s renderStats;
 	
 	/* Init */
 	initUserInput( &userArgs );
@@ -201,8 +856,14 @@ int main(int argc, char *argv[])
 		if( (strcmp( argv[i] , "-s" ) == 0 ) || 
 				(strcmp( argv[i] , "--size")== 0) ) {
 
-			if( argv[i+1] != NULL ) {
+			if( (argv[i+1] != NULL) && ((strcmp( argv[i+1] , "all" ) == 0) || (strchr( argv[i+1] , ',' ) != NULL)) ) {
+				userArgs.sizeLevels = parseSizeLevels( argv[i+1] );
+				if( userArgs.sizeLevels == 0 ) {
+					printf(" Warrning: -s option must be set to all or list of [ 1 - 10 ]!\n");
+				}
+			} else if( argv[i+1] != NULL ) {
 				userArgs.sizeMode = atoi(argv[i+1]);
+				userArgs.sizeLevels = 0;
 				if( (userArgs.sizeMode < 1) || (userArgs.sizeMode > 10) ) {
 					printf(" Warrning: -s option must be set [ 1 - 10 ]!\n");
 					userArgs.sizeMode = 6;							/* Using default value */
@@ -218,6 +879,236 @@ int main(int argc, char *argv[])
 			userArgs.htmlMode = 1;	
 		}
 
+		/* --luma flag */
+		if( strcmp( argv[i] , "--luma" ) == 0 ) {
+
+			if( argv[i+1] != NULL ) {
+				userArgs.grayMode = atoi(argv[i+1]);
+				if( (userArgs.grayMode != GRAY_BT601) && (userArgs.grayMode != GRAY_BT709) ) {
+					printf(" Warrning: --luma option must be set to 601 or 709!\n");
+					userArgs.grayMode = GRAY_AVERAGE;						/* Using default value */
+				}
+			} else {
+				printf(" Warrning: --luma option must be set to 601 or 709!\n");
+			}
+			continue;
+		}
+
+		/* --color flag */
+		if( strcmp( argv[i] , "--color" ) == 0 ) {
+
+			if( argv[i+1] != NULL ) {
+				userArgs.colorMode = atoi(argv[i+1]);
+				if( (userArgs.colorMode != COLOR_TRUE) && (userArgs.colorMode != COLOR_256) ) {
+					printf(" Warrning: --color option must be set to 24 or 256!\n");
+					userArgs.colorMode = COLOR_NONE;						/* Using default value */
+				}
+			} else {
+				printf(" Warrning: --color option must be set to 24 or 256!\n");
+			}
+			continue;
+		}
+
+		/* --band flag */
+		if( strcmp( argv[i] , "--band" ) == 0 ) {
+			userArgs.bandMode = 1;
+		}
+
+		/* -t, --threads flags */
+		if( (strcmp( argv[i] , "-t" ) == 0 ) || 
+				(strcmp( argv[i] , "--threads")== 0) ) {
+
+			if( argv[i+1] != NULL ) {
+				userArgs.numOfThreads = atoi(argv[i+1]);
+				if( userArgs.numOfThreads < 0 ) {
+					printf(" Warrning: -t option must be set to 0 ( all cores ) or more!\n");
+					userArgs.numOfThreads = 1;							/* Using default value */
+				}
+			} else {
+				printf(" Warrning: -t option must be set to 0 ( all cores ) or more!\n");
+			}
+			continue;
+		}
+
+		/* --batch flag */
+		if( strcmp( argv[i] , "--batch" ) == 0 ) {
+			userArgs.batchMode = 1;
+		}
+
+		/* --dither flag */
+		if( strcmp( argv[i] , "--dither" ) == 0 ) {
+
+			if( (argv[i+1] != NULL) && (strcmp( argv[i+1] , "fs" ) == 0) ) {
+				userArgs.ditherMode = DITHER_FS;
+			} else if( (argv[i+1] != NULL) && (strcmp( argv[i+1] , "bayer" ) == 0) ) {
+				userArgs.ditherMode = DITHER_BAYER;
+			} else {
+				printf(" Warrning: --dither option must be set to fs or bayer!\n");
+			}
+			continue;
+		}
+
+		/* --gzip flag */
+		if( strcmp( argv[i] , "--gzip" ) == 0 ) {
+			userArgs.gzipMode = 1;
+		}
+
+		/* --braille and --blocks flags */
+		if( strcmp( argv[i] , "--braille" ) == 0 ) {
+			userArgs.maskMode = MASK_BRAILLE;
+		}
+		if( strcmp( argv[i] , "--blocks" ) == 0 ) {
+			userArgs.maskMode = MASK_BLOCKS;
+		}
+
+		/* --shape flag */
+		if( strcmp( argv[i] , "--shape" ) == 0 ) {
+			userArgs.shapeMode = 1;
+		}
+
+		/* --integral flag */
+		if( strcmp( argv[i] , "--integral" ) == 0 ) {
+			userArgs.integralMode = 1;
+		}
+
+		/* --ramp flag */
+		if( strcmp( argv[i] , "--ramp" ) == 0 ) {
+
+			if( (argv[i+1] != NULL) && (argv[i+1][0] != '\0') ) {
+				userArgs.asciiRamp = argv[i+1];
+			} else {
+				printf(" Warrning: --ramp option must be set to string of symbols!\n");
+			}
+			continue;
+		}
+
+		/* --serve flag */
+		if( strcmp( argv[i] , "--serve" ) == 0 ) {
+
+			if( (argv[i+1] != NULL) && (argv[i+1][0] != '\0') ) {
+				userArgs.servePath = argv[i+1];
+			} else {
+				printf(" Warrning: --serve option must be set to socket path!\n");
+			}
+			continue;
+		}
+
+		/* --grayCache flag */
+		if( strcmp( argv[i] , "--grayCache" ) == 0 ) {
+
+			if( (argv[i+1] != NULL) && (argv[i+1][0] != '\0') ) {
+				userArgs.grayCacheDir = argv[i+1];
+			} else {
+				printf(" Warrning: --grayCache option must be set to directory path!\n");
+			}
+			continue;
+		}
+
+		/* --grayCacheMb flag */
+		if( strcmp( argv[i] , "--grayCacheMb" ) == 0 ) {
+
+			if( argv[i+1] != NULL ) {
+				userArgs.grayCacheMb = atoi(argv[i+1]);
+				if( userArgs.grayCacheMb < 1 ) {
+					printf(" Warrning: --grayCacheMb option must be set to 1 or more MB!\n");
+					userArgs.grayCacheMb = GRAY_CACHE_MB;					/* Using default value */
+				}
+			} else {
+				printf(" Warrning: --grayCacheMb option must be set to 1 or more MB!\n");
+			}
+			continue;
+		}
+
+		/* --stream flag */
+		if( strcmp( argv[i] , "--stream" ) == 0 ) {
+			userArgs.streamMode = 1;
+		}
+
+		/* --cache flag */
+		if( strcmp( argv[i] , "--cache" ) == 0 ) {
+
+			if( argv[i+1] != NULL ) {
+				userArgs.cacheSizeMb = atoi(argv[i+1]);
+				if( userArgs.cacheSizeMb < 0 ) {
+					printf(" Warrning: --cache option must be set to 0 ( no cache ) or more MB!\n");
+					userArgs.cacheSizeMb = SERVE_CACHE_MB;					/* Using default value */
+				}
+			} else {
+				printf(" Warrning: --cache option must be set to 0 ( no cache ) or more MB!\n");
+			}
+			continue;
+		}
+
+		/* --memory flag */
+		if( strcmp( argv[i] , "--memory" ) == 0 ) {
+
+			if( argv[i+1] != NULL ) {
+				userArgs.memoryLimitMb = atoi(argv[i+1]);
+				if( userArgs.memoryLimitMb < 0 ) {
+					printf(" Warrning: --memory option must be set to 0 ( no limit ) or more MB!\n");
+					userArgs.memoryLimitMb = MEMORY_LIMIT_MB;				/* Using default value */
+				}
+			} else {
+				printf(" Warrning: --memory option must be set to 0 ( no limit ) or more MB!\n");
+			}
+			continue;
+		}
+
+		/* --cols flag */
+		if( strcmp( argv[i] , "--cols" ) == 0 ) {
+
+			if( (argv[i+1] != NULL) && (strcmp( argv[i+1] , "auto" ) == 0) ) {
+				userArgs.outCols = RESAMPLE_AUTO;
+			} else if( argv[i+1] != NULL ) {
+				userArgs.outCols = atoi(argv[i+1]);
+				if( (userArgs.outCols < 1) || (userArgs.outCols > RESAMPLE_MAX) ) {
+					printf(" Warrning: --cols option must be set to auto or 1 - %d!\n", RESAMPLE_MAX );
+					userArgs.outCols = 0;								/* Using default value */
+				}
+			} else {
+				printf(" Warrning: --cols option must be set to auto or 1 - %d!\n", RESAMPLE_MAX );
+			}
+			continue;
+		}
+
+		/* --rows flag */
+		if( strcmp( argv[i] , "--rows" ) == 0 ) {
+
+			if( argv[i+1] != NULL ) {
+				userArgs.outRows = atoi(argv[i+1]);
+				if( (userArgs.outRows < 1) || (userArgs.outRows > RESAMPLE_MAX) ) {
+					printf(" Warrning: --rows option must be set to 1 - %d!\n", RESAMPLE_MAX );
+					userArgs.outRows = 0;								/* Using default value */
+				}
+			} else {
+				printf(" Warrning: --rows option must be set to 1 - %d!\n", RESAMPLE_MAX );
+			}
+			continue;
+		}
+
+		/* --aspect flag - percent, so later math is integer */
+		if( strcmp( argv[i] , "--aspect" ) == 0 ) {
+
+			if( argv[i+1] != NULL ) {
+				userArgs.cellAspect = (int) (atof(argv[i+1]) * 100 + 0.5);
+				if( (userArgs.cellAspect < 10) || (userArgs.cellAspect > 1000) ) {
+					printf(" Warrning: --aspect option must be set to 0.1 - 10!\n");
+					userArgs.cellAspect = RESAMPLE_ASPECT;				/* Using default value */
+				}
+			} else {
+				printf(" Warrning: --aspect option must be set to 0.1 - 10!\n");
+			}
+			continue;
+		}
+
+		/* --stats, --stats=json flags */
+		if( strcmp( argv[i] , "--stats" ) == 0 ) {
+			statsFormat = STATS_TEXT;
+		}
+		if( strcmp( argv[i] , "--stats=json" ) == 0 ) {
+			statsFormat = STATS_JSON;
+		}
+
 		/* -h, --help flags */
 		if( (strcmp( argv[i] , "-h" ) == 0 ) || 
 				(strcmp( argv[i] , "--help")== 0) ) {
@@ -227,732 +1118,7669 @@ int main(int argc, char *argv[])
 
 	} /* END Loop input arguments */
 
-	/*************************************************************************/
-	/*                           Get image info                              */                
-	/*************************************************************************/
-	
-	retVal = storeBmpImageData( imagePath , &imageData  );
-	if( retVal < 0 ) {
-		return 0;
+	/* Only files are compressed */
+	if( userArgs.gzipMode == 1 ) {
+#ifndef USE_ZLIB
+		printf(" Warrning: --gzip needs build with USE_ZLIB constant!\n");
+		userArgs.gzipMode = 0;
+#endif
+		if( (userArgs.htmlMode == 0) && (userArgs.batchMode == 0) ) {
+			printf(" Warrning: --gzip is used only with --html or --batch!\n");
+			userArgs.gzipMode = 0;
+		}
 	}
 
-	/* Print image data */
-	if( userArgs.infoFlag == 1 ) {
-		printImageInfo( &imageData );
-		return 0;
+	/* Sub-pixel symbols are drawn only from full gray map */
+	if( (userArgs.maskMode != MASK_NONE) && ((userArgs.shapeMode == 1) || (userArgs.ditherMode != DITHER_NONE) ||
+		(userArgs.bandMode == 1) || (userArgs.colorMode != COLOR_NONE) || (userArgs.outCols != 0) || 
+		(userArgs.outRows != 0)) ) {
+		printf(" Warrning: --braille and --blocks are not used with --shape, --dither, --band, --color, --cols or --rows!\n");
+		userArgs.maskMode = MASK_NONE;
 	}
 
-	/*************************************************************************/
-	/*                       Make gray scale pixel map                       */                
-	/*************************************************************************/
+	/* Cache files are mapped */
+#ifdef WINDOWS
+	if( userArgs.grayCacheDir != NULL ) {
+		printf(" Warrning: --grayCache is not supported on this system!\n");
+		userArgs.grayCacheDir = NULL;
+	}
+#endif
 
-	/* Allocate memory for gray pixel map */
-	grayPixelMap = createPixelMap( imageData.imgHeight , imageData.imgWidth );
-	if( grayPixelMap == NULL ) {
-		return 0;
+	/* Resampled output has one size */
+	if( (userArgs.sizeLevels != 0) && ((userArgs.outCols != 0) || (userArgs.outRows != 0)) ) {
+		printf(" Warrning: --size all or list is not used with --cols or --rows!\n");
+		userArgs.sizeLevels = 0;
 	}
 
-	/* Read image and store gray pixels in gray pixel map */
-	retVal = makeGrayPixelMap( grayPixelMap , &imageData );
-	if( retVal < 0 ) {
-		printf("Cannot create gray-scale pixel map!\n");
-		return 0;
+	/* Shape symbols are not ramp levels */
+	if( (userArgs.shapeMode == 1) && (userArgs.ditherMode != DITHER_NONE) ) {
+		printf(" Warrning: --dither is not used with --shape!\n");
+		userArgs.ditherMode = DITHER_NONE;
+	}
+
+	/* Symbols for all gray values are selected only once */
+	initGlyphTable( &userArgs );
+	initColorTable( &userArgs );
+	if( userArgs.maskMode != MASK_NONE ) {
+		initMaskTable( &userArgs );
+	}
+	if( userArgs.shapeMode == 1 ) {
+		initShapeTable( &userArgs );
+		if( (userArgs.bandMode == 1) || (userArgs.colorMode != COLOR_NONE) || (userArgs.outCols != 0) || 
+			(userArgs.outRows != 0) ) {
+			printf(" Warrning: --shape is not used with --band, --color, --cols or --rows!\n");
+		}
+	}
+
+	/* Stages of all images are measured */
+	if( statsFormat != 0 ) {
+		statsInit( &renderStats , statsFormat );
+		userArgs.renderStats = &renderStats;
 	}
 
 	/*************************************************************************/
-	/*                         Main                                          */                
+	/*                           Print images                                */                
 	/*************************************************************************/
 
-	/* Print image to output */
-	printAsciiImage ( grayPixelMap , &userArgs , &imageData );
+#ifdef USE_THREADS
+	if( userArgs.numOfThreads == 0 ) {
+		userArgs.numOfThreads = sysconf( _SC_NPROCESSORS_ONLN );
+	}
+#else
+	userArgs.numOfThreads = 1;
+#endif
+
+	/* Stream mode - frames come from standard input */
+	if( userArgs.streamMode == 1 ) {
+#ifndef WINDOWS
+		streamImages( &userArgs );
+#else
+		printf("--stream mode is not supported on this system!\n");
+#endif
+		return 0;
+	}
 
-	/* Free memory of gray pixel map */
-	destroyPixelMap( grayPixelMap , imageData.imgHeight );
+	/* Serve mode - images come from clients of socket */
+	if( userArgs.servePath != NULL ) {
+#ifdef USE_THREADS
+		serveImages( userArgs.servePath , &userArgs );
+#else
+		printf("--serve mode is not supported on this system!\n");
+#endif
+		return 0;
+	}
 
-	return 0;
-}
+	/* Batch mode - all images in one process */
+	if( userArgs.batchMode == 1 ) {
 
-/********************************************************************************
-*     FUNCTION: initUserInput
-*        INPUT: userInput - structure for storing user input data
-*       OUTPUT: /
-*  DESCRIPTION: This function initializes userInput_s
-********************************************************************************/
+		batchList.imagePaths = NULL;
+		batchList.numOfImages = 0;
+		batchList.listSize = 0;
 
-void initUserInput( userInput_s *userInput )
-{
-	userInput->infoFlag = 0;
-	userInput->invertFlag = 0;
-	userInput->sizeMode = 6;
-	userInput->bitGraphic = 4;
-	userInput->htmlMode = 0;
-	
-	return;
-}
+		/* Files, directories or - for list on standard input */
+		for( i=1 ; i<argc ; i++ ) {
+			if( isOptionWithValue( argv[i] ) ) {
+				i++;
+				continue;
+			}
+			if( (argv[i][0] != '-') || (strcmp( argv[i] , "-" ) == 0) ) {
+				batchListAddPath( &batchList , argv[i] );
+			}
+		}
 
+		printBatch( &batchList , &userArgs );
+		batchListDestroy( &batchList );
 
-/********************************************************************************
-*     FUNCTION: createGrayPixMap
-*        INPUT: heightInPix - map height
-*               widthInPix  - map width
-*       OUTPUT: NULL or pointer to 2D pixel map
-*  DESCRIPTION: This function allocates memory on heap for gray scale pixel map
-********************************************************************************/
+	} else {
 
-unsigned char ** createPixelMap( int heightInPix , int widthInPix )
-{
-	int i;
-	unsigned char **pixelMap;
-	
-	/* Allocate memory for pixelMap - pointers to lines  */
-	pixelMap = malloc( heightInPix  * sizeof( unsigned char *));
-	if( pixelMap == NULL) {
-		printf("Cannot allocate memory for gray pixel map!\n");
-		return NULL;
+		arenaInit( &memArena );
+		printImageFile( imagePath , &memArena , &userArgs );
+		arenaDestroy( &memArena );
 	}
 
-	/* Allocate memory for lines in grayPixelMap */
-	for( i=0 ; i < heightInPix ; i++ ) {
-		pixelMap[i] = malloc( widthInPix  * sizeof(unsigned char));
-		if( pixelMap[i] == NULL ) {
-			printf("Cannot allocate memory for gray pixel map!\n");
-			return NULL;
-		}
+	/* Report is printed to stderr, so it does not mix with ascii image */
+	if( userArgs.renderStats != NULL ) {
+		statsPrint( userArgs.renderStats );
+		statsDestroy( userArgs.renderStats );
 	}
 
-	return pixelMap;
+	return 0;
 }
+#endif /* !BENCH && !ASCII_LIBRARY */
 
 /********************************************************************************
-*     FUNCTION: destroyGrayPixMap
-*        INPUT: **grayPixelMap - gray scale pixel map
-*               heightInPix    - gray scale map height
-*       OUTPUT: / 
-*  DESCRIPTION: This function frees memory on heap for gray scale pixel map
+*     FUNCTION: printImageFile
+*        INPUT: imagePath - image location on filesystem
+*               memArena  - arena for image buffers, it is enlarged when 
+*                           needed and can be reused for next image
+*               userInput - user input data strucure
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function prints one image with selected settings
 ********************************************************************************/
 
-void destroyPixelMap( unsigned char **grayPixelMap, int heightInPix )
+int printImageFile( char *imagePath , memArena_s *memArena , userInput_s *userInput )
 {
-	int i;
+	int retVal;
+	size_t arenaSize;
+	double startTime;
+	unsigned char *arenaBlock;
+
+	imageData_s imageData;
+	imageFile_s imageFile;
+	pixelMap_s grayPixelMap;
+	integralImage_s integralImage;
+	userInput_s levelInput;			/* Banded pyramid - input of one size */
+	int cacheHit;
+	int overLimit;					/* Gray pixel map would be larger than memory limit */
+#ifndef WINDOWS
+	grayCache_s grayCache;
+#endif
+
+	/*************************************************************************/
+	/*                           Get image info                              */                
+	/*************************************************************************/
 	
-	/* Free memory for each individual line */
-	for( i = 0 ; i<heightInPix ; i++ ) {
-		free( grayPixelMap[i] );
+	startTime = getWallTime();
+
+	/* Image file is opened ( mapped ) only once */
+	retVal = imageFileOpen( imagePath , &imageFile );
+	if( retVal < 0 ) {
+		return ERROR;
 	}
-	
-	/* Free pointers to each line */
-	free( grayPixelMap );
 
-	return;
-}
+	retVal = storeBmpImageData( &imageFile , imagePath , &imageData  );
+	if( retVal < 0 ) {
+		imageFileClose( &imageFile );
+		return ERROR;
+	}
 
-/********************************************************************************
-*     FUNCTION: printAsciiImage
-*        INPUT: **grayImageMap - gray scale image map
-*               userInput      - user input data strucure
-*               imageData      - image data structure
-*       OUTPUT:	ERROR or OK
-*  DESCRIPTION: This function prints ascii image to provided output
-********************************************************************************/
+	statsAddStage( userInput , STATS_HEADER , startTime , BMP_HEADER_SIZE , 0 , 0 );
 
-int printAsciiImage( unsigned char **grayImageMap, userInput_s *userInput, imageData_s *imageData )
-{
-	int pix;
-	int line;
-	int xAxe;
-	int yAxe;	
-	int symTemp;
-	int symIndex;
-	int symAverage;
-	int symbolWidth;			/* How many pixels from one line is in one printed symbol */
-	int symbolHeight;			/* How many pixels from one column is in one printed symbol */
+	/* Print image data */
+	if( userInput->infoFlag == 1 ) {
+		printImageInfo( &imageData );
+		imageFileClose( &imageFile );
+		return OK;
+	}
 
-	char outFilePath[IMAGE_NAME_LEN];
-	char *bufferedLine;
-	
-	FILE *outFilePtr;
+	/* RLE image is decoded to memory, then it is read like other images */
+	if( (imageData.compression == BMP_RLE8) || (imageData.compression == BMP_RLE4) ) {
+		if( bmpDecodeRle( &imageFile , &imageData ) < 0 ) {
+			printf("File %s is not supported or damaged!\n", imagePath );
+			imageFileClose( &imageFile );
+			return ERROR;
+		}
+	}
+
+	/* Exact output size - image is resampled one output line at a time */
+	if( (userInput->outCols != 0) || (userInput->outRows != 0) ) {
+		retVal = setResampleSize( userInput , &imageData );
+		if( retVal == OK ) {
+			retVal = printAsciiImageResampled( &imageFile , userInput , &imageData );
+		}
+		imageFileClose( &imageFile );
+		return retVal;
+	}
+
+	/* One allocation for gray pixel map, line of RGB pixels and output line */
+	arenaSize = sizeAdd( sizeAdd( pixelMapSize( imageData.imgHeight , imageData.imgWidth ) , 
+				arenaBlockSize( imageData.imgWidthInBytes ) ) ,
+				arenaBlockSize( getAsciiLineSize( userInput , &imageData ) ) );
+
+	if( (userInput->integralMode == 1) && (userInput->sizeLevels == 0) ) {
+		arenaSize = sizeAdd( arenaSize , integralImageSize( imageData.imgHeight , imageData.imgWidth ) );
+	}
+
+	/* Coarser pyramid levels, their integral images and output lines */
+	if( userInput->sizeLevels != 0 ) {
+		arenaSize = sizeAdd( arenaSize , pyramidSize( userInput , &imageData ) );
+	}
+
+	/* Images larger than memory limit are always printed in bands */
+	overLimit = (userInput->memoryLimitMb > 0) && (arenaSize / (1024 * 1024) >= (size_t) userInput->memoryLimitMb);
+
+#ifdef USE_THREADS
+	/* Bands are printed by multiple threads ( mapped file only ), output is 
+	   buffered only for reorder window in band mode and over memory limit */
+	if( (userInput->numOfThreads > 1) && (imageFile.fileData != NULL) && (userInput->colorMode == COLOR_NONE) &&
+		(userInput->shapeMode == 0) && (userInput->maskMode == MASK_NONE) && (userInput->sizeLevels == 0) &&
+		((userInput->grayCacheDir == NULL) || (userInput->bandMode == 1) || overLimit) ) {
+		retVal = printAsciiImageParallel( &imageFile , userInput , &imageData , (userInput->bandMode == 1) || overLimit );
+		imageFileClose( &imageFile );
+		return retVal;
+	}
+#endif
+
+	/* Band mode - never hold whole gray pixel map in memory ( colors are summed only here ). 
+	   Each size of pyramid is then read from file again. */
+	if( (userInput->bandMode == 1) || (userInput->colorMode != COLOR_NONE) || overLimit ) {
+		if( userInput->sizeLevels == 0 ) {
+			retVal = printAsciiImageBanded( &imageFile , userInput , &imageData );
+		} else {
+			retVal = OK;
+			levelInput = *userInput;
+			for( levelInput.sizeMode = 1 ; levelInput.sizeMode <= 10 ; levelInput.sizeMode++ ) {
+				if( (userInput->sizeLevels & (1 << levelInput.sizeMode)) && 
+					(printAsciiImageBanded( &imageFile , &levelInput , &imageData ) < 0) ) {
+					retVal = ERROR;
+				}
+			}
+		}
+		imageFileClose( &imageFile );
+		return retVal;
+	}
 
 	/*************************************************************************/
-	/*                           Printing settings                           */                
+	/*                       Make gray scale pixel map                       */                
 	/*************************************************************************/
 
-	/* Set width and height of one symbol - larger the width of symbol smaller the picture */
-	switch( userInput->sizeMode ) {
-		case 0 :
-			symbolWidth = 8;			/* Default size */
-			break;
-		case 10:
-			symbolWidth = 1;			/* Larges size output */
-			break;
-		
-		default:
-			symbolWidth = (userInput->sizeMode-10) * (-2);
+	/* Gray pixel map of earlier run is used mapped from cache file */
+	cacheHit = 0;
+#ifndef WINDOWS
+	grayCache.mapData = NULL;
+	if( userInput->grayCacheDir != NULL ) {
+		startTime = getWallTime();
+		if( grayCacheFind( &grayCache , imagePath , &imageFile , userInput , &imageData , &grayPixelMap ) == OK ) {
+			cacheHit = 1;
+			arenaSize = arenaSize - pixelMapSize( imageData.imgHeight , imageData.imgWidth );
+			statsAddStage( userInput , STATS_GRAY , startTime , (long) grayCache.mapSize , 0 , 0 );
+		}
+	}
+#endif
 
+	startTime = getWallTime();
+	arenaBlock = memArena->memBlock;
+
+	retVal = arenaReserve( memArena , arenaSize );
+
+	/* Allocate memory for gray pixel map */
+	if( (retVal == OK) && (cacheHit == 0) ) {
+		retVal = createPixelMap( &grayPixelMap , memArena , imageData.imgHeight , imageData.imgWidth );
 	}
-	
-	/* Height to width ratio is 2:1 */
-	symbolHeight = symbolWidth * 2;
 
-	/* Allocate memory for output line */
-	bufferedLine = malloc( ((imageData->imgWidth / symbolWidth) + 1) *  sizeof(char));
-	if( bufferedLine == NULL ) {
-		printf("Could not allocate memory for bufferedLine!\n");
+	if( retVal < 0 ) {
+		imageFileClose( &imageFile );
+#ifndef WINDOWS
+		grayCacheRelease( &grayCache );
+#endif
 		return ERROR;
 	}
-	
-	/* Html mode */
-	if( userInput->htmlMode ) {
 
-		/* Create output filename */
-		snprintf( outFilePath , IMAGE_NAME_LEN , "%s%s" , imageData->imgName , ".html" );
+	/* Arena block is allocated again only for larger image */
+	statsAddStage( userInput , STATS_ALLOC , startTime , 0 , 0 , (memArena->memBlock != arenaBlock) ? 1 : 0 );
 
-		/* Create or owerwrite file */
-		outFilePtr = fopen( outFilePath  , "w" );				/* Print to html file */
-		if( outFilePtr == NULL ) {
-			printf("Could not open file %s", outFilePath );
-			free(bufferedLine);
-			return ERROR ;
+	/* Read image and store gray pixels in gray pixel map */
+	if( cacheHit == 0 ) {
+
+		startTime = getWallTime();
+		retVal = makeGrayPixelMap( &grayPixelMap , memArena , &imageFile , userInput , &imageData );
+		if( retVal < 0 ) {
+			printf("Cannot create gray-scale pixel map!\n");
+			imageFileClose( &imageFile );
+			return ERROR;
 		}
 
-		/* Print html header to file */
-		htmlFilePrintHeader( outFilePtr );
+		statsAddStage( userInput , STATS_GRAY , startTime , (long) imageData.imgHeight * imageData.imgWidthInBytes , 0 , 0 );
 
-	} else {
-		outFilePtr = stdout; 								/* Print to console */
+#ifndef WINDOWS
+		/* Failed write only costs decoding in next run */
+		if( (userInput->grayCacheDir != NULL) && (grayCache.cachePath[0] != '\0') ) {
+			startTime = getWallTime();
+			grayCacheStore( &grayCache , &grayPixelMap , userInput );
+			statsAddStage( userInput , STATS_GRAY , startTime , 0 , (long) grayCache.mapSize , 0 );
+		}
+#endif
 	}
 
+	imageFileClose( &imageFile );
+
 	/*************************************************************************/
-	/*                           Print ascii image                           */                
+	/*                         Main                                          */                
 	/*************************************************************************/
-	
-	/* Move down the lines of 2D map */
-	for( yAxe = 0; yAxe < (imageData->imgHeight - symbolHeight); yAxe = yAxe + symbolHeight ) {
-	
-		symIndex = 0;
 
-		/* Move throug the pixels in 2D map */
-		for( xAxe = 0; xAxe < (imageData->imgWidth - symbolWidth); xAxe = xAxe + symbolWidth ) {
-		
-			symTemp = 0;
+	if( userInput->sizeLevels != 0 ) {
 
-			/* Clacualte average for one symbol  */
-			for( line = yAxe ; line < (symbolHeight + yAxe); line++ ) {
-				for( pix = xAxe ; pix < (symbolWidth + xAxe); pix++ ) {
-					/* Add all pixel values in range of one symbol */
-					symTemp = symTemp + grayImageMap[line][pix];	
-				}
-			}
-			/* Average */
-			symAverage = symTemp / ( symbolWidth * symbolHeight );
-			/* Store one ascii symbol */
-			bufferedLine[symIndex] = getAsciiSymbol(symAverage , userInput->bitGraphic , userInput->invertFlag );
-			symIndex++;
+		/* All sizes are printed from one decoded gray pixel map */
+		retVal = printAsciiPyramid( &grayPixelMap , memArena , userInput , &imageData );
 
-		} /* END Move throug the pixels in 2D map */
+	} else {
 
-		bufferedLine[symIndex] = '\0';
-		fprintf( outFilePtr , "%s\n" , bufferedLine );
-	
-	} /* END Move down the lines of 2D map */
+		/* Integral image - average of any symbol costs four lookups */
+		if( userInput->integralMode == 1 ) {
+			startTime = getWallTime();
+			retVal = createIntegralImage( &integralImage , memArena , &grayPixelMap );
+			statsAddStage( userInput , STATS_CELLS , startTime , 0 , 0 , 0 );
+		}
 
-	/*************************************************************************/
-	/*                             Clean up                                  */
-	/*************************************************************************/
-	
-	/* Html mode */
-	if( userInput->htmlMode ) {
-		printf(" Ascii image printed to file %s\n" , outFilePath );
-		htmlFilePrintFooter( outFilePtr );
-		fclose(outFilePtr);
+		/* Print image to output */
+		if( retVal == OK ) {
+			retVal = printAsciiImage ( &grayPixelMap , (userInput->integralMode == 1) ? &integralImage : NULL , 
+								memArena , userInput , &imageData );
+		}
 	}
- 
-	free(bufferedLine);
 
-	return OK;
+#ifndef WINDOWS
+	grayCacheRelease( &grayCache );
+#endif
 
+	return retVal;
 }
 
 /********************************************************************************
-*     FUNCTION: htmlFilePrintHeader
-*        INPUT: pointer to html file
-*       OUTPUT: /
-*  DESCRIPTION: This function prints html header to file
+*     FUNCTION: printBatch
+*        INPUT: batchList - list of images
+*               userInput - user input data strucure
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function prints all images in list, each to its own 
+*               file. Images are shared between numOfThreads workers ( calling
+*               thread is one of them ), each worker reuses its buffers for 
+*               all of its images.
 ********************************************************************************/
 
-void htmlFilePrintHeader( FILE *htmlFilePtr )
+int printBatch( batchList_s *batchList , userInput_s *userInput )
 {
-	fprintf( htmlFilePtr, "%s", "<!DOCTYPE html>\n<html>\n<head>\n</head>\n<body>\n<div style=\"");
-	fprintf( htmlFilePtr, "%s", HTML_W_SPACE HTML_F_FAMILY HTML_F_SIZE HTML_F_WEIGHT );
-	fprintf( htmlFilePtr, "%s", "\">\n");
-	return;
-}
+	int i;
+	int numOfFailed;
+	int numOfWorkers;
 
-/********************************************************************************
-*     FUNCTION: htmlFilePrintFooter
-*        INPUT: pointer to html file
-*       OUTPUT: /
-*  DESCRIPTION: This function prints html footer to file
-********************************************************************************/
+	userInput_s workerInput;
+	memArena_s memArena;
 
-void htmlFilePrintFooter( FILE *htmlFilePtr )
-{
-	fprintf( htmlFilePtr, "%s", "</div>\n</body>\n</html>");
-	return;
-}
+#ifdef USE_THREADS
+	int numOfStarted;
+	pthread_t *threadIds;
+	batchJob_s batchJob;
+#endif
 
-/********************************************************************************
- *     Function: getAsciiSymbol 
- *        Input: grayValue  - pixel gray scale ( 0 - 255 )
- *               bitGraphic - 1 , 2 , 3 , 4 bit graphic
- *               inverMode  - 1 for inverted
- *       Output: Ascii symbol 
- *  Description: This function returns ascii symbol 
- ********************************************************************************/
+	/* Each image is printed by one thread */
+	workerInput = *userInput;
+	workerInput.numOfThreads = 1;
 
-inline unsigned char getAsciiSymbol( unsigned char grayValue , int bitGraphic  , int invertMode )
-{
+	numOfWorkers = userInput->numOfThreads;
+	if( numOfWorkers > batchList->numOfImages ) {
+		numOfWorkers = batchList->numOfImages;
+	}
+
+	numOfFailed = 0;
+
+#ifdef USE_THREADS
+	if( numOfWorkers > 1 ) {
+
+		threadIds = malloc( (numOfWorkers - 1) * sizeof(pthread_t) );
+		if( threadIds == NULL ) {
+			printf("Cannot allocate memory for worker threads!\n");
+			return ERROR;
+		}
+
+		batchJob.batchList = batchList;
+		batchJob.userInput = &workerInput;
+		batchJob.nextImage = 0;
+		batchJob.numOfFailed = 0;
+		pthread_mutex_init( &batchJob.jobLock , NULL );
+
+		for( numOfStarted = 0 ; numOfStarted < numOfWorkers - 1 ; numOfStarted++ ) {
+			if( pthread_create( &threadIds[numOfStarted] , NULL , batchWorkerThread , &batchJob ) != 0 ) {
+				break;
+			}
+		}
+
+		/* Calling thread is the last worker, so images are printed even if no thread started */
+		batchWorkerThread( &batchJob );
 
-	char retSymbol;
+		for( i = 0 ; i < numOfStarted ; i++ ) {
+			pthread_join( threadIds[i] , NULL );
+		}
 
-	char tabel_1[] = "# ";					/* 1 bit graphic */
-	char tabel_2[] = "#6+ ";				/* 2 bit graphic */	
-	char tabel_3[] = "#&$21:- ";			/* 3 bit graphic */
-	char tabel_4[] = "##&8$62I1|:+-.  ";	/* 4 bit graphic */
+		pthread_mutex_destroy( &batchJob.jobLock );
+		free( threadIds );
 
-	/* Inverted mode */
-	if( invertMode == 1 ) {
-		grayValue = 255 - grayValue;
+		numOfFailed = batchJob.numOfFailed;
+		numOfWorkers = 0;						/* All images are done */
 	}
+#endif
 
-	/* Calculate return symbol according to bitGraphic and grayValue */
-	switch ( bitGraphic ) {
-		case 1:
-			retSymbol = tabel_1[grayValue/128];
-			break;
-		case 2:
-			retSymbol = tabel_2[grayValue/64];
-			break;
-		case 3:
-			retSymbol = tabel_3[grayValue/32];
-			break;
-		case 4:
-			retSymbol = tabel_4[grayValue/16];
-			break;
-				
-		default:
-			printf("%d Bit grapic not supported!\n" , bitGraphic );
-			retSymbol = 0;
+	/* Single thread */
+	if( numOfWorkers > 0 ) {
+		arenaInit( &memArena );
+		for( i = 0 ; i < batchList->numOfImages ; i++ ) {
+			if( printImageFile( batchList->imagePaths[i] , &memArena , &workerInput ) < 0 ) {
+				numOfFailed++;
+			}
+		}
+		arenaDestroy( &memArena );
 	}
 
-	return retSymbol;
+	printf(" Batch: %d of %d images printed\n" , batchList->numOfImages - numOfFailed , batchList->numOfImages );
 
+	return (numOfFailed == 0) ? OK : ERROR;
 }
 
+#ifdef USE_THREADS
 
 /********************************************************************************
- *     FUNCTION: makeGrayPixelMap
- *        INPUT: **grayImageMap - 2D map for retriving grayscale pixels
- *               *imageData     - image data struct
- *       OUTPUT: ERROR or OK
- *  DESCRIPTION: This function converts .bmp file to 2D gray pixel map
- ********************************************************************************/
+*     FUNCTION: batchWorkerThread
+*        INPUT: jobArg - pointer to batchJob_s
+*       OUTPUT: NULL
+*  DESCRIPTION: Worker thread - takes next image from list and prints it 
+*               until all images are taken
+********************************************************************************/
 
-int makeGrayPixelMap( unsigned char **grayImageMap , imageData_s *imageData )
+void * batchWorkerThread( void *jobArg )
 {
-	int i, j;
-	int line;
-	int pixel;
+	int image;
 	int retVal;
-	int usefullBytesInLine;
-	
-	FILE *filePtr;
-	unsigned char *lineBuffer;	
-	
-	/* Allocat memory for whole line of RGB pixels */
-	lineBuffer = malloc( imageData->imgWidthInBytes * sizeof(unsigned char));
-	if( lineBuffer == NULL ) {
-		printf("Cannot allocate memory for lineBuffer!\n");
-		return ERROR;
-	}
 
+	batchJob_s *batchJob;
+	memArena_s memArena;
 
-	/* Open image file */
-	filePtr = fopen( imageData->imgName , READ_BINARY_FILE );
-	if( filePtr == NULL ) {
-		printf("Cannot open file %s!\n", imageData->imgName );
-		free(lineBuffer);
-		return ERROR;
-	}
-
-	/* Move to begining of RBG pixels */
-	retVal = fseek( filePtr , imageData->pixelOffset , SEEK_SET );
-	if( retVal < 0 ) {
-		printf("Error: fseek function!\n");
-		free(lineBuffer);
-		fclose(filePtr);
-		return ERROR;
-	}
+	batchJob = jobArg;
 
-	/*************************************************************************/
-	/*                           Make gray image map                         */                
-	/*************************************************************************/
+	/* Buffers are reused for all images of this worker */
+	arenaInit( &memArena );
 
-	/* INFO: bmp format stores first pixel line on the end of file */
-	line = imageData->imgHeight - 1;
+	while( 1 ) {
 
-	/* INFO: bmp format adds zero bytes to the end of each line */
-	usefullBytesInLine = (imageData->imgWidthInBytes - imageData->paddedBytes );
+		pthread_mutex_lock( &batchJob->jobLock );
+		image = batchJob->nextImage;
+		batchJob->nextImage++;
+		pthread_mutex_unlock( &batchJob->jobLock );
 
-	/* Read all lines and store gray pixels in grayImageMap */
-	for( i=0 ; i < imageData->imgHeight ; i++ , line-- ) {	
-		
-		/* Read on line of RGB pixels */
-		retVal = fread( lineBuffer, 1 , imageData->imgWidthInBytes , filePtr );
-		if( retVal < 0 ) {
-			printf("Cannot read form file!\n");
-			free(lineBuffer);
-			fclose(filePtr);
-			return ERROR;
+		if( image >= batchJob->batchList->numOfImages ) {
+			break;
 		}
-	
 
-		/* Convert line of RGB pixels to line of gray pixels */
-		for( j=0 , pixel=0 ; j < usefullBytesInLine  ; j=j+3 , pixel++ ) {
-			/* Store gray pixel */	
-			grayImageMap[line][pixel] = pixelToGray( lineBuffer[j], lineBuffer[j+1], lineBuffer[j+2]);
-				
+		retVal = printImageFile( batchJob->batchList->imagePaths[image] , &memArena , batchJob->userInput );
+		if( retVal < 0 ) {
+			pthread_mutex_lock( &batchJob->jobLock );
+			batchJob->numOfFailed++;
+			pthread_mutex_unlock( &batchJob->jobLock );
 		}
 	}
 
-	/* Clean up */
-	fclose(filePtr);
-	free(lineBuffer);
-
-	return OK;
+	arenaDestroy( &memArena );
 
+	return NULL;
 }
 
+#endif /* USE_THREADS */
+
 /********************************************************************************
-*     FUNCTION: pixelToGray
-*        INPUT: redPix   - color value ( 0 - 255 ) 
-*               greenPix - color value ( 0 - 255 ) 
-*               bluePix  - color value ( 0 - 255 ) 
-*       OUTPUT: Gray pixel value
-*  DESCRIPTION: This function return gray-scale pixel
+*     FUNCTION: batchListAddPath
+*        INPUT: batchList - list of images
+*               imagePath - image, directory or - ( list on standard input )
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function adds image, all .bmp images in directory or 
+*               all images listed on standard input ( one per line ) to list
 ********************************************************************************/
 
-inline unsigned char pixelToGray( unsigned char redPix , unsigned char greenPix , unsigned char bluePix )
+int batchListAddPath( batchList_s *batchList , char *imagePath )
 {
-	unsigned char retVal = (int) (redPix + greenPix + bluePix ) / 3;
-	return retVal;
+#ifndef WINDOWS
+	struct stat fileStat;
+#endif
+
+	if( strcmp( imagePath , "-" ) == 0 ) {
+		return batchListAddStream( batchList , stdin );
+	}
+
+#ifndef WINDOWS
+	if( (stat( imagePath , &fileStat ) == 0) && S_ISDIR( fileStat.st_mode ) ) {
+		return batchListAddDirectory( batchList , imagePath );
+	}
+#endif
 
+	return batchListAddImage( batchList , imagePath );
 }
 
 /********************************************************************************
-*     FUNCTION: storeBmpImageData
-*        INPUT: imagePath - image location on filesystem
-*               imageData - structure for retrived data
+*     FUNCTION: batchListAddImage
+*        INPUT: batchList - list of images
+*               imagePath - image location on filesystem
 *       OUTPUT: ERROR or OK
-*  DESCRIPTION: This function retrives data from image header and stores data
-*               in imageData_s
+*  DESCRIPTION: This function adds copy of image path to list
 ********************************************************************************/
 
-int storeBmpImageData( char *imagePath , imageData_s *imageData )
+int batchListAddImage( batchList_s *batchList , char *imagePath )
 {
-	int retVal;
-	FILE *filePtr;
+	char **newPaths;
 
-	unsigned char imageHeader[BMP_HEADER_SIZE];
-
-	/* Open and read image header */	
-	filePtr = fopen( imagePath , "r" );
-	if( filePtr == NULL ) {
-		printf("Cannot open file %s!\n", imagePath );
-		return ERROR;
-	}
-
-	retVal = fread( imageHeader, 1 , BMP_HEADER_SIZE , filePtr );
-	if( retVal < 0 ) {
-		printf("Cannot read form file %s!\n", imagePath );
-		return ERROR;
+	/* Enlarge list */
+	if( batchList->numOfImages == batchList->listSize ) {
+		newPaths = realloc( batchList->imagePaths , (batchList->listSize * 2 + 16) * sizeof(char *) );
+		if( newPaths == NULL ) {
+			printf("Cannot allocate memory for list of images!\n");
+			return ERROR;
+		}
+		batchList->imagePaths = newPaths;
+		batchList->listSize = batchList->listSize * 2 + 16;
 	}
 
-	fclose(filePtr);
-	
-	/* Check image format */
-	if( !isBmpFormat(imageHeader) ) {
-		printf("File %s is not .bmp file!\n", imagePath );
-		return ERROR;
-	}
-	
-	/* Check image name */
-	if(	strlen( imagePath ) > IMAGE_NAME_LEN ) {
-		printf("Image path to long to store!\n");
+	batchList->imagePaths[batchList->numOfImages] = malloc( strlen( imagePath ) + 1 );
+	if( batchList->imagePaths[batchList->numOfImages] == NULL ) {
+		printf("Cannot allocate memory for list of images!\n");
 		return ERROR;
 	}
-
-	/* Store image data in structure */	
-	memset( imageData->imgName , 0 , IMAGE_NAME_LEN+1 );
-	strncpy( imageData->imgName , imagePath , IMAGE_NAME_LEN );
-
-	imageData->imgWidth = bmpGetWidth(imageHeader);
-	imageData->imgHeight = bmpGetHeight(imageHeader);
-	imageData->imgRawSize = bmpGetRawSize(imageHeader);
-	imageData->pixelOffset = bmpGetOffset(imageHeader);
-	imageData->imgFileSize = bmpGetFileSize(imageHeader);
-
-	imageData->paddedBytes = bmpGetPaddedBytes( imageData->imgWidth );
-	imageData->imgWidthInBytes = bmpGetWidthInBytes( imageData->imgWidth );
+	strcpy( batchList->imagePaths[batchList->numOfImages] , imagePath );
+	batchList->numOfImages++;
 
 	return OK;
-
 }
 
-
 /********************************************************************************
- *     FUNCTION: bmpGetWidthInBytes
- *        INPUT: pixelWidth - width in pixels
- *       OUTPUT: Width in bytes
- *  DESCRIPTION: This function returns width of image array in bytes. Whidth is
- *               affected by number of pixels and zero byte padding.
- *               In bmp standard number of bytes in one line must be multiple of 
- *               number 4. If it is not zero bytes are added.
- ********************************************************************************/
+*     FUNCTION: batchListAddDirectory
+*        INPUT: batchList - list of images
+*               dirPath   - directory location on filesystem
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function adds all files with .bmp extension in directory
+********************************************************************************/
 
-int bmpGetWidthInBytes( int pixelWidth )
+int batchListAddDirectory( batchList_s *batchList , char *dirPath )
 {
+#ifndef WINDOWS
+	int nameLen;
+	int pathLen;
+	char imagePath[IMAGE_NAME_LEN+1];
 
-	int byteWidth;
-
-	byteWidth = pixelWidth * 3;			/* For 24-bit image depth */
-
-	switch( byteWidth % 4 ) {  
-		case 0 :						/* Nothing padded  */	
-			break;
+	DIR *dirPtr;
+	struct dirent *dirEntry;
 
-		case 1 : 
-			byteWidth = byteWidth + 3;	/* 3 zero bytes padded */
-			break;
+	dirPtr = opendir( dirPath );
+	if( dirPtr == NULL ) {
+		printf("Cannot open directory %s!\n", dirPath );
+		return ERROR;
+	}
 
-		case 2 :
-			byteWidth = byteWidth + 2;	/* 2 zero bytes padded */
-			break;
+	while( (dirEntry = readdir( dirPtr )) != NULL ) {
 
-		case 3 :
-			byteWidth = byteWidth + 1;	/* 1 zero bytes padded */
-			break;
+		nameLen = strlen( dirEntry->d_name );
+		if( (nameLen < 5) || (strcmp( dirEntry->d_name + nameLen - 4 , ".bmp" ) != 0) ) {
+			continue;
+		}
 
-		default:
-			printf("Cannot happen!\n");
+		/* Truncated path would name other file */
+		pathLen = snprintf( imagePath , IMAGE_NAME_LEN+1 , "%s/%s" , dirPath , dirEntry->d_name );
+		if( (pathLen < 0) || (pathLen > IMAGE_NAME_LEN) ) {
+			printf("Path %s/%s is too long!\n", dirPath , dirEntry->d_name );
+			continue;
+		}
 
+		if( batchListAddImage( batchList , imagePath ) < 0 ) {
+			closedir( dirPtr );
+			return ERROR;
+		}
 	}
 
-	return byteWidth;
+	closedir( dirPtr );
+#endif
 
+	return OK;
 }
 
+/********************************************************************************
+*     FUNCTION: batchListAddStream
+*        INPUT: batchList   - list of images
+*               listFilePtr - opened file with one image path per line
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function adds all images listed in file
+********************************************************************************/
+
+int batchListAddStream( batchList_s *batchList , FILE *listFilePtr )
+{
+	int pathLen;
+	char imagePath[IMAGE_NAME_LEN+2];
+
+	while( fgets( imagePath , IMAGE_NAME_LEN+2 , listFilePtr ) != NULL ) {
+
+		/* Remove end of line */
+		pathLen = strlen( imagePath );
+		while( (pathLen > 0) && ((imagePath[pathLen-1] == '\n') || (imagePath[pathLen-1] == '\r')) ) {
+			pathLen--;
+			imagePath[pathLen] = '\0';
+		}
+
+		if( pathLen == 0 ) {
+			continue;
+		}
+
+		if( batchListAddImage( batchList , imagePath ) < 0 ) {
+			return ERROR;
+		}
+	}
+
+	return OK;
+}
 
 /********************************************************************************
- *     FUNCTION: bmpGetPaddedBytes
- *        INPUT: pixelWidth - width in pixels
- *       OUTPUT: Padded bytes
- *  DESCRIPTION: This function returns number of added bytes.
- *               In bmp standard number of bytes in one line must be multiple of 
- *               number 4. If it is not, zero bytes are added.
- ********************************************************************************/
+*     FUNCTION: batchListDestroy
+*        INPUT: batchList - list of images
+*       OUTPUT: /
+*  DESCRIPTION: This function frees list of images
+********************************************************************************/
 
-int bmpGetPaddedBytes( int pixelWidth )
+void batchListDestroy( batchList_s *batchList )
 {
+	int i;
 
-	int byteWidth;
-	int paddedBytes;
+	for( i = 0 ; i < batchList->numOfImages ; i++ ) {
+		free( batchList->imagePaths[i] );
+	}
+	free( batchList->imagePaths );
 
-	paddedBytes = 0;
+	batchList->imagePaths = NULL;
+	batchList->numOfImages = 0;
+	batchList->listSize = 0;
 
-	byteWidth = pixelWidth * 3;		/* For 24-bit image depth */
-	
-	switch( byteWidth % 4 ) {  
-		case 0 :				/* Nothing padded  */	
-			break;
+	return;
+}
 
-		case 1 : 
-			paddedBytes = 3;	/* 3 zero bytes padded */
-			break;
+/********************************************************************************
+*     FUNCTION: isOptionWithValue
+*        INPUT: optionArg - command line argument
+*       OUTPUT: True (1) or false (0)
+*  DESCRIPTION: This function checks if argument is option followed by value
+********************************************************************************/
 
-		case 2 :
-			paddedBytes = 2;	/* 2 zero bytes padded */
-			break;
+int isOptionWithValue( char *optionArg )
+{
+	if( (strcmp( optionArg , "-b" ) == 0) || (strcmp( optionArg , "--bitGraphic" ) == 0) ||
+		(strcmp( optionArg , "-s" ) == 0) || (strcmp( optionArg , "--size" ) == 0) ||
+		(strcmp( optionArg , "-t" ) == 0) || (strcmp( optionArg , "--threads" ) == 0) ||
+		(strcmp( optionArg , "--luma" ) == 0) || (strcmp( optionArg , "--ramp" ) == 0) ||
+		(strcmp( optionArg , "--serve" ) == 0) || (strcmp( optionArg , "--cache" ) == 0) ||
+		(strcmp( optionArg , "--color" ) == 0) || (strcmp( optionArg , "--memory" ) == 0) ||
+		(strcmp( optionArg , "--cols" ) == 0) || (strcmp( optionArg , "--rows" ) == 0) ||
+		(strcmp( optionArg , "--aspect" ) == 0) || (strcmp( optionArg , "--dither" ) == 0) ||
+		(strcmp( optionArg , "--grayCache" ) == 0) || (strcmp( optionArg , "--grayCacheMb" ) == 0) ) {
+		return 1;
+	}
 
-		case 3 :
-			paddedBytes = 1;	/* 1 zero bytes padded */
-			break;
+	return 0;
+}
 
-		default:
-			printf("Cannot happen!\n");
+/********************************************************************************
+*     FUNCTION: parseSizeLevels
+*        INPUT: sizeArg - all or comma separated sizes ( 2,6,10 )
+*       OUTPUT: Bit of each size ( 1 << sizeMode ) or 0 when list is not valid
+*  DESCRIPTION: /
+********************************************************************************/
+
+int parseSizeLevels( char *sizeArg )
+{
+	int sizeMode;
+	int sizeLevels;
+	char *endPtr;
 
+	if( strcmp( sizeArg , "all" ) == 0 ) {
+		return PYRAMID_ALL_SIZES;
 	}
 
-	return paddedBytes;
+	sizeLevels = 0;
+	while( *sizeArg != '\0' ) {
+		sizeMode = (int) strtol( sizeArg , &endPtr , 10 );
+		if( (endPtr == sizeArg) || (sizeMode < 1) || (sizeMode > 10) || ((*endPtr != ',') && (*endPtr != '\0')) ) {
+			return 0;
+		}
+		sizeLevels = sizeLevels | (1 << sizeMode);
+		sizeArg = (*endPtr == ',') ? endPtr + 1 : endPtr;
+	}
 
+	return sizeLevels;
 }
 
 /********************************************************************************
- *     FUNCTION: bmpGetFileSize
- *        INPUT: *imgHeader - pointer to image header
- *       OUTPUT: Acctual file size
- *  DESCRIPTION: /
- ********************************************************************************/
+*     FUNCTION: initUserInput
+*        INPUT: userInput - structure for storing user input data
+*       OUTPUT: /
+*  DESCRIPTION: This function initializes userInput_s
+********************************************************************************/
 
-int bmpGetFileSize( unsigned char *imgHeader )
+void initUserInput( userInput_s *userInput )
 {
-	return byteToInt( imgHeader , BMP_H_FILE_SIZE , 4 ); 
+	userInput->infoFlag = 0;
+	userInput->invertFlag = 0;
+	userInput->sizeMode = 6;
+	userInput->sizeLevels = 0;
+	userInput->bitGraphic = 4;
+	userInput->asciiRamp = NULL;
+	userInput->htmlMode = 0;
+	userInput->colorMode = COLOR_NONE;
+	userInput->bandMode = 0;
+	userInput->grayMode = GRAY_AVERAGE;
+	userInput->integralMode = 0;
+	userInput->shapeMode = 0;
+	userInput->ditherMode = DITHER_NONE;
+	userInput->maskMode = MASK_NONE;
+	userInput->gzipMode = 0;
+	userInput->numOfThreads = 1;
+	userInput->batchMode = 0;
+	userInput->renderStats = NULL;
+	userInput->servePath = NULL;
+	userInput->streamMode = 0;
+	userInput->cacheSizeMb = SERVE_CACHE_MB;
+	userInput->memoryLimitMb = MEMORY_LIMIT_MB;
+	userInput->outCols = 0;
+	userInput->outRows = 0;
+	userInput->cellAspect = RESAMPLE_ASPECT;
+	userInput->grayCacheDir = NULL;
+	userInput->grayCacheMb = GRAY_CACHE_MB;
+	
+	return;
 }
 
+
 /********************************************************************************
- *     FUNCTION: bmpGetOffset
- *        INPUT: *imgHeader - pointer to image header
- *       OUTPUT: Offset where the pixel array starts in bmp file 
- *  DESCRIPTION: /
- ********************************************************************************/
+*     FUNCTION: arenaInit
+*        INPUT: memArena - arena structure
+*       OUTPUT: /
+*  DESCRIPTION: This function initializes empty arena ( for arenaReserve )
+********************************************************************************/
 
-int bmpGetOffset( unsigned char *imgHeader )
+void arenaInit( memArena_s *memArena )
 {
-	return byteToInt( imgHeader , BMP_H_OFFSET , 4 ); 
+	memArena->memBlock = NULL;
+	memArena->memStart = NULL;
+	memArena->memSize = 0;
+	memArena->memUsed = 0;
+
+	return;
 }
 
 /********************************************************************************
- *     FUNCTION: bmpGetWidth
- *        INPUT: *imgHeader - pointer to image header
- *       OUTPUT: Image width in pixels
- *  DESCRIPTION: /
- ********************************************************************************/
+*     FUNCTION: arenaAttach
+*        INPUT: memArena - arena structure
+*               memBlock - memory of caller
+*               memSize  - size of memBlock ( CACHE_LINE_SIZE more than sum of
+*                          arenaBlockSize of all blocks )
+*       OUTPUT: /
+*  DESCRIPTION: This function makes arena in memory of caller. Such arena is
+*               not freed with arenaDestroy.
+********************************************************************************/
 
-int bmpGetWidth( unsigned char *imgHeader )
+void arenaAttach( memArena_s *memArena , void *memBlock , size_t memSize )
 {
-	return byteToInt( imgHeader , BMP_H_WIDTH , 4 ); 
+	size_t alignSize;
+
+	alignSize = (CACHE_LINE_SIZE - ((size_t) memBlock % CACHE_LINE_SIZE)) % CACHE_LINE_SIZE;
+
+	memArena->memBlock = NULL;
+	memArena->memStart = (unsigned char *) memBlock + alignSize;
+	memArena->memSize = (memSize > alignSize) ? memSize - alignSize : 0;
+	memArena->memUsed = 0;
+
+	return;
 }
 
 /********************************************************************************
- *     FUNCTION: bmpGetHeight
- *        INPUT: *imgHeader - pointer to image header
- *       OUTPUT: Image height in pixels
- *  DESCRIPTION: /
- ********************************************************************************/
+*     FUNCTION: arenaCreate
+*        INPUT: memArena - arena structure
+*               memSize  - size of arena ( sum of arenaBlockSize of all blocks )
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function allocates one memory block, from which all 
+*               buffers of one image are taken. Start of block is aligned to
+*               CACHE_LINE_SIZE.
+********************************************************************************/
 
-int bmpGetHeight( unsigned char *imgHeader )
+int arenaCreate( memArena_s *memArena , size_t memSize )
 {
-	return byteToInt( imgHeader , BMP_H_HEIGHT , 4 ); 
+	memArena->memBlock = NULL;
+	if( memSize <= SIZE_MAX - CACHE_LINE_SIZE ) {
+		memArena->memBlock = malloc( memSize + CACHE_LINE_SIZE );
+	}
+	if( memArena->memBlock == NULL ) {
+		printf("Cannot allocate memory for image buffers!\n");
+		return ERROR;
+	}
+
+	/* Align start of arena */
+	memArena->memStart = memArena->memBlock + 
+		(CACHE_LINE_SIZE - ((size_t) memArena->memBlock % CACHE_LINE_SIZE)) % CACHE_LINE_SIZE;
+	memArena->memSize = memSize;
+	memArena->memUsed = 0;
+
+	return OK;
 }
 
 /********************************************************************************
- *     FUNCTION: bmpGetRawSize
- *        INPUT: *imgHeader - pointer to image header
- *       OUTPUT: Raw size of image data (including padded bytes)
- *  DESCRIPTION: Returns raw size of image data
- ********************************************************************************/
+*     FUNCTION: arenaReserve
+*        INPUT: memArena - initialized or created arena
+*               memSize  - size of arena ( sum of arenaBlockSize of all blocks )
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function empties arena for next image. Memory block is 
+*               allocated again only when it is smaller than memSize.
+********************************************************************************/
 
-int bmpGetRawSize( unsigned char *imgHeader )
+int arenaReserve( memArena_s *memArena , size_t memSize )
 {
-	return byteToInt( imgHeader , BMP_H_RAW_SIZE , 4 ); 
+	if( (memArena->memBlock != NULL) && (memArena->memSize >= memSize) ) {
+		memArena->memUsed = 0;
+		return OK;
+	}
+
+	arenaDestroy( memArena );
+
+	return arenaCreate( memArena , memSize );
 }
 
 /********************************************************************************
- *     FUNCTION: byteToInt
- *        INPUT: *dataArray  - pointer to array of bytes
- *               dataOffset  - offset in array
- *               numOfBytes  - number of bytes
- *       OUTPUT: Integer value
- *  DESCRIPTION: This function reads given number of bytes starting form offset
- *               and returns integer value writen in this bytes
- ********************************************************************************/
+*     FUNCTION: arenaAlloc
+*        INPUT: memArena  - arena structure
+*               allocSize - requested size
+*       OUTPUT: NULL or pointer to aligned memory
+*  DESCRIPTION: This function takes next aligned block from arena
+********************************************************************************/
 
-int byteToInt( unsigned char *dataArray , int dataOffset , int numOfBytes ) 
+void * arenaAlloc( memArena_s *memArena , size_t allocSize )
 {
-	int i;	
-	int tmpInt;
-	int retVal;
+	void *retPtr;
 
-	retVal = 0;
+	if( arenaBlockSize( allocSize ) > (memArena->memSize - memArena->memUsed) ) {
+		return NULL;
+	}
 
-	if( numOfBytes <= 0 ) return 0;
+	retPtr = memArena->memStart + memArena->memUsed;
+	memArena->memUsed = memArena->memUsed + arenaBlockSize( allocSize );
 
-	/* Get value */
-	for( i = 0 ; i < numOfBytes ; i++ ) {
-		tmpInt = (int) pow( 256 , i );
-		retVal = retVal + ((int) dataArray[ dataOffset+i ] * tmpInt  );
+	return retPtr;
+}
+
+/********************************************************************************
+*     FUNCTION: arenaBlockSize
+*        INPUT: allocSize - requested size
+*       OUTPUT: Size that allocSize takes in arena
+*  DESCRIPTION: Blocks in arena are rounded up to CACHE_LINE_SIZE
+********************************************************************************/
+
+size_t arenaBlockSize( size_t allocSize )
+{
+	if( allocSize > SIZE_MAX - CACHE_LINE_SIZE ) {
+		return SIZE_MAX;						/* Overflow - allocation fails */
 	}
 
-	return retVal;
+	return ((allocSize + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE) * CACHE_LINE_SIZE;
+}
 
+/********************************************************************************
+*     FUNCTION: arenaDestroy
+*        INPUT: memArena - arena structure
+*       OUTPUT: /
+*  DESCRIPTION: This function frees arena and all blocks taken from it
+********************************************************************************/
+
+void arenaDestroy( memArena_s *memArena )
+{
+	free( memArena->memBlock );
+	memArena->memBlock = NULL;
+	memArena->memStart = NULL;
+	memArena->memSize = 0;
+	memArena->memUsed = 0;
+
+	return;
 }
 
 /********************************************************************************
- *     FUNCTION: isBmpFormat
- *        INPUT: imgHeader - image header file
- *       OUTPUT: True (1) or false (0) 
- *  DESCRIPTION: This function checks image header if file is in BMP format 
- ********************************************************************************/
+*     FUNCTION: createPixelMap
+*        INPUT: pixelMap    - pixel map structure
+*               memArena    - arena with at least pixelMapSize free bytes
+*               heightInPix - map height
+*               widthInPix  - map width
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function takes memory for gray scale pixel map from arena.
+*               All lines are in one block, each line starts on cache line.
+********************************************************************************/
 
-int isBmpFormat( unsigned char *imgHeader )
+int createPixelMap( pixelMap_s *pixelMap , memArena_s *memArena , int heightInPix , int widthInPix )
 {
-	if( ( imgHeader[0] == 0x42 ) &&				/* First byte in file  */
-		( imgHeader[1] == 0x4d ) ) { 			/* Second byte in file */
-		return 1;
-	}	
+	pixelMap->width = widthInPix;
+	pixelMap->height = heightInPix;
+	pixelMap->stride = arenaBlockSize( widthInPix );
 
-	return 0;
+	pixelMap->pixels = arenaAlloc( memArena , pixelMapSize( heightInPix , widthInPix ) );
+	if( pixelMap->pixels == NULL ) {
+		printf("Cannot allocate memory for gray pixel map!\n");
+		return ERROR;
+	}
+
+	return OK;
 }
 
 /********************************************************************************
- *     FUNCTION: printImageInfo
- *        INPUT: imageData_s - image data holding structure
- *       OUTPUT: /
- *  DESCRIPTION: This function prints basic image data
- ********************************************************************************/
+*     FUNCTION: pixelMapSize
+*        INPUT: heightInPix - map height
+*               widthInPix  - map width
+*       OUTPUT: Size of pixel map in bytes
+*  DESCRIPTION: /
+********************************************************************************/
 
-void printImageInfo( imageData_s *imageData )
+size_t pixelMapSize( int heightInPix , int widthInPix )
 {
+	return sizeMultiply( heightInPix , arenaBlockSize( widthInPix ) );
+}
 
-	printf("-----------------------------------\n");
-	printf("Image info:\n");
+/********************************************************************************
+*     FUNCTION: createCellLine
+*        INPUT: cellLine    - cell line structure
+*               memArena    - arena with at least cellLineSize free bytes
+*               symbolWidth - pixels in one symbol ( horizontal )
+*               imageData   - image data structure
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function takes memory for symbol sums of one output line
+*               and for one decoded gray line from arena
+********************************************************************************/
 
-	printf(" -    file size: %d B\n -  image width: %d pixels\n - image height: %d pixels\n",
-			imageData->imgFileSize , imageData->imgWidth , imageData->imgHeight );
+int createCellLine( cellLine_s *cellLine , memArena_s *memArena , int symbolWidth , imageData_s *imageData )
+{
+	cellLine->symbolWidth = symbolWidth;
+	cellLine->symbolHeight = symbolWidth * 2;
 
-	printf(" - padded bytes: %d B\n - image header: %d B\n", imageData->paddedBytes,
-						imageData->pixelOffset );
+	/* Same number of symbols as in makeAsciiLine */
+	cellLine->numOfCells = 0;
+	if( imageData->imgWidth > symbolWidth ) {
+		cellLine->numOfCells = (imageData->imgWidth - 1) / symbolWidth;
+	}
 
-	printf("-----------------------------------\n");
-	return;	
+	cellLine->cellSums = arenaAlloc( memArena , sizeMultiply( cellLine->numOfCells + 1 , sizeof(uint32_t) ) );
+	cellLine->grayLine = arenaAlloc( memArena , imageData->imgWidth );
+	cellLine->colorColumns = NULL;
+	cellLine->cellColors = NULL;
+	cellLine->bgrLine = NULL;
+	if( (cellLine->cellSums == NULL) || (cellLine->grayLine == NULL) ) {
+		printf("Cannot allocate memory for output line sums!\n");
+		return ERROR;
+	}
 
+	return OK;
 }
 
 /********************************************************************************
- *     Function: helpFunction
- *        Input: /
- *       Output: /
- *  Description: This function prints help for this program
- ********************************************************************************/
+*     FUNCTION: cellLineSize
+*        INPUT: symbolWidth - pixels in one symbol ( horizontal )
+*               imageData   - image data structure
+*       OUTPUT: Size of cell line buffers in bytes
+*  DESCRIPTION: /
+********************************************************************************/
 
-void helpFunction( void )
+size_t cellLineSize( int symbolWidth , imageData_s *imageData )
 {
+	return sizeAdd( arenaBlockSize( sizeMultiply( imageData->imgWidth / symbolWidth + 1 , sizeof(uint32_t) ) ) , 
+			arenaBlockSize( imageData->imgWidth ) );
+}
 
-	printf("========================== HELP ==========================\n");
-	printf(" This program converts 24-bit .bmp image to ASCII image.\n");
-	printf("      Image is printed on standard output.\n\n");
+/********************************************************************************
+*     FUNCTION: createCellColors
+*        INPUT: cellLine    - cell line made by createCellLine
+*               memArena    - arena with at least cellColorsSize free bytes
+*               imageData   - image data structure
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function takes memory for color sums of each byte column
+*               of band and for color of each symbol from arena. With these
+*               buffers readBandCells sums colors too.
+********************************************************************************/
 
-	printf(" Usage: asciiImage FILE [OPTION] \n");
+int createCellColors( cellLine_s *cellLine , memArena_s *memArena , imageData_s *imageData )
+{
+	cellLine->colorColumns = arenaAlloc( memArena , sizeMultiply( imageData->imgWidth , 3 * sizeof(uint16_t) ) );
+	cellLine->cellColors = arenaAlloc( memArena , sizeMultiply( cellLine->numOfCells + 1 , sizeof(uint32_t) ) );
+	cellLine->bgrLine = arenaAlloc( memArena , sizeMultiply( imageData->imgWidth , 3 ) );
+	if( (cellLine->colorColumns == NULL) || (cellLine->cellColors == NULL) || (cellLine->bgrLine == NULL) ) {
+		printf("Cannot allocate memory for output line colors!\n");
+		return ERROR;
+	}
 
-	printf(" Options:\n");
-	printf(" -b, -bitGraphic    ... bit color option: 1 bit .. 4 bit\n");
-	printf(" -h, --help         ... this menu\n");
-	printf(" --html             ... print image to .html file\n");
-	printf(" --info             ... print image info\n");
-	printf(" -i, --invert       ... invert ascii colors\n");
-	printf(" -s, --size         ... size option [1-10]\n\n");
+	return OK;
+}
 
-	printf("==========================================================\n");
+/********************************************************************************
+*     FUNCTION: cellColorsSize
+*        INPUT: symbolWidth - pixels in one symbol ( horizontal )
+*               imageData   - image data structure
+*       OUTPUT: Size of color buffers in bytes
+*  DESCRIPTION: /
+********************************************************************************/
 
-	return;
+size_t cellColorsSize( int symbolWidth , imageData_s *imageData )
+{
+	return sizeAdd( sizeAdd( arenaBlockSize( sizeMultiply( imageData->imgWidth , 3 * sizeof(uint16_t) ) ) , 
+			arenaBlockSize( sizeMultiply( imageData->imgWidth / symbolWidth + 1 , sizeof(uint32_t) ) ) ) ,
+			arenaBlockSize( sizeMultiply( imageData->imgWidth , 3 ) ) );
+}
+
+/********************************************************************************
+*     FUNCTION: createResampleLine
+*        INPUT: resampleLine - resample line structure
+*               memArena     - arena with at least resampleLineSize free bytes
+*               userInput    - user input data strucure
+*               imageData    - image data structure ( with outCols, outRows )
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function takes memory of one resampled output line from
+*               arena and computes horizontal weights. Source pixel x covers
+*               [x * cols, (x + 1) * cols) and symbol c covers [c * width, 
+*               (c + 1) * width), so overlap of pixel and symbol is integer 
+*               for any scale and every edge pixel belongs to some symbol.
+********************************************************************************/
+
+int createResampleLine( resampleLine_s *resampleLine , memArena_s *memArena , userInput_s *userInput , 
+					imageData_s *imageData )
+{
+	int pix;
+	int symIndex;
+	int numOfWeights;
+	int64_t symLeft;
+	int64_t symRight;
+	int64_t pixLeft;
+	int64_t pixRight;
+
+	resampleLine->numOfCols = imageData->outCols;
+	resampleLine->numOfRows = imageData->outRows;
+	resampleLine->cellArea = (uint64_t) imageData->imgWidth * imageData->imgHeight;
+	resampleLine->loadedLine = -1;
+
+	resampleLine->cellFirstPix = arenaAlloc( memArena , sizeMultiply( imageData->outCols , sizeof(int) ) );
+	resampleLine->weightStart = arenaAlloc( memArena , sizeMultiply( imageData->outCols + 1 , sizeof(int) ) );
+	resampleLine->pixWeights = arenaAlloc( memArena , sizeMultiply( sizeAdd( imageData->imgWidth , imageData->outCols ) , 
+							sizeof(uint32_t) ) );
+	resampleLine->rowSums = arenaAlloc( memArena , sizeMultiply( imageData->imgWidth , sizeof(uint64_t) ) );
+	resampleLine->grayLine = arenaAlloc( memArena , imageData->imgWidth );
+	resampleLine->colorSums = NULL;
+	resampleLine->colorPixels = NULL;
+	resampleLine->bgrLine = NULL;
+	resampleLine->cellColors = NULL;
+	if( userInput->colorMode != COLOR_NONE ) {
+		resampleLine->colorSums = arenaAlloc( memArena , sizeMultiply( imageData->imgWidth , 3 * sizeof(uint64_t) ) );
+		resampleLine->bgrLine = arenaAlloc( memArena , sizeMultiply( imageData->imgWidth , 3 ) );
+		resampleLine->cellColors = arenaAlloc( memArena , sizeMultiply( imageData->outCols , sizeof(uint32_t) ) );
+	}
+	if( (resampleLine->cellFirstPix == NULL) || (resampleLine->weightStart == NULL) || 
+		(resampleLine->pixWeights == NULL) || (resampleLine->rowSums == NULL) || (resampleLine->grayLine == NULL) ||
+		((userInput->colorMode != COLOR_NONE) && ((resampleLine->colorSums == NULL) || 
+		(resampleLine->bgrLine == NULL) || (resampleLine->cellColors == NULL))) ) {
+		printf("Cannot allocate memory for resampled line!\n");
+		return ERROR;
+	}
+
+	/* Each symbol has width pixel units, sum of all its weights */
+	numOfWeights = 0;
+	for( symIndex = 0 ; symIndex < resampleLine->numOfCols ; symIndex++ ) {
+
+		symLeft = (int64_t) symIndex * imageData->imgWidth;
+		symRight = symLeft + imageData->imgWidth;
+
+		resampleLine->cellFirstPix[symIndex] = (int) (symLeft / resampleLine->numOfCols);
+		resampleLine->weightStart[symIndex] = numOfWeights;
+
+		for( pix = resampleLine->cellFirstPix[symIndex] ; pix <= (symRight - 1) / resampleLine->numOfCols ; pix++ ) {
+			pixLeft = (int64_t) pix * resampleLine->numOfCols;
+			pixRight = pixLeft + resampleLine->numOfCols;
+			resampleLine->pixWeights[numOfWeights] = (uint32_t) (((pixRight < symRight) ? pixRight : symRight) - 
+							((pixLeft > symLeft) ? pixLeft : symLeft));
+			numOfWeights++;
+		}
+	}
+	resampleLine->weightStart[resampleLine->numOfCols] = numOfWeights;
 
+	return OK;
 }
+
+/********************************************************************************
+*     FUNCTION: resampleLineSize
+*        INPUT: userInput   - user input data strucure
+*               imageData   - image data structure ( with outCols, outRows )
+*       OUTPUT: Size of resample line buffers in bytes
+*  DESCRIPTION: /
+********************************************************************************/
+
+size_t resampleLineSize( userInput_s *userInput , imageData_s *imageData )
+{
+	size_t lineSize;
+
+	lineSize = sizeAdd( arenaBlockSize( sizeMultiply( imageData->outCols , sizeof(int) ) ) , 
+				arenaBlockSize( sizeMultiply( imageData->outCols + 1 , sizeof(int) ) ) );
+	lineSize = sizeAdd( lineSize , arenaBlockSize( sizeMultiply( sizeAdd( imageData->imgWidth , imageData->outCols ) , 
+				sizeof(uint32_t) ) ) );
+	lineSize = sizeAdd( lineSize , arenaBlockSize( sizeMultiply( imageData->imgWidth , sizeof(uint64_t) ) ) );
+	lineSize = sizeAdd( lineSize , arenaBlockSize( imageData->imgWidth ) );
+
+	if( userInput->colorMode != COLOR_NONE ) {
+		lineSize = sizeAdd( lineSize , arenaBlockSize( sizeMultiply( imageData->imgWidth , 3 * sizeof(uint64_t) ) ) );
+		lineSize = sizeAdd( lineSize , arenaBlockSize( sizeMultiply( imageData->imgWidth , 3 ) ) );
+		lineSize = sizeAdd( lineSize , arenaBlockSize( sizeMultiply( imageData->outCols , sizeof(uint32_t) ) ) );
+	}
+
+	return lineSize;
+}
+
+/********************************************************************************
+*     FUNCTION: createIntegralImage
+*        INPUT: integralImage - integral image structure
+*               memArena      - arena with at least integralImageSize free bytes
+*               grayImageMap  - gray scale image map
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function builds summed-area table of gray pixel map. 
+*               Entry (x,y) holds sum of all pixels above and left of (x,y).
+*               32-bit sums are used when sum of whole map fits to 32 bits.
+********************************************************************************/
+
+int createIntegralImage( integralImage_s *integralImage , memArena_s *memArena , pixelMap_s *grayImageMap )
+{
+	int xAxe;
+	int yAxe;
+	uint64_t lineSum;
+	unsigned char *mapLine;
+
+	uint32_t *sums32Line;
+	uint64_t *sums64Line;
+
+	integralImage->width = grayImageMap->width + 1;
+	integralImage->height = grayImageMap->height + 1;
+	integralImage->sums32 = NULL;
+	integralImage->sums64 = NULL;
+
+	if( (uint64_t) grayImageMap->width * grayImageMap->height * 255 <= UINT32_MAX ) {
+		integralImage->sums32 = arenaAlloc( memArena , integralImageSize( grayImageMap->height , grayImageMap->width ) );
+		if( integralImage->sums32 == NULL ) {
+			printf("Cannot allocate memory for integral image!\n");
+			return ERROR;
+		}
+		memset( integralImage->sums32 , 0 , integralImage->width * sizeof(uint32_t) );
+	} else {
+		integralImage->sums64 = arenaAlloc( memArena , integralImageSize( grayImageMap->height , grayImageMap->width ) );
+		if( integralImage->sums64 == NULL ) {
+			printf("Cannot allocate memory for integral image!\n");
+			return ERROR;
+		}
+		memset( integralImage->sums64 , 0 , integralImage->width * sizeof(uint64_t) );
+	}
+
+	/* Each entry is entry above plus sum of line up to this pixel */
+	for( yAxe = 1 ; yAxe < integralImage->height ; yAxe++ ) {
+
+		mapLine = PIXEL_MAP_LINE( grayImageMap , yAxe - 1 );
+		lineSum = 0;
+
+		if( integralImage->sums32 != NULL ) {
+			sums32Line = integralImage->sums32 + (size_t) yAxe * integralImage->width;
+			sums32Line[0] = 0;
+			for( xAxe = 1 ; xAxe < integralImage->width ; xAxe++ ) {
+				lineSum = lineSum + mapLine[xAxe - 1];
+				sums32Line[xAxe] = sums32Line[xAxe - integralImage->width] + (uint32_t) lineSum;
+			}
+		} else {
+			sums64Line = integralImage->sums64 + (size_t) yAxe * integralImage->width;
+			sums64Line[0] = 0;
+			for( xAxe = 1 ; xAxe < integralImage->width ; xAxe++ ) {
+				lineSum = lineSum + mapLine[xAxe - 1];
+				sums64Line[xAxe] = sums64Line[xAxe - integralImage->width] + lineSum;
+			}
+		}
+	}
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: integralImageSize
+*        INPUT: heightInPix - map height
+*               widthInPix  - map width
+*       OUTPUT: Size of integral image in bytes
+*  DESCRIPTION: /
+********************************************************************************/
+
+size_t integralImageSize( int heightInPix , int widthInPix )
+{
+	size_t entrySize;
+
+	entrySize = sizeof(uint32_t);
+	if( (uint64_t) widthInPix * heightInPix * 255 > UINT32_MAX ) {
+		entrySize = sizeof(uint64_t);
+	}
+
+	return arenaBlockSize( sizeMultiply( sizeMultiply( (size_t) heightInPix + 1 , (size_t) widthInPix + 1 ) , entrySize ) );
+}
+
+/********************************************************************************
+*     FUNCTION: integralRectSum
+*        INPUT: integralImage - integral image
+*               xAxe, yAxe    - upper left pixel of rectangle
+*               rectWidth     - width of rectangle
+*               rectHeight    - height of rectangle
+*       OUTPUT: Sum of all gray pixels in rectangle
+*  DESCRIPTION: Sum is calculated from four entries of integral image
+********************************************************************************/
+
+static inline uint64_t integralRectSum( integralImage_s *integralImage , int xAxe , int yAxe , int rectWidth , int rectHeight )
+{
+	size_t topLeft;
+	size_t bottomLeft;
+
+	topLeft = (size_t) yAxe * integralImage->width + xAxe;
+	bottomLeft = (size_t) (yAxe + rectHeight) * integralImage->width + xAxe;
+
+	/* 32-bit sums wrap around, difference is still correct */
+	if( integralImage->sums32 != NULL ) {
+		return (uint32_t) ( integralImage->sums32[bottomLeft + rectWidth] - integralImage->sums32[bottomLeft]
+						  - integralImage->sums32[topLeft + rectWidth] + integralImage->sums32[topLeft] );
+	}
+
+	return integralImage->sums64[bottomLeft + rectWidth] - integralImage->sums64[bottomLeft]
+		 - integralImage->sums64[topLeft + rectWidth] + integralImage->sums64[topLeft];
+}
+
+/********************************************************************************
+*     FUNCTION: printAsciiImage
+*        INPUT: *grayImageMap  - gray scale image map
+*               *integralImage - integral image of map or NULL
+*               memArena       - arena for output line
+*               userInput      - user input data strucure
+*               imageData      - image data structure
+*       OUTPUT:	ERROR or OK
+*  DESCRIPTION: This function prints ascii image to provided output. When 
+*               integral image is given symbols are averaged from it.
+********************************************************************************/
+
+int printAsciiImage( pixelMap_s *grayImageMap, integralImage_s *integralImage , memArena_s *memArena , 
+					userInput_s *userInput, imageData_s *imageData )
+{
+	int yAxe;	
+	int retVal;
+	int lineLen;
+	int symbolWidth;			/* How many pixels from one line is in one printed symbol */
+	int symbolHeight;			/* How many pixels from one column is in one printed symbol */
+	double startTime;
+	double cellsTime;			/* Averaging time, rest of loop is output */
+
+	char *bufferedLine;
+	
+	outputBuffer_s outBuffer;
+	dither_s dither;
+
+	/*************************************************************************/
+	/*                           Printing settings                           */                
+	/*************************************************************************/
+
+	/* Set width and height of one symbol - larger the width of symbol smaller the picture 
+	   ( pyramid level has levelScale times fewer pixels ) */
+	symbolWidth = getSymbolWidth( userInput->sizeMode ) / imageData->levelScale;
+	
+	/* Height to width ratio is 2:1 */
+	symbolHeight = symbolWidth * 2;
+
+	/* Allocate memory for output line */
+	bufferedLine = arenaAlloc( memArena , getAsciiLineSize( userInput , imageData ) );
+	if( bufferedLine == NULL ) {
+		printf("Could not allocate memory for bufferedLine!\n");
+		return ERROR;
+	}
+	
+	startTime = getWallTime();
+	cellsTime = 0;
+
+	if( ditherInit( &dither , getAsciiLineSize( userInput , imageData ) , userInput ) < 0 ) {
+		return ERROR;
+	}
+
+	/* Open console or html output - buffer for whole frame */
+	if( openAsciiOutput( &outBuffer , getAsciiNumOfLines( userInput , imageData ) , userInput , imageData ) < 0 ) {
+		ditherDestroy( &dither );
+		return ERROR ;
+	}
+
+	/*************************************************************************/
+	/*                           Print ascii image                           */                
+	/*************************************************************************/
+	
+	/* Move down the lines of 2D map */
+	for( yAxe = 0; yAxe < (imageData->imgHeight - symbolHeight); yAxe = yAxe + symbolHeight ) {
+	
+		cellsTime = cellsTime - getWallTime();
+		if( userInput->maskMode != MASK_NONE ) {
+			lineLen = makeAsciiLineMask( grayImageMap , integralImage , yAxe , symbolWidth , symbolHeight , 
+							bufferedLine , userInput , imageData );
+		} else if( userInput->shapeMode == 1 ) {
+			lineLen = makeAsciiLineShape( grayImageMap , integralImage , yAxe , symbolWidth , symbolHeight , 
+							bufferedLine , userInput , imageData );
+		} else if( integralImage != NULL ) {
+			lineLen = makeAsciiLineIntegral( integralImage , yAxe , symbolWidth , symbolHeight , bufferedLine , userInput , imageData );
+		} else {
+			lineLen = makeAsciiLine( grayImageMap , yAxe , symbolWidth , symbolHeight , bufferedLine , userInput , imageData );
+		}
+		ditherLine( &dither , bufferedLine , lineLen );
+		cellsTime = cellsTime + getWallTime();
+
+		outputAppendLine( &outBuffer , bufferedLine , lineLen );
+	
+	} /* END Move down the lines of 2D map */
+
+	/*************************************************************************/
+	/*                             Clean up                                  */
+	/*************************************************************************/
+	
+	retVal = closeAsciiOutput( &outBuffer , userInput );
+	ditherDestroy( &dither );
+
+	statsAddStage( userInput , STATS_CELLS , getWallTime() - cellsTime , 0 , 0 , 0 );
+	statsAddStage( userInput , STATS_EMIT , startTime + cellsTime , 0 , outBuffer.outWritten , 1 );
+
+	return retVal;
+
+}
+
+/********************************************************************************
+*     FUNCTION: printAsciiPyramid
+*        INPUT: *grayImageMap  - gray pixel map of whole image
+*               *memArena      - arena with at least pyramidSize free bytes
+*               userInput      - user input data strucure
+*               imageData      - image data structure
+*       OUTPUT:	ERROR or OK
+*  DESCRIPTION: This function prints image once for each size of sizeLevels,
+*               each size to its own file. Symbol of size is averaged from
+*               coarsest pyramid level its width is multiple of. Levels are
+*               made only when first needed, each one from previous level, 
+*               so image is decoded only once.
+********************************************************************************/
+
+int printAsciiPyramid( pixelMap_s *grayImageMap , memArena_s *memArena , userInput_s *userInput, imageData_s *imageData )
+{
+	int retVal;
+	int numOfLevels;			/* Levels made so far ( full map is first ) */
+	int levelDepth;
+	double startTime;
+
+	pixelMap_s levelMaps[PYRAMID_MAX_DEPTH + 1];
+	integralImage_s integralImage;
+	imageData_s levelData;
+	userInput_s levelInput;
+
+	levelMaps[0] = *grayImageMap;
+	numOfLevels = 1;
+	levelInput = *userInput;
+	retVal = OK;
+
+	for( levelInput.sizeMode = 1 ; levelInput.sizeMode <= 10 ; levelInput.sizeMode++ ) {
+
+		if( (userInput->sizeLevels & (1 << levelInput.sizeMode)) == 0 ) {
+			continue;
+		}
+
+		levelDepth = getLevelDepth( &levelInput );
+
+		/* 2 x 2 box filter of previous level */
+		if( levelDepth >= numOfLevels ) {
+			startTime = getWallTime();
+			for( ; numOfLevels <= levelDepth ; numOfLevels++ ) {
+				setPyramidLevel( &levelData , imageData , numOfLevels );
+				if( createPixelMap( &levelMaps[numOfLevels] , memArena , levelData.imgHeight , levelData.imgWidth ) < 0 ) {
+					return ERROR;
+				}
+				reducePixelMap( &levelMaps[numOfLevels - 1] , &levelMaps[numOfLevels] );
+			}
+			statsAddStage( userInput , STATS_CELLS , startTime , 0 , 0 , 0 );
+		}
+
+		setPyramidLevel( &levelData , imageData , levelDepth );
+
+		/* Integral image of level - average of any symbol costs four lookups */
+		if( userInput->integralMode == 1 ) {
+			startTime = getWallTime();
+			if( createIntegralImage( &integralImage , memArena , &levelMaps[levelDepth] ) < 0 ) {
+				return ERROR;
+			}
+			statsAddStage( userInput , STATS_CELLS , startTime , 0 , 0 , 0 );
+		}
+
+		if( printAsciiImage( &levelMaps[levelDepth] , (userInput->integralMode == 1) ? &integralImage : NULL , 
+							memArena , &levelInput , &levelData ) < 0 ) {
+			retVal = ERROR;
+		}
+	}
+
+	return retVal;
+}
+
+/********************************************************************************
+*     FUNCTION: reducePixelMap
+*        INPUT: *sourceMap     - pyramid level
+*               *levelMap      - next level, half width and height rounded up
+*       OUTPUT: /
+*  DESCRIPTION: Each pixel of levelMap is rounded average of 2 x 2 pixels of
+*               sourceMap. Last column and line of odd sized map are used 
+*               twice.
+********************************************************************************/
+
+void reducePixelMap( pixelMap_s *sourceMap , pixelMap_s *levelMap )
+{
+	int pix;
+	int line;
+	int pairPixels;				/* Level pixels with two source columns */
+	unsigned char *levelLine;
+	unsigned char *firstLine;
+	unsigned char *secondLine;
+
+	pairPixels = sourceMap->width / 2;
+
+	for( line = 0 ; line < levelMap->height ; line++ ) {
+
+		levelLine = PIXEL_MAP_LINE( levelMap , line );
+		firstLine = PIXEL_MAP_LINE( sourceMap , 2 * line );
+		secondLine = (2 * line + 1 < sourceMap->height) ? PIXEL_MAP_LINE( sourceMap , 2 * line + 1 ) : firstLine;
+
+		for( pix = 0 ; pix < pairPixels ; pix++ ) {
+			levelLine[pix] = (firstLine[2 * pix] + firstLine[2 * pix + 1] + 
+								secondLine[2 * pix] + secondLine[2 * pix + 1] + 2) >> 2;
+		}
+		if( pairPixels < levelMap->width ) {
+			levelLine[pix] = (firstLine[2 * pix] + secondLine[2 * pix] + 1) >> 1;
+		}
+	}
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: getLevelDepth
+*        INPUT: userInput      - user input data strucure
+*       OUTPUT: Pyramid level of sizeMode ( 0 for full gray pixel map )
+*  DESCRIPTION: Symbol width is divided by level scale ( 1 << depth ) without
+*               remainder. Regions of --shape and sub-pixels of --braille 
+*               and --blocks need full map.
+********************************************************************************/
+
+int getLevelDepth( userInput_s *userInput )
+{
+	int levelDepth;
+	int symbolWidth;
+
+	if( (userInput->shapeMode == 1) || (userInput->maskMode != MASK_NONE) ) {
+		return 0;
+	}
+
+	symbolWidth = getSymbolWidth( userInput->sizeMode );
+
+	levelDepth = 0;
+	while( (levelDepth < PYRAMID_MAX_DEPTH) && (symbolWidth % (2 << levelDepth) == 0) ) {
+		levelDepth++;
+	}
+
+	return levelDepth;
+}
+
+/********************************************************************************
+*     FUNCTION: setPyramidLevel
+*        INPUT: *levelData     - image data of level
+*               imageData      - image data structure
+*               levelDepth     - pyramid level
+*       OUTPUT: /
+*  DESCRIPTION: Size of level is rounded up, so level has same number of 
+*               symbols in line and same number of lines as full image.
+********************************************************************************/
+
+void setPyramidLevel( imageData_s *levelData , imageData_s *imageData , int levelDepth )
+{
+	*levelData = *imageData;
+
+	levelData->levelScale = 1 << levelDepth;
+	levelData->imgWidth = (int) (((int64_t) imageData->imgWidth + levelData->levelScale - 1) >> levelDepth);
+	levelData->imgHeight = (int) (((int64_t) imageData->imgHeight + levelData->levelScale - 1) >> levelDepth);
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: pyramidSize
+*        INPUT: userInput      - user input data strucure
+*               imageData      - image data structure
+*       OUTPUT: Size in bytes
+*  DESCRIPTION: Arena memory of printAsciiPyramid besides full gray pixel map -
+*               coarser levels and output line ( and integral image ) of 
+*               each size
+********************************************************************************/
+
+size_t pyramidSize( userInput_s *userInput , imageData_s *imageData )
+{
+	int levelDepth;
+	int maxDepth;
+	size_t arenaSize;
+
+	imageData_s levelData;
+	userInput_s levelInput;
+
+	arenaSize = 0;
+	maxDepth = 0;
+	levelInput = *userInput;
+
+	for( levelInput.sizeMode = 1 ; levelInput.sizeMode <= 10 ; levelInput.sizeMode++ ) {
+
+		if( (userInput->sizeLevels & (1 << levelInput.sizeMode)) == 0 ) {
+			continue;
+		}
+
+		levelDepth = getLevelDepth( &levelInput );
+		if( levelDepth > maxDepth ) {
+			maxDepth = levelDepth;
+		}
+
+		setPyramidLevel( &levelData , imageData , levelDepth );
+		arenaSize = sizeAdd( arenaSize , arenaBlockSize( getAsciiLineSize( &levelInput , &levelData ) ) );
+		if( userInput->integralMode == 1 ) {
+			arenaSize = sizeAdd( arenaSize , integralImageSize( levelData.imgHeight , levelData.imgWidth ) );
+		}
+	}
+
+	for( levelDepth = 1 ; levelDepth <= maxDepth ; levelDepth++ ) {
+		setPyramidLevel( &levelData , imageData , levelDepth );
+		arenaSize = sizeAdd( arenaSize , pixelMapSize( levelData.imgHeight , levelData.imgWidth ) );
+	}
+
+	return arenaSize;
+}
+
+/********************************************************************************
+*     FUNCTION: printAsciiImageBanded
+*        INPUT: imageFile      - opened image file
+*               userInput      - user input data strucure
+*               imageData      - image data structure
+*       OUTPUT:	ERROR or OK
+*  DESCRIPTION: This function prints ascii image to provided output without 
+*               creating whole gray pixel map. Only one band of symbolHeight
+*               lines is read from file, each decoded line is added straight
+*               to symbol sums of output line, which is printed after band.
+*               Memory usage depends only on image width.
+********************************************************************************/
+
+int printAsciiImageBanded( imageFile_s *imageFile , userInput_s *userInput, imageData_s *imageData )
+{
+	int yAxe;	
+	int retVal;
+	int lineLen;
+	int symbolWidth;			/* How many pixels from one line is in one printed symbol */
+	int symbolHeight;			/* How many pixels from one column is in one printed symbol */
+	size_t arenaSize;
+	double startTime;
+	double grayTime;			/* Reading and summing bands */
+	double cellsTime;			/* Averaging sums, rest of loop is output */
+
+	char *bufferedLine;
+	unsigned char *bandBuffer;	/* Raw RGB lines of one band, as stored in file */
+
+	cellLine_s cellLine;		/* Symbol sums of one output line */
+	memArena_s memArena;
+	
+	outputBuffer_s outBuffer;
+	dither_s dither;
+
+	/*************************************************************************/
+	/*                           Printing settings                           */                
+	/*************************************************************************/
+
+	symbolWidth = getSymbolWidth( userInput->sizeMode );
+	symbolHeight = symbolWidth * 2;
+
+	startTime = getWallTime();
+
+	/* One allocation for symbol sums, output line and ( if file is not mapped ) raw band */
+	arenaSize = sizeAdd( cellLineSize( symbolWidth , imageData ) , 
+				arenaBlockSize( getAsciiLineSize( userInput , imageData ) ) );
+	if( imageFile->fileData == NULL ) {
+		arenaSize = sizeAdd( arenaSize , arenaBlockSize( sizeMultiply( symbolHeight , imageData->imgWidthInBytes ) ) );
+	}
+	if( userInput->colorMode != COLOR_NONE ) {
+		arenaSize = sizeAdd( arenaSize , cellColorsSize( symbolWidth , imageData ) );
+	}
+
+	retVal = arenaCreate( &memArena , arenaSize );
+	if( retVal < 0 ) {
+		return ERROR;
+	}
+
+	/* Allocate memory for symbol sums */
+	retVal = createCellLine( &cellLine , &memArena , symbolWidth , imageData );
+	if( (retVal == OK) && (userInput->colorMode != COLOR_NONE) ) {
+		retVal = createCellColors( &cellLine , &memArena , imageData );
+	}
+	if( retVal < 0 ) {
+		arenaDestroy( &memArena );
+		return ERROR;
+	}
+
+	/* Allocate memory for output line */
+	bufferedLine = arenaAlloc( &memArena , getAsciiLineSize( userInput , imageData ) );
+
+	/* Mapped file is read in place, buffer is needed only for file reads */
+	bandBuffer = NULL;
+	if( imageFile->fileData == NULL ) {
+		bandBuffer = arenaAlloc( &memArena , sizeMultiply( symbolHeight , imageData->imgWidthInBytes ) );
+	}
+
+	statsAddStage( userInput , STATS_ALLOC , startTime , 0 , 0 , 1 );
+	startTime = getWallTime();
+	grayTime = 0;
+	cellsTime = 0;
+
+	if( ditherInit( &dither , getAsciiLineSize( userInput , imageData ) , userInput ) < 0 ) {
+		arenaDestroy( &memArena );
+		return ERROR;
+	}
+
+	/* Open console or html output - buffer for one line */
+	if( openAsciiOutput( &outBuffer , 1 , userInput , imageData ) < 0 ) {
+		ditherDestroy( &dither );
+		arenaDestroy( &memArena );
+		return ERROR ;
+	}
+
+	/*************************************************************************/
+	/*                           Print ascii image                           */                
+	/*************************************************************************/
+
+	retVal = OK;
+	
+	/* Read one band, print one line */
+	for( yAxe = 0; yAxe < (imageData->imgHeight - symbolHeight); yAxe = yAxe + symbolHeight ) {
+
+		grayTime = grayTime - getWallTime();
+		retVal = readBandCells( imageFile , &cellLine , bandBuffer , yAxe , userInput , imageData );
+		grayTime = grayTime + getWallTime();
+		if( retVal < 0 ) {
+			break;
+		}
+	
+		cellsTime = cellsTime - getWallTime();
+		lineLen = makeAsciiLineCells( &cellLine , bufferedLine , userInput );
+		ditherLine( &dither , bufferedLine , lineLen );
+		if( cellLine.cellColors != NULL ) {
+			makeCellColors( &cellLine , userInput );
+		}
+		cellsTime = cellsTime + getWallTime();
+
+		if( cellLine.cellColors != NULL ) {
+			outputAppendColorLine( &outBuffer , bufferedLine , cellLine.cellColors , lineLen );
+		} else {
+			outputAppendLine( &outBuffer , bufferedLine , lineLen );
+		}
+		outputFlush( &outBuffer );			/* First line is out after first band */
+	
+	} /* END Read one band, print one line */
+
+	/*************************************************************************/
+	/*                             Clean up                                  */
+	/*************************************************************************/
+	
+	if( closeAsciiOutput( &outBuffer , userInput ) < 0 ) {
+		retVal = ERROR;
+	}
+	ditherDestroy( &dither );
+
+	statsAddStage( userInput , STATS_GRAY , getWallTime() - grayTime , 
+					(long) yAxe * imageData->imgWidthInBytes , 0 , 0 );
+	statsAddStage( userInput , STATS_CELLS , getWallTime() - cellsTime , 0 , 0 , 0 );
+	statsAddStage( userInput , STATS_EMIT , startTime + grayTime + cellsTime , 0 , outBuffer.outWritten , 1 );
+ 
+	arenaDestroy( &memArena );
+
+	return retVal;
+
+}
+
+/********************************************************************************
+*     FUNCTION: printAsciiImageResampled
+*        INPUT: imageFile      - opened image file
+*               userInput      - user input data strucure
+*               imageData      - image data structure ( with outCols, outRows )
+*       OUTPUT:	ERROR or OK
+*  DESCRIPTION: This function prints image with exactly outCols x outRows 
+*               symbols ( --cols, --rows ). Symbols are area weighted 
+*               averages of source pixels, pixels on edge of two symbols 
+*               are shared by weight, so any scale works and no edge pixel
+*               is dropped. Like printAsciiImageBanded, only one output line
+*               is held in memory.
+********************************************************************************/
+
+int printAsciiImageResampled( imageFile_s *imageFile , userInput_s *userInput, imageData_s *imageData )
+{
+	int yAxe;
+	int retVal;
+	int lineLen;
+	size_t arenaSize;
+	double startTime;
+	double grayTime;			/* Reading and summing source lines */
+	double cellsTime;			/* Weighting sums, rest of loop is output */
+
+	char *bufferedLine;
+	unsigned char *lineBuffer;	/* One source line, as stored in file */
+
+	resampleLine_s resampleLine;
+	memArena_s memArena;
+
+	outputBuffer_s outBuffer;
+	dither_s dither;
+
+	/*************************************************************************/
+	/*                           Printing settings                           */                
+	/*************************************************************************/
+
+	startTime = getWallTime();
+
+	/* One allocation for weights, sums, output line and ( if file is not mapped ) one source line */
+	arenaSize = sizeAdd( resampleLineSize( userInput , imageData ) , 
+				arenaBlockSize( getAsciiLineSize( userInput , imageData ) ) );
+	if( imageFile->fileData == NULL ) {
+		arenaSize = sizeAdd( arenaSize , arenaBlockSize( imageData->imgWidthInBytes ) );
+	}
+
+	retVal = arenaCreate( &memArena , arenaSize );
+	if( retVal < 0 ) {
+		return ERROR;
+	}
+
+	retVal = createResampleLine( &resampleLine , &memArena , userInput , imageData );
+	if( retVal < 0 ) {
+		arenaDestroy( &memArena );
+		return ERROR;
+	}
+
+	bufferedLine = arenaAlloc( &memArena , getAsciiLineSize( userInput , imageData ) );
+
+	lineBuffer = NULL;
+	if( imageFile->fileData == NULL ) {
+		lineBuffer = arenaAlloc( &memArena , imageData->imgWidthInBytes );
+	}
+
+	statsAddStage( userInput , STATS_ALLOC , startTime , 0 , 0 , 1 );
+	startTime = getWallTime();
+	grayTime = 0;
+	cellsTime = 0;
+
+	if( ditherInit( &dither , getAsciiLineSize( userInput , imageData ) , userInput ) < 0 ) {
+		arenaDestroy( &memArena );
+		return ERROR;
+	}
+
+	if( openAsciiOutput( &outBuffer , 1 , userInput , imageData ) < 0 ) {
+		ditherDestroy( &dither );
+		arenaDestroy( &memArena );
+		return ERROR ;
+	}
+
+	/*************************************************************************/
+	/*                           Print ascii image                           */                
+	/*************************************************************************/
+
+	retVal = OK;
+
+	/* Sum source lines of one output line, print one line */
+	for( yAxe = 0 ; yAxe < resampleLine.numOfRows ; yAxe++ ) {
+
+		grayTime = grayTime - getWallTime();
+		retVal = readResampleLine( imageFile , &resampleLine , lineBuffer , yAxe , userInput , imageData );
+		grayTime = grayTime + getWallTime();
+		if( retVal < 0 ) {
+			break;
+		}
+
+		cellsTime = cellsTime - getWallTime();
+		lineLen = makeAsciiLineResampled( &resampleLine , bufferedLine , userInput );
+		ditherLine( &dither , bufferedLine , lineLen );
+		cellsTime = cellsTime + getWallTime();
+
+		if( resampleLine.cellColors != NULL ) {
+			outputAppendColorLine( &outBuffer , bufferedLine , resampleLine.cellColors , lineLen );
+		} else {
+			outputAppendLine( &outBuffer , bufferedLine , lineLen );
+		}
+		outputFlush( &outBuffer );
+
+	} /* END Sum source lines of one output line, print one line */
+
+	/*************************************************************************/
+	/*                             Clean up                                  */
+	/*************************************************************************/
+
+	if( closeAsciiOutput( &outBuffer , userInput ) < 0 ) {
+		retVal = ERROR;
+	}
+	ditherDestroy( &dither );
+
+	statsAddStage( userInput , STATS_GRAY , getWallTime() - grayTime , 
+					(long) imageData->imgHeight * imageData->imgWidthInBytes , 0 , 0 );
+	statsAddStage( userInput , STATS_CELLS , getWallTime() - cellsTime , 0 , 0 , 0 );
+	statsAddStage( userInput , STATS_EMIT , startTime + grayTime + cellsTime , 0 , outBuffer.outWritten , 1 );
+
+	arenaDestroy( &memArena );
+
+	return retVal;
+}
+
+#ifdef USE_THREADS
+
+/********************************************************************************
+*     FUNCTION: printAsciiImageParallel
+*        INPUT: imageFile      - opened ( mapped ) image file
+*               userInput      - user input data strucure
+*               imageData      - image data structure
+*               lowMemory      - output is buffered only for reorder window
+*                                ( --band or memory limit )
+*       OUTPUT:	ERROR or OK
+*  DESCRIPTION: This function prints ascii image with numOfThreads workers. 
+*               Image is split to bands of symbolHeight lines, workers take
+*               bands in order. Finished lines are stored in reorder window
+*               of BAND_WINDOW_PER_WORKER lines for each worker and printed 
+*               in order by calling thread. Worker waits when its band is 
+*               one window ahead of printed lines, so memory does not grow 
+*               with image height.
+********************************************************************************/
+
+int printAsciiImageParallel( imageFile_s *imageFile , userInput_s *userInput, imageData_s *imageData , int lowMemory )
+{
+	int i;
+	int band;
+	int slot;
+	int retVal;
+	int lineLen;
+	int numOfStarted;
+	double startTime;
+	double emitTime;			/* Output of ready lines, rest is waiting for workers */
+
+	bandJob_s bandJob;
+	outputBuffer_s outBuffer;
+	dither_s dither;
+
+	/*************************************************************************/
+	/*                           Printing settings                           */                
+	/*************************************************************************/
+
+	bandJob.imageFile = imageFile;
+	bandJob.userInput = userInput;
+	bandJob.imageData = imageData;
+	bandJob.symbolWidth = getSymbolWidth( userInput->sizeMode );
+	bandJob.symbolHeight = bandJob.symbolWidth * 2;
+	bandJob.lineSize = getAsciiLineSize( userInput , imageData );
+	bandJob.errorFlag = 0;
+	bandJob.numOfWorkers = userInput->numOfThreads;
+	bandJob.nextBand = 0;
+	bandJob.printedBands = 0;
+
+	/* Same number of lines as in printAsciiImage */
+	bandJob.numOfBands = getAsciiNumOfLines( userInput , imageData );
+
+	bandJob.windowLines = bandJob.numOfWorkers * BAND_WINDOW_PER_WORKER;
+	if( bandJob.windowLines > bandJob.numOfBands ) {
+		bandJob.windowLines = (bandJob.numOfBands > 0) ? bandJob.numOfBands : 1;
+	}
+
+	startTime = getWallTime();
+
+	/* Allocate reorder window and workers */
+	bandJob.outputLines = malloc( sizeMultiply( bandJob.windowLines , bandJob.lineSize ) );
+	bandJob.lineDone = calloc( bandJob.windowLines , sizeof(int) );
+	bandJob.workers = calloc( bandJob.numOfWorkers , sizeof(bandWorker_s) );
+	if( (bandJob.outputLines == NULL) || (bandJob.lineDone == NULL) || (bandJob.workers == NULL) ) {
+		printf("Cannot allocate memory for worker threads!\n");
+		free( bandJob.outputLines );
+		free( bandJob.lineDone );
+		free( bandJob.workers );
+		return ERROR;
+	}
+
+	/* Workers make gray values, lines are dithered in order when printed */
+	if( ditherInit( &dither , bandJob.lineSize , userInput ) < 0 ) {
+		free( bandJob.outputLines );
+		free( bandJob.lineDone );
+		free( bandJob.workers );
+		return ERROR;
+	}
+
+	/* Open console or html output - buffer for whole frame or only for window */
+	if( openAsciiOutput( &outBuffer , lowMemory ? bandJob.windowLines : bandJob.numOfBands , userInput , imageData ) < 0 ) {
+		ditherDestroy( &dither );
+		free( bandJob.outputLines );
+		free( bandJob.lineDone );
+		free( bandJob.workers );
+		return ERROR ;
+	}
+
+	pthread_mutex_init( &bandJob.doneLock , NULL );
+	pthread_cond_init( &bandJob.doneCond , NULL );
+
+	statsAddStage( userInput , STATS_ALLOC , startTime , 0 , 0 , 3 );
+	startTime = getWallTime();
+	emitTime = 0;
+
+	/*************************************************************************/
+	/*                           Start workers                               */                
+	/*************************************************************************/
+
+	for( numOfStarted = 0 ; numOfStarted < bandJob.numOfWorkers ; numOfStarted++ ) {
+		bandJob.workers[numOfStarted].bandJob = &bandJob;
+		retVal = pthread_create( &bandJob.workers[numOfStarted].threadId , NULL , 
+									bandWorkerThread , &bandJob.workers[numOfStarted] );
+		if( retVal != 0 ) {
+			break;					/* Started workers take all bands */
+		}
+	}
+
+	if( numOfStarted == 0 ) {
+		printf("Cannot start worker threads!\n");
+		bandJob.errorFlag = 1;
+	}
+
+	/*************************************************************************/
+	/*                     Print lines in order                              */                
+	/*************************************************************************/
+
+	for( band = 0 ; band < bandJob.numOfBands ; band++ ) {
+
+		slot = band % bandJob.windowLines;
+
+		pthread_mutex_lock( &bandJob.doneLock );
+		while( !bandJob.lineDone[slot] && !bandJob.errorFlag ) {
+			pthread_cond_wait( &bandJob.doneCond , &bandJob.doneLock );
+		}
+		lineLen = bandJob.lineDone[slot] - 1;
+		pthread_mutex_unlock( &bandJob.doneLock );
+
+		if( lineLen < 0 ) {
+			break;
+		}
+
+		/* Line is dithered here, in order of lines */
+		emitTime = emitTime - getWallTime();
+		ditherLine( &dither , bandJob.outputLines + (size_t) slot * bandJob.lineSize , lineLen );
+		outputAppendLine( &outBuffer , bandJob.outputLines + (size_t) slot * bandJob.lineSize , lineLen );
+		emitTime = emitTime + getWallTime();
+
+		/* Slot is free for band one window later */
+		pthread_mutex_lock( &bandJob.doneLock );
+		bandJob.lineDone[slot] = 0;
+		bandJob.printedBands = band + 1;
+		pthread_cond_broadcast( &bandJob.doneCond );
+		pthread_mutex_unlock( &bandJob.doneLock );
+	}
+
+	/*************************************************************************/
+	/*                             Clean up                                  */
+	/*************************************************************************/
+
+	/* Workers waiting for window must not wait for lines that will never be printed */
+	if( band < bandJob.numOfBands ) {
+		pthread_mutex_lock( &bandJob.doneLock );
+		bandJob.errorFlag = 1;
+		pthread_cond_broadcast( &bandJob.doneCond );
+		pthread_mutex_unlock( &bandJob.doneLock );
+	}
+
+	for( i = 0 ; i < numOfStarted ; i++ ) {
+		pthread_join( bandJob.workers[i].threadId , NULL );
+	}
+
+	pthread_mutex_destroy( &bandJob.doneLock );
+	pthread_cond_destroy( &bandJob.doneCond );
+
+	/* Workers convert and average in one pass, both are reported as gray stage */
+	statsAddStage( userInput , STATS_GRAY , startTime + emitTime , 
+					(long) band * bandJob.symbolHeight * imageData->imgWidthInBytes , 0 , numOfStarted );
+	startTime = getWallTime();
+
+	if( closeAsciiOutput( &outBuffer , userInput ) < 0 ) {
+		bandJob.errorFlag = 1;
+	}
+	ditherDestroy( &dither );
+
+	statsAddStage( userInput , STATS_EMIT , startTime - emitTime , 0 , outBuffer.outWritten , 1 );
+
+	free( bandJob.outputLines );
+	free( bandJob.lineDone );
+	free( bandJob.workers );
+
+	return bandJob.errorFlag ? ERROR : OK;
+}
+
+/********************************************************************************
+*     FUNCTION: bandWorkerThread
+*        INPUT: workerArg - pointer to bandWorker_s
+*       OUTPUT: NULL
+*  DESCRIPTION: Worker thread - reads band, sums it to output line and 
+*               stores line in reorder window until there are no bands left
+********************************************************************************/
+
+void * bandWorkerThread( void *workerArg )
+{
+	int band;
+	int slot;
+	int lineLen;
+	int retVal;
+
+	bandWorker_s *bandWorker;
+	bandJob_s *bandJob;
+
+	cellLine_s cellLine;
+	memArena_s memArena;
+
+	bandWorker = workerArg;
+	bandJob = bandWorker->bandJob;
+
+	/* One arena for symbol sums of each worker */
+	retVal = arenaCreate( &memArena , cellLineSize( bandJob->symbolWidth , bandJob->imageData ) );
+	if( retVal == OK ) {
+		retVal = createCellLine( &cellLine , &memArena , bandJob->symbolWidth , bandJob->imageData );
+	}
+
+	while( retVal == OK ) {
+
+		band = bandWorkerTakeBand( bandWorker );
+		if( band < 0 ) {
+			break;
+		}
+		slot = band % bandJob->windowLines;
+
+		/* Mapped file is read in place, no band buffer */
+		retVal = readBandCells( bandJob->imageFile , &cellLine , NULL , band * bandJob->symbolHeight , 
+								bandJob->userInput , bandJob->imageData );
+		if( retVal == OK ) {
+			lineLen = makeAsciiLineCells( &cellLine , bandJob->outputLines + (size_t) slot * bandJob->lineSize , 
+								bandJob->userInput );
+		}
+
+		pthread_mutex_lock( &bandJob->doneLock );
+		if( retVal == OK ) {
+			bandJob->lineDone[slot] = lineLen + 1;
+		} else {
+			bandJob->errorFlag = 1;
+		}
+		pthread_cond_broadcast( &bandJob->doneCond );
+		pthread_mutex_unlock( &bandJob->doneLock );
+	}
+
+	/* Printing thread must not wait for lines that will never be done */
+	if( retVal != OK ) {
+		pthread_mutex_lock( &bandJob->doneLock );
+		bandJob->errorFlag = 1;
+		pthread_cond_broadcast( &bandJob->doneCond );
+		pthread_mutex_unlock( &bandJob->doneLock );
+	}
+
+	arenaDestroy( &memArena );
+
+	return NULL;
+}
+
+/********************************************************************************
+*     FUNCTION: bandWorkerTakeBand
+*        INPUT: bandWorker - worker structure
+*       OUTPUT: Band number or ERROR when all bands are taken ( or on error )
+*  DESCRIPTION: Worker takes next band in order. It waits while slot of band
+*               in reorder window still holds line that is not printed.
+********************************************************************************/
+
+int bandWorkerTakeBand( bandWorker_s *bandWorker )
+{
+	int band;
+	bandJob_s *bandJob;
+
+	bandJob = bandWorker->bandJob;
+	band = ERROR;
+
+	pthread_mutex_lock( &bandJob->doneLock );
+	if( bandJob->nextBand < bandJob->numOfBands ) {
+		band = bandJob->nextBand;
+		bandJob->nextBand++;
+	}
+	while( (band >= 0) && (band >= bandJob->printedBands + bandJob->windowLines) && !bandJob->errorFlag ) {
+		pthread_cond_wait( &bandJob->doneCond , &bandJob->doneLock );
+	}
+	if( bandJob->errorFlag ) {
+		band = ERROR;
+	}
+	pthread_mutex_unlock( &bandJob->doneLock );
+
+	return band;
+}
+
+#endif /* USE_THREADS */
+
+/********************************************************************************
+*     FUNCTION: makeAsciiLine
+*        INPUT: *grayImageMap  - gray scale image map
+*               firstLine      - first line of map used for this output line
+*               symbolWidth    - pixels in one symbol ( horizontal )
+*               symbolHeight   - pixels in one symbol ( vertical )
+*               *bufferedLine  - output line
+*               userInput      - user input data strucure
+*               imageData      - image data structure
+*       OUTPUT:	Number of symbols in line
+*  DESCRIPTION: This function averages symbolHeight lines of gray map starting
+*               at firstLine and stores one line of ascii symbols ( gray 
+*               values in dither mode, see ditherLine )
+********************************************************************************/
+
+int makeAsciiLine( pixelMap_s *grayImageMap , int firstLine , int symbolWidth , int symbolHeight ,
+					char *bufferedLine , userInput_s *userInput , imageData_s *imageData )
+{
+	int pix;
+	int line;
+	int xAxe;
+	unsigned char *mapLine;
+	int symTemp;
+	int symIndex;
+	int symAverage;
+	int grayLine;
+
+	symIndex = 0;
+
+	/* Dithered line keeps gray values, symbols are selected in ditherLine */
+	grayLine = (userInput->ditherMode != DITHER_NONE);
+
+	/* Move throug the pixels in 2D map */
+	for( xAxe = 0; xAxe < (imageData->imgWidth - symbolWidth); xAxe = xAxe + symbolWidth ) {
+	
+		symTemp = 0;
+
+		/* Clacualte average for one symbol  */
+		for( line = firstLine ; line < (symbolHeight + firstLine); line++ ) {
+			mapLine = PIXEL_MAP_LINE( grayImageMap , line );
+			for( pix = xAxe ; pix < (symbolWidth + xAxe); pix++ ) {
+				/* Add all pixel values in range of one symbol */
+				symTemp = symTemp + mapLine[pix];	
+			}
+		}
+		/* Average */
+		symAverage = symTemp / ( symbolWidth * symbolHeight );
+		/* Store one ascii symbol */
+		bufferedLine[symIndex] = grayLine ? symAverage : userInput->glyphTable[symAverage];
+		symIndex++;
+
+	} /* END Move throug the pixels in 2D map */
+
+	bufferedLine[symIndex] = '\0';
+
+	return symIndex;
+}
+
+/********************************************************************************
+*     FUNCTION: makeAsciiLineCells
+*        INPUT: *cellLine      - symbol sums of one output line
+*               *bufferedLine  - output line
+*               userInput      - user input data strucure
+*       OUTPUT:	Number of symbols in line
+*  DESCRIPTION: Same as makeAsciiLine, but symbols are averaged from sums
+*               made by readBandCells
+********************************************************************************/
+
+int makeAsciiLineCells( cellLine_s *cellLine , char *bufferedLine , userInput_s *userInput )
+{
+	int symIndex;
+	int symArea;
+	int symAverage;
+	int grayLine;
+
+	symArea = cellLine->symbolWidth * cellLine->symbolHeight;
+	grayLine = (userInput->ditherMode != DITHER_NONE);
+
+	for( symIndex = 0 ; symIndex < cellLine->numOfCells ; symIndex++ ) {
+		symAverage = cellLine->cellSums[symIndex] / symArea;
+		bufferedLine[symIndex] = grayLine ? symAverage : userInput->glyphTable[symAverage];
+	}
+
+	bufferedLine[symIndex] = '\0';
+
+	return symIndex;
+}
+
+/********************************************************************************
+*     FUNCTION: makeAsciiLineResampled
+*        INPUT: *resampleLine  - line sums made by readResampleLine
+*               *bufferedLine  - output line
+*               userInput      - user input data strucure
+*       OUTPUT:	Number of symbols in line
+*  DESCRIPTION: Same as makeAsciiLineCells, but each symbol is weighted sum of
+*               its source pixels. Weights of symbol sum to width * height 
+*               of image, so average is one integer division. Colors are 
+*               averaged the same way as in makeCellColors.
+********************************************************************************/
+
+int makeAsciiLineResampled( resampleLine_s *resampleLine , char *bufferedLine , userInput_s *userInput )
+{
+	int weight;
+	int symIndex;
+	int symAverage;
+	int grayLine;
+	uint64_t symTemp;
+	uint64_t blueSum;
+	uint64_t greenSum;
+	uint64_t redSum;
+	uint64_t *rowPtr;
+	uint64_t *colorPtr;
+
+	grayLine = (userInput->ditherMode != DITHER_NONE);
+
+	for( symIndex = 0 ; symIndex < resampleLine->numOfCols ; symIndex++ ) {
+
+		rowPtr = resampleLine->rowSums + resampleLine->cellFirstPix[symIndex];
+		symTemp = 0;
+		for( weight = resampleLine->weightStart[symIndex] ; weight < resampleLine->weightStart[symIndex + 1] ; weight++ ) {
+			symTemp = symTemp + (uint64_t) resampleLine->pixWeights[weight] * (*rowPtr);
+			rowPtr++;
+		}
+		symAverage = (int) (symTemp / resampleLine->cellArea);
+		bufferedLine[symIndex] = grayLine ? symAverage : userInput->glyphTable[symAverage];
+
+		if( resampleLine->cellColors == NULL ) {
+			continue;
+		}
+
+		colorPtr = resampleLine->colorSums + (size_t) resampleLine->cellFirstPix[symIndex] * 3;
+		blueSum = 0;
+		greenSum = 0;
+		redSum = 0;
+		for( weight = resampleLine->weightStart[symIndex] ; weight < resampleLine->weightStart[symIndex + 1] ; weight++ ) {
+			blueSum = blueSum + (uint64_t) resampleLine->pixWeights[weight] * colorPtr[0];
+			greenSum = greenSum + (uint64_t) resampleLine->pixWeights[weight] * colorPtr[1];
+			redSum = redSum + (uint64_t) resampleLine->pixWeights[weight] * colorPtr[2];
+			colorPtr = colorPtr + 3;
+		}
+
+		blueSum = blueSum / resampleLine->cellArea;
+		greenSum = greenSum / resampleLine->cellArea;
+		redSum = redSum / resampleLine->cellArea;
+
+		if( userInput->colorMode == COLOR_256 ) {
+			resampleLine->cellColors[symIndex] = COLOR_CUBE_START + 36 * userInput->colorLevels[redSum] + 
+							6 * userInput->colorLevels[greenSum] + userInput->colorLevels[blueSum];
+		} else {
+			resampleLine->cellColors[symIndex] = (uint32_t) ((redSum << 16) | (greenSum << 8) | blueSum);
+		}
+	}
+
+	bufferedLine[symIndex] = '\0';
+
+	return symIndex;
+}
+
+/********************************************************************************
+*     FUNCTION: makeAsciiLineShape
+*        INPUT: *grayImageMap  - 2D map of gray pixels
+*               *integralImage - integral image of map or NULL
+*               firstLine      - first line of map used for this output line
+*               symbolWidth    - pixels in one symbol ( horizontal )
+*               symbolHeight   - pixels in one symbol ( vertical )
+*               *bufferedLine  - output line
+*               userInput      - user input data strucure
+*               imageData      - image data structure
+*       OUTPUT:	Number of symbols in line
+*  DESCRIPTION: Same as makeAsciiLine, but each symbol is split to 2 x 3 
+*               regions. 2 bit mean of each region makes signature and 
+*               symbol is one lookup in shapeTable. Region has at least one
+*               pixel, so small symbols share pixels between regions.
+********************************************************************************/
+
+int makeAsciiLineShape( pixelMap_s *grayImageMap , integralImage_s *integralImage , int firstLine , 
+					int symbolWidth , int symbolHeight , char *bufferedLine , userInput_s *userInput , 
+					imageData_s *imageData )
+{
+	int i;
+	int pix;
+	int line;
+	int xAxe;
+	int region;
+	int regionCol;
+	int regionRow;
+	int symIndex;
+	int signature;
+	int regionLeft[SHAPE_COLS];
+	int regionWidth[SHAPE_COLS];
+	int regionTop[SHAPE_ROWS];
+	int regionHeight[SHAPE_ROWS];
+	uint64_t regionSum;
+	unsigned char *mapLine;
+
+	/* Regions are same for every symbol */
+	for( i = 0 ; i < SHAPE_COLS ; i++ ) {
+		regionLeft[i] = i * symbolWidth / SHAPE_COLS;
+		regionWidth[i] = (i + 1) * symbolWidth / SHAPE_COLS - regionLeft[i];
+		if( regionWidth[i] < 1 ) {
+			regionWidth[i] = 1;
+		}
+	}
+	for( i = 0 ; i < SHAPE_ROWS ; i++ ) {
+		regionTop[i] = firstLine + i * symbolHeight / SHAPE_ROWS;
+		regionHeight[i] = firstLine + (i + 1) * symbolHeight / SHAPE_ROWS - regionTop[i];
+		if( regionHeight[i] < 1 ) {
+			regionHeight[i] = 1;
+		}
+	}
+
+	symIndex = 0;
+
+	for( xAxe = 0; xAxe < (imageData->imgWidth - symbolWidth); xAxe = xAxe + symbolWidth ) {
+
+		signature = 0;
+
+		for( region = 0 ; region < SHAPE_REGIONS ; region++ ) {
+
+			regionCol = region % SHAPE_COLS;
+			regionRow = region / SHAPE_COLS;
+
+			if( integralImage != NULL ) {
+				regionSum = integralRectSum( integralImage , xAxe + regionLeft[regionCol] , regionTop[regionRow] , 
+								regionWidth[regionCol] , regionHeight[regionRow] );
+			} else {
+				regionSum = 0;
+				for( line = regionTop[regionRow] ; line < regionTop[regionRow] + regionHeight[regionRow] ; line++ ) {
+					mapLine = PIXEL_MAP_LINE( grayImageMap , line ) + xAxe + regionLeft[regionCol];
+					for( pix = 0 ; pix < regionWidth[regionCol] ; pix++ ) {
+						regionSum = regionSum + mapLine[pix];
+					}
+				}
+			}
+
+			/* Mean of region to SHAPE_LEVELS levels */
+			regionSum = regionSum / ((uint64_t) regionWidth[regionCol] * regionHeight[regionRow]);
+			signature = signature | (int) (regionSum * SHAPE_LEVELS / 256) << (2 * region);
+		}
+
+		bufferedLine[symIndex] = userInput->shapeTable[signature];
+		symIndex++;
+	}
+
+	bufferedLine[symIndex] = '\0';
+
+	return symIndex;
+}
+
+/********************************************************************************
+*     FUNCTION: makeAsciiLineMask
+*        INPUT: *grayImageMap  - 2D map of gray pixels
+*               *integralImage - integral image of map or NULL
+*               firstLine      - first line of map used for this output line
+*               symbolWidth    - pixels in one symbol ( horizontal )
+*               symbolHeight   - pixels in one symbol ( vertical )
+*               *bufferedLine  - output line ( MASK_SYMBOL_BYTES per symbol )
+*               userInput      - user input data strucure
+*               imageData      - image data structure
+*       OUTPUT:	Number of bytes in line
+*  DESCRIPTION: Same as makeAsciiLineShape, but symbol is split to 2 x 4 
+*               ( --braille ) or 2 x 2 ( --blocks ) sub-pixels. Each light 
+*               sub-pixel sets one bit of mask and UTF-8 symbol is one 
+*               lookup in maskTable. Every symbol is copied as 4 bytes and
+*               line moves by length of symbol, so there is no branch.
+********************************************************************************/
+
+int makeAsciiLineMask( pixelMap_s *grayImageMap , integralImage_s *integralImage , int firstLine , 
+					int symbolWidth , int symbolHeight , char *bufferedLine , userInput_s *userInput , 
+					imageData_s *imageData )
+{
+	int i;
+	int pix;
+	int line;
+	int xAxe;
+	int maskRows;
+	int subPixel;
+	int subPixels;
+	int subCol;
+	int subRow;
+	int lineLen;
+	int pixelMask;
+	int subLeft[MASK_COLS];
+	int subWidth[MASK_COLS];
+	int subTop[MASK_ROWS_MAX];
+	int subHeight[MASK_ROWS_MAX];
+	uint64_t subSum;
+	unsigned char *mapLine;
+
+	maskRows = (userInput->maskMode == MASK_BRAILLE) ? MASK_ROWS_MAX : 2;
+	subPixels = MASK_COLS * maskRows;
+
+	/* Sub-pixels are same for every symbol */
+	for( i = 0 ; i < MASK_COLS ; i++ ) {
+		subLeft[i] = i * symbolWidth / MASK_COLS;
+		subWidth[i] = (i + 1) * symbolWidth / MASK_COLS - subLeft[i];
+		if( subWidth[i] < 1 ) {
+			subWidth[i] = 1;
+		}
+	}
+	for( i = 0 ; i < maskRows ; i++ ) {
+		subTop[i] = firstLine + i * symbolHeight / maskRows;
+		subHeight[i] = firstLine + (i + 1) * symbolHeight / maskRows - subTop[i];
+		if( subHeight[i] < 1 ) {
+			subHeight[i] = 1;
+		}
+	}
+
+	lineLen = 0;
+
+	for( xAxe = 0; xAxe < (imageData->imgWidth - symbolWidth); xAxe = xAxe + symbolWidth ) {
+
+		pixelMask = 0;
+
+		for( subPixel = 0 ; subPixel < subPixels ; subPixel++ ) {
+
+			subCol = subPixel % MASK_COLS;
+			subRow = subPixel / MASK_COLS;
+
+			if( integralImage != NULL ) {
+				subSum = integralRectSum( integralImage , xAxe + subLeft[subCol] , subTop[subRow] , 
+								subWidth[subCol] , subHeight[subRow] );
+			} else {
+				subSum = 0;
+				for( line = subTop[subRow] ; line < subTop[subRow] + subHeight[subRow] ; line++ ) {
+					mapLine = PIXEL_MAP_LINE( grayImageMap , line ) + xAxe + subLeft[subCol];
+					for( pix = 0 ; pix < subWidth[subCol] ; pix++ ) {
+						subSum = subSum + mapLine[pix];
+					}
+				}
+			}
+
+			/* Mean of sub-pixel thresholded at middle gray - top bit of mean */
+			subSum = subSum / ((uint64_t) subWidth[subCol] * subHeight[subRow]);
+			pixelMask = pixelMask | (int) (subSum >> 7) << subPixel;
+		}
+
+		memcpy( bufferedLine + lineLen , userInput->maskTable[pixelMask] , 4 );
+		lineLen = lineLen + userInput->maskTable[pixelMask][3];
+	}
+
+	bufferedLine[lineLen] = '\0';
+
+	return lineLen;
+}
+
+/********************************************************************************
+*     FUNCTION: makeAsciiLineIntegral
+*        INPUT: *integralImage - integral image of gray scale map
+*               firstLine      - first line of map used for this output line
+*               symbolWidth    - pixels in one symbol ( horizontal )
+*               symbolHeight   - pixels in one symbol ( vertical )
+*               *bufferedLine  - output line
+*               userInput      - user input data strucure
+*               imageData      - image data structure
+*       OUTPUT:	Number of symbols in line
+*  DESCRIPTION: Same as makeAsciiLine, but each symbol average costs four 
+*               lookups in integral image regardless of symbol size
+********************************************************************************/
+
+int makeAsciiLineIntegral( integralImage_s *integralImage , int firstLine , int symbolWidth , int symbolHeight ,
+					char *bufferedLine , userInput_s *userInput , imageData_s *imageData )
+{
+	int xAxe;
+	int symIndex;
+	int symAverage;
+	int grayLine;
+
+	symIndex = 0;
+	grayLine = (userInput->ditherMode != DITHER_NONE);
+
+	for( xAxe = 0; xAxe < (imageData->imgWidth - symbolWidth); xAxe = xAxe + symbolWidth ) {
+	
+		symAverage = integralRectSum( integralImage , xAxe , firstLine , symbolWidth , symbolHeight ) / 
+						( symbolWidth * symbolHeight );
+		bufferedLine[symIndex] = grayLine ? symAverage : userInput->glyphTable[symAverage];
+		symIndex++;
+	}
+
+	bufferedLine[symIndex] = '\0';
+
+	return symIndex;
+}
+
+/********************************************************************************
+*     FUNCTION: getSymbolWidth
+*        INPUT: sizeMode - user selected size [ 1 - 10 ]
+*       OUTPUT: Width of one symbol in pixels
+*  DESCRIPTION: Larger the width of symbol smaller the picture
+********************************************************************************/
+
+int getSymbolWidth( int sizeMode )
+{
+	int symbolWidth;
+
+	switch( sizeMode ) {
+		case 0 :
+			symbolWidth = 8;			/* Default size */
+			break;
+		case 10:
+			symbolWidth = 1;			/* Larges size output */
+			break;
+		
+		default:
+			symbolWidth = (sizeMode-10) * (-2);
+
+	}
+
+	return symbolWidth;
+}
+
+/********************************************************************************
+*     FUNCTION: getAsciiLineSize
+*        INPUT: userInput      - user input data strucure
+*               imageData      - image data structure
+*       OUTPUT: Size of one output line in bytes ( with terminating zero )
+*  DESCRIPTION: /
+********************************************************************************/
+
+int getAsciiLineSize( userInput_s *userInput , imageData_s *imageData )
+{
+	if( imageData->outCols > 0 ) {
+		return imageData->outCols + 1;
+	}
+
+	/* UTF-8 symbols of --braille and --blocks */
+	if( userInput->maskMode != MASK_NONE ) {
+		return (imageData->imgWidth / getSymbolWidth( userInput->sizeMode )) * MASK_SYMBOL_BYTES + 1;
+	}
+
+	return (imageData->imgWidth / (getSymbolWidth( userInput->sizeMode ) / imageData->levelScale)) + 1;
+}
+
+/********************************************************************************
+*     FUNCTION: getAsciiNumOfLines
+*        INPUT: userInput      - user input data strucure
+*               imageData      - image data structure
+*       OUTPUT: Number of output lines
+*  DESCRIPTION: /
+********************************************************************************/
+
+int getAsciiNumOfLines( userInput_s *userInput , imageData_s *imageData )
+{
+	int symbolHeight;
+
+	if( imageData->outRows > 0 ) {
+		return imageData->outRows;
+	}
+
+	symbolHeight = getSymbolWidth( userInput->sizeMode ) / imageData->levelScale * 2;
+
+	if( imageData->imgHeight <= symbolHeight ) {
+		return 0;
+	}
+
+	return (imageData->imgHeight - 1) / symbolHeight;
+}
+
+/********************************************************************************
+*     FUNCTION: setResampleSize
+*        INPUT: userInput      - user input data strucure
+*               imageData      - image data structure
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function stores output size of --cols and --rows in 
+*               imageData. When only one is given, other one keeps aspect 
+*               of image with symbols cellAspect percent higher than wide.
+*               Size is per image, because batch workers share userInput.
+********************************************************************************/
+
+int setResampleSize( userInput_s *userInput , imageData_s *imageData )
+{
+	int64_t outCols;
+	int64_t outRows;
+
+	/* Weighted sum of symbol is up to 255 * width * height */
+	if( (uint64_t) imageData->imgWidth * imageData->imgHeight > UINT64_MAX / 255 ) {
+		printf("Image is too large for --cols or --rows!\n");
+		return ERROR;
+	}
+
+	outCols = userInput->outCols;
+	outRows = userInput->outRows;
+
+	if( outCols == RESAMPLE_AUTO ) {
+		outCols = getTerminalWidth();
+	}
+
+	/* Symbol height / width on image is cellAspect / 100 */
+	if( outCols == 0 ) {
+		outCols = (outRows * imageData->imgWidth * userInput->cellAspect + (int64_t) imageData->imgHeight * 50) / 
+					((int64_t) imageData->imgHeight * 100);
+	}
+	if( outRows == 0 ) {
+		outRows = (outCols * imageData->imgHeight * 100 + (int64_t) imageData->imgWidth * userInput->cellAspect / 2) / 
+					((int64_t) imageData->imgWidth * userInput->cellAspect);
+	}
+
+	imageData->outCols = (int) ((outCols < 1) ? 1 : (outCols > RESAMPLE_MAX) ? RESAMPLE_MAX : outCols);
+	imageData->outRows = (int) ((outRows < 1) ? 1 : (outRows > RESAMPLE_MAX) ? RESAMPLE_MAX : outRows);
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: getTerminalWidth
+*        INPUT: /
+*       OUTPUT: Number of terminal columns
+*  DESCRIPTION: Width of terminal on standard output, COLUMNS environment 
+*               variable when output is not terminal or TERMINAL_WIDTH.
+********************************************************************************/
+
+int getTerminalWidth( void )
+{
+	char *envColumns;
+
+#ifndef WINDOWS
+	struct winsize winSize;
+
+	if( (ioctl( STDOUT_FILENO , TIOCGWINSZ , &winSize ) == 0) && (winSize.ws_col > 0) ) {
+		return winSize.ws_col;
+	}
+#endif
+
+	envColumns = getenv( "COLUMNS" );
+	if( (envColumns != NULL) && (atoi( envColumns ) > 0) ) {
+		return atoi( envColumns );
+	}
+
+	return TERMINAL_WIDTH;
+}
+
+/********************************************************************************
+*     FUNCTION: openAsciiOutput
+*        INPUT: *outBuffer     - output buffer structure
+*               numOfLines     - number of lines buffered before writing
+*               userInput      - user input data strucure
+*               imageData      - image data structure
+*       OUTPUT:	ERROR or OK
+*  DESCRIPTION: This function selects stdout or creates html file ( .txt file
+*               in batch mode ) and allocates buffer for numOfLines escaped 
+*               lines, html header and footer. Html header is stored to 
+*               buffer, nothing is written before outputFlush.
+********************************************************************************/
+
+int openAsciiOutput( outputBuffer_s *outBuffer , int numOfLines , userInput_s *userInput, imageData_s *imageData )
+{
+	size_t lineSize;
+
+	outBuffer->htmlMode = userInput->htmlMode;
+	outBuffer->colorMode = userInput->colorMode;
+	outBuffer->spanOpen = 0;
+	outBuffer->gzipStream = NULL;
+	outBuffer->bufUsed = 0;
+	outBuffer->outWritten = 0;
+	outBuffer->outFilePath[0] = '\0';
+
+	/* One line with every symbol escaped and end of line */
+	lineSize = (size_t) getAsciiLineSize( userInput , imageData ) * HTML_ESCAPE_MAX + 1;
+
+	/* Color can change on every symbol, color is reset on end of line */
+	if( userInput->colorMode != COLOR_NONE ) {
+		lineSize = lineSize + (size_t) (getAsciiLineSize( userInput , imageData ) + 1) * COLOR_ESCAPE_MAX;
+	}
+
+	outBuffer->bufSize = lineSize * numOfLines;
+	if( outBuffer->bufSize > OUTPUT_BUFFER_MAX ) {
+		outBuffer->bufSize = OUTPUT_BUFFER_MAX;
+	}
+	if( outBuffer->bufSize < lineSize ) {
+		outBuffer->bufSize = lineSize;
+	}
+	outBuffer->bufSize = outBuffer->bufSize + sizeof(HTML_HEADER) + sizeof(HTML_CHARSET) + 216 * HTML_CLASS_MAX + 
+							sizeof(HTML_FOOTER);
+
+	outBuffer->bufData = malloc( outBuffer->bufSize );
+	if( outBuffer->bufData == NULL ) {
+		printf("Could not allocate memory for output buffer!\n");
+		return ERROR;
+	}
+
+	/* Console mode */
+	if( !userInput->htmlMode && !userInput->batchMode && (userInput->sizeLevels == 0) ) {
+		outBuffer->outFilePtr = stdout; 						/* Print to console */
+		return OK;
+	}
+
+	/* Create output filename - html file or batch mode text file ( size in name of each pyramid level ) */
+	if( userInput->sizeLevels != 0 ) {
+		snprintf( outBuffer->outFilePath , sizeof( outBuffer->outFilePath ) , "%s_s%d%s%s" , imageData->imgName , 
+				userInput->sizeMode , userInput->htmlMode ? ".html" : ".txt" , userInput->gzipMode ? ".gz" : "" );
+	} else {
+		snprintf( outBuffer->outFilePath , sizeof( outBuffer->outFilePath ) , "%s%s%s" , imageData->imgName , 
+				userInput->htmlMode ? ".html" : ".txt" , userInput->gzipMode ? ".gz" : "" );
+	}
+
+	/* Create or owerwrite file */
+	outBuffer->outFilePtr = fopen( outBuffer->outFilePath  , userInput->gzipMode ? "wb" : "w" );
+	if( outBuffer->outFilePtr == NULL ) {
+		printf("Could not open file %s\n", outBuffer->outFilePath );
+		free( outBuffer->bufData );
+		return ERROR ;
+	}
+
+#ifdef USE_ZLIB
+	/* Compressed file - window bits + 16 makes gzip header */
+	if( userInput->gzipMode ) {
+		outBuffer->gzipStream = calloc( 1 , sizeof( z_stream ) );
+		if( (outBuffer->gzipStream == NULL) || (deflateInit2( outBuffer->gzipStream , Z_DEFAULT_COMPRESSION , Z_DEFLATED ,
+														15 + 16 , 8 , Z_DEFAULT_STRATEGY ) != Z_OK) ) {
+			printf("Could not compress file %s\n", outBuffer->outFilePath );
+			free( outBuffer->gzipStream );
+			fclose( outBuffer->outFilePtr );
+			free( outBuffer->bufData );
+			return ERROR ;
+		}
+	}
+#endif
+
+	/* Html header is first in buffer */
+	if( userInput->htmlMode ) {
+		htmlFilePrintHeader( outBuffer , userInput->maskMode != MASK_NONE );
+	}
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: closeAsciiOutput
+*        INPUT: *outBuffer     - output buffer structure
+*               userInput      - user input data strucure
+*       OUTPUT:	ERROR or OK
+*  DESCRIPTION: This function adds html footer, writes buffer and closes 
+*               output file
+********************************************************************************/
+
+int closeAsciiOutput( outputBuffer_s *outBuffer , userInput_s *userInput )
+{
+	int retVal;
+
+	if( userInput->htmlMode ) {
+		htmlFilePrintFooter( outBuffer );
+	}
+
+	retVal = outputFlush( outBuffer );
+
+#ifdef USE_ZLIB
+	/* End of compressed stream */
+	if( outBuffer->gzipStream != NULL ) {
+		if( outputGzipWrite( outBuffer , Z_FINISH ) < 0 ) {
+			retVal = ERROR;
+		}
+		deflateEnd( outBuffer->gzipStream );
+		free( outBuffer->gzipStream );
+		outBuffer->gzipStream = NULL;
+	}
+#endif
+
+	free( outBuffer->bufData );
+	outBuffer->bufData = NULL;
+
+	/* Html or batch mode file */
+	if( outBuffer->outFilePtr != stdout ) {
+		if( fclose( outBuffer->outFilePtr ) != 0 ) {
+			retVal = ERROR;
+		}
+		printf(" Ascii image printed to file %s\n" , outBuffer->outFilePath );
+	}
+
+	return retVal;
+}
+
+/********************************************************************************
+*     FUNCTION: outputAppendLine
+*        INPUT: *outBuffer     - output buffer structure
+*               *asciiLine     - line of ascii symbols
+*               lineLen        - number of symbols
+*       OUTPUT:	ERROR or OK
+*  DESCRIPTION: This function copies line and end of line to buffer. In html 
+*               mode symbols &, < and > are escaped in the same pass. Buffer
+*               is written first if line would not fit. Buffer without file
+*               ( library ) is never written, ERROR is returned when full.
+********************************************************************************/
+
+int outputAppendLine( outputBuffer_s *outBuffer , char *asciiLine , int lineLen )
+{
+	int i;
+	size_t lineSize;
+	char *outPtr;
+
+	/* Longest possible line with end of line */
+	lineSize = (size_t) lineLen * (outBuffer->htmlMode ? HTML_ESCAPE_MAX : 1) + 1;
+
+	if( outBuffer->bufSize - outBuffer->bufUsed < lineSize ) {
+		if( outBuffer->outFilePtr == NULL ) {
+			return ERROR;
+		}
+		outputFlush( outBuffer );
+	}
+
+	outPtr = outBuffer->bufData + outBuffer->bufUsed;
+
+	if( !outBuffer->htmlMode ) {
+		memcpy( outPtr , asciiLine , lineLen );
+		outPtr = outPtr + lineLen;
+	} else {
+		for( i = 0 ; i < lineLen ; i++ ) {
+			outPtr = outputPutSymbol( outPtr , asciiLine[i] , 1 );
+		}
+	}
+
+	*outPtr = '\n';
+	outPtr++;
+
+	outBuffer->bufUsed = outPtr - outBuffer->bufData;
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: outputAppendColorLine
+*        INPUT: *outBuffer     - output buffer structure
+*               *asciiLine     - line of ascii symbols
+*               *cellColors    - color of each symbol ( makeCellColors )
+*               lineLen        - number of symbols
+*       OUTPUT:	ERROR or OK
+*  DESCRIPTION: Same as outputAppendLine, but symbols are colored. Color is 
+*               written only when it differs from previous symbol, so run of
+*               same color costs one escape ( or one html span ). Console 
+*               color is reset on end of line, html span is continued on 
+*               next line when its first color is same.
+********************************************************************************/
+
+int outputAppendColorLine( outputBuffer_s *outBuffer , char *asciiLine , uint32_t *cellColors , int lineLen )
+{
+	int i;
+	size_t lineSize;
+	char *outPtr;
+
+	/* Longest possible line with end of line */
+	lineSize = (size_t) lineLen * ((outBuffer->htmlMode ? HTML_ESCAPE_MAX : 1) + COLOR_ESCAPE_MAX) + 
+				COLOR_ESCAPE_MAX + 1;
+
+	if( outBuffer->bufSize - outBuffer->bufUsed < lineSize ) {
+		if( outBuffer->outFilePtr == NULL ) {
+			return ERROR;
+		}
+		outputFlush( outBuffer );
+	}
+
+	outPtr = outBuffer->bufData + outBuffer->bufUsed;
+
+	for( i = 0 ; i < lineLen ; i++ ) {
+
+		/* Html - span stays open while color is same, also over end of line */
+		if( outBuffer->htmlMode ) {
+			if( !outBuffer->spanOpen || (cellColors[i] != outBuffer->spanColor) ) {
+				if( outBuffer->spanOpen ) {
+					memcpy( outPtr , "</span>" , 7 );
+					outPtr = outPtr + 7;
+				}
+				outPtr = outputPutColor( outPtr , cellColors[i] , outBuffer->colorMode , 1 );
+				outBuffer->spanOpen = 1;
+				outBuffer->spanColor = cellColors[i];
+			}
+		} else if( (i == 0) || (cellColors[i] != cellColors[i-1]) ) {
+			outPtr = outputPutColor( outPtr , cellColors[i] , outBuffer->colorMode , 0 );
+		}
+
+		outPtr = outputPutSymbol( outPtr , asciiLine[i] , outBuffer->htmlMode );
+	}
+
+	/* Reset color - html span is closed by next color or footer */
+	if( (lineLen > 0) && !outBuffer->htmlMode ) {
+		memcpy( outPtr , "\033[0m" , 4 );
+		outPtr = outPtr + 4;
+	}
+
+	*outPtr = '\n';
+	outPtr++;
+
+	outBuffer->bufUsed = outPtr - outBuffer->bufData;
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: outputPutSymbol
+*        INPUT: *outPtr        - place in output buffer
+*               asciiSymbol    - symbol
+*               htmlMode       - symbols &, < and > are escaped
+*       OUTPUT:	Place after symbol
+*  DESCRIPTION: /
+********************************************************************************/
+
+static inline char * outputPutSymbol( char *outPtr , char asciiSymbol , int htmlMode )
+{
+	if( htmlMode ) {
+		switch( asciiSymbol ) {
+			case '&':
+				memcpy( outPtr , "&amp;" , 5 );
+				return outPtr + 5;
+			case '<':
+				memcpy( outPtr , "&lt;" , 4 );
+				return outPtr + 4;
+			case '>':
+				memcpy( outPtr , "&gt;" , 4 );
+				return outPtr + 4;
+		}
+	}
+
+	*outPtr = asciiSymbol;
+
+	return outPtr + 1;
+}
+
+/********************************************************************************
+*     FUNCTION: outputPutColor
+*        INPUT: *outPtr        - place in output buffer
+*               cellColor      - 0xRRGGBB ( COLOR_TRUE ) or palette index 
+*                                ( COLOR_256 )
+*               colorMode      - COLOR_TRUE or COLOR_256
+*               htmlMode       - html span instead of ANSI escape
+*       OUTPUT:	Place after color
+*  DESCRIPTION: This function writes start of color. Numbers are written 
+*               without printf, it is called for every run of color.
+********************************************************************************/
+
+static inline char * outputPutColor( char *outPtr , uint32_t cellColor , int colorMode , int htmlMode )
+{
+	int i;
+	int channel;
+	int colorValue[3];
+
+	static const char hexDigits[] = "0123456789abcdef";
+
+	channel = 0;
+
+	/* Palette index - html class of header ( htmlFilePrintHeader ) */
+	if( colorMode == COLOR_256 ) {
+		if( !htmlMode ) {
+			memcpy( outPtr , "\033[38;5;" , 7 );
+			outPtr = outPtr + 7;
+		} else {
+			memcpy( outPtr , "<span class=c" , 13 );
+			outPtr = outPtr + 13;
+		}
+		colorValue[0] = cellColor;
+		channel = 1;
+	} else if( htmlMode ) {
+		memcpy( outPtr , "<span style=color:#" , 19 );
+		outPtr = outPtr + 19;
+		for( i = 20 ; i >= 0 ; i = i - 4 ) {
+			*outPtr = hexDigits[(cellColor >> i) & 0x0F];
+			outPtr++;
+		}
+		*outPtr = '>';
+		return outPtr + 1;
+	}
+
+	if( colorMode == COLOR_TRUE ) {
+		memcpy( outPtr , "\033[38;2;" , 7 );
+		outPtr = outPtr + 7;
+		colorValue[0] = (cellColor >> 16) & 0xFF;
+		colorValue[1] = (cellColor >> 8) & 0xFF;
+		colorValue[2] = cellColor & 0xFF;
+		channel = 3;
+	}
+
+	/* Values 0 - 255 separated by ; */
+	for( i = 0 ; i < channel ; i++ ) {
+		if( colorValue[i] >= 100 ) {
+			*outPtr = '0' + colorValue[i] / 100;
+			outPtr++;
+		}
+		if( colorValue[i] >= 10 ) {
+			*outPtr = '0' + (colorValue[i] / 10) % 10;
+			outPtr++;
+		}
+		*outPtr = '0' + colorValue[i] % 10;
+		outPtr++;
+		*outPtr = (i < channel - 1) ? ';' : (htmlMode ? '>' : 'm');
+		outPtr++;
+	}
+
+	return outPtr;
+}
+
+/********************************************************************************
+*     FUNCTION: outputAppendText
+*        INPUT: *outBuffer     - output buffer structure
+*               *outText       - text ( not escaped )
+*       OUTPUT:	ERROR or OK
+*  DESCRIPTION: This function copies text to buffer ( html header , footer )
+********************************************************************************/
+
+int outputAppendText( outputBuffer_s *outBuffer , char *outText )
+{
+	return outputAppendData( outBuffer , outText , strlen( outText ) );
+}
+
+/********************************************************************************
+*     FUNCTION: outputAppendData
+*        INPUT: *outBuffer     - output buffer structure
+*               *outData       - bytes ( not escaped )
+*               dataLen        - number of bytes
+*       OUTPUT:	ERROR or OK
+*  DESCRIPTION: This function copies bytes to buffer. Data larger than 
+*               buffer is written in parts.
+********************************************************************************/
+
+int outputAppendData( outputBuffer_s *outBuffer , const char *outData , size_t dataLen )
+{
+	if( outBuffer->bufSize - outBuffer->bufUsed < dataLen ) {
+		if( outBuffer->outFilePtr == NULL ) {
+			return ERROR;
+		}
+		outputFlush( outBuffer );
+
+		while( dataLen > outBuffer->bufSize ) {
+			memcpy( outBuffer->bufData , outData , outBuffer->bufSize );
+			outBuffer->bufUsed = outBuffer->bufSize;
+			outputFlush( outBuffer );
+			outData = outData + outBuffer->bufSize;
+			dataLen = dataLen - outBuffer->bufSize;
+		}
+	}
+
+	memcpy( outBuffer->bufData + outBuffer->bufUsed , outData , dataLen );
+	outBuffer->bufUsed = outBuffer->bufUsed + dataLen;
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: outputFlush
+*        INPUT: *outBuffer     - output buffer structure
+*       OUTPUT:	ERROR or OK
+*  DESCRIPTION: This function writes whole buffer with one write call ( more 
+*               only if write is interrupted ) and empties buffer
+********************************************************************************/
+
+int outputFlush( outputBuffer_s *outBuffer )
+{
+	size_t written;
+
+#ifndef WINDOWS
+	ssize_t retVal;
+#endif
+
+#ifdef USE_ZLIB
+	/* Buffer is compressed to file */
+	if( outBuffer->gzipStream != NULL ) {
+		return outputGzipWrite( outBuffer , Z_NO_FLUSH );
+	}
+#endif
+
+	/* Text printed before with printf must stay in front */
+	fflush( outBuffer->outFilePtr );
+
+	written = 0;
+
+	while( written < outBuffer->bufUsed ) {
+#ifndef WINDOWS
+		retVal = write( fileno( outBuffer->outFilePtr ) , outBuffer->bufData + written , outBuffer->bufUsed - written );
+		if( retVal <= 0 ) {
+			break;
+		}
+		written = written + retVal;
+#else
+		written = written + fwrite( outBuffer->bufData + written , 1 , outBuffer->bufUsed - written , outBuffer->outFilePtr );
+		break;
+#endif
+	}
+
+	outBuffer->outWritten = outBuffer->outWritten + written;
+
+	if( written < outBuffer->bufUsed ) {
+		printf("Cannot write to output!\n");
+		outBuffer->bufUsed = 0;
+		return ERROR;
+	}
+
+	outBuffer->bufUsed = 0;
+
+	return OK;
+}
+
+#ifdef USE_ZLIB
+/********************************************************************************
+*     FUNCTION: outputGzipWrite
+*        INPUT: *outBuffer     - output buffer structure with gzip stream
+*               flushMode      - Z_NO_FLUSH or Z_FINISH ( end of file )
+*       OUTPUT:	ERROR or OK
+*  DESCRIPTION: This function compresses buffer to output file ( --gzip ). 
+*               Compressed data is written in chunks while buffer is 
+*               compressed, so .gz file is made in one pass.
+********************************************************************************/
+
+int outputGzipWrite( outputBuffer_s *outBuffer , int flushMode )
+{
+	size_t dataLen;
+	z_stream *gzipStream;
+	unsigned char gzipChunk[GZIP_CHUNK];
+
+	gzipStream = outBuffer->gzipStream;
+	gzipStream->next_in = (unsigned char *) outBuffer->bufData;
+	gzipStream->avail_in = outBuffer->bufUsed;
+	outBuffer->bufUsed = 0;
+
+	do {
+		gzipStream->next_out = gzipChunk;
+		gzipStream->avail_out = GZIP_CHUNK;
+		if( deflate( gzipStream , flushMode ) == Z_STREAM_ERROR ) {
+			printf("Cannot compress output!\n");
+			return ERROR;
+		}
+
+		dataLen = GZIP_CHUNK - gzipStream->avail_out;
+		if( fwrite( gzipChunk , 1 , dataLen , outBuffer->outFilePtr ) != dataLen ) {
+			printf("Cannot write to output!\n");
+			return ERROR;
+		}
+		outBuffer->outWritten = outBuffer->outWritten + dataLen;
+
+	} while( gzipStream->avail_out == 0 );
+
+	return OK;
+}
+#endif
+
+/********************************************************************************
+*     FUNCTION: htmlFilePrintHeader
+*        INPUT: *outBuffer - output buffer of html file
+*               utf8Flag   - symbols are UTF-8 ( charset is declared )
+*       OUTPUT: /
+*  DESCRIPTION: This function stores html header to output buffer. Style 
+*               of image is one short class. For 256 colors every palette
+*               color of cube gets class, so each span is only index.
+********************************************************************************/
+
+void htmlFilePrintHeader( outputBuffer_s *outBuffer , int utf8Flag )
+{
+	int cubeIndex;
+	char colorClass[HTML_CLASS_MAX + 1];
+
+	static const unsigned char cubeValues[6] = { 0 , 95 , 135 , 175 , 215 , 255 };	/* xterm cube levels */
+
+	outputAppendText( outBuffer , HTML_HEAD_START );
+	if( utf8Flag ) {
+		outputAppendText( outBuffer , HTML_CHARSET );
+	}
+	outputAppendText( outBuffer , HTML_STYLE );
+
+	if( outBuffer->colorMode == COLOR_256 ) {
+		for( cubeIndex = 0 ; cubeIndex < 216 ; cubeIndex++ ) {
+			snprintf( colorClass , sizeof( colorClass ) , ".c%d{color:#%02x%02x%02x}\n" , COLOR_CUBE_START + cubeIndex ,
+						cubeValues[cubeIndex / 36] , cubeValues[(cubeIndex / 6) % 6] , cubeValues[cubeIndex % 6] );
+			outputAppendText( outBuffer , colorClass );
+		}
+	}
+
+	outputAppendText( outBuffer , HTML_BODY_START );
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: htmlFilePrintFooter
+*        INPUT: *outBuffer - output buffer of html file
+*       OUTPUT: /
+*  DESCRIPTION: This function stores html footer to output buffer
+********************************************************************************/
+
+void htmlFilePrintFooter( outputBuffer_s *outBuffer )
+{
+	/* Last color span is closed here */
+	if( outBuffer->spanOpen ) {
+		outputAppendText( outBuffer , "</span>" );
+		outBuffer->spanOpen = 0;
+	}
+
+	outputAppendText( outBuffer , HTML_FOOTER );
+	return;
+}
+
+/********************************************************************************
+ *     Function: initGlyphTable 
+ *        Input: userInput - user input data ( bitGraphic , invertFlag and 
+ *                           asciiRamp are used )
+ *       Output: /
+ *  Description: This function stores ascii symbol for each gray value to 
+ *               userInput->glyphTable, so printing needs only one lookup per
+ *               symbol. User ramp ( --ramp ) can have any length, otherwise
+ *               1 , 2 , 3 or 4 bit table is used.
+ ********************************************************************************/
+
+void initGlyphTable( userInput_s *userInput )
+{
+	int grayValue;
+	int rampValue;
+	int rampLen;
+	char *asciiRamp;
+
+	asciiRamp = userInput->asciiRamp;
+	if( asciiRamp == NULL ) {
+		asciiRamp = getBuiltinRamp( userInput->bitGraphic );
+	}
+
+	rampLen = strlen( asciiRamp );
+
+	for( grayValue = 0 ; grayValue < 256 ; grayValue++ ) {
+
+		rampValue = grayValue;
+
+		/* Inverted mode */
+		if( userInput->invertFlag == 1 ) {
+			rampValue = 255 - grayValue;
+		}
+
+		/* For 2^n long ramps same as rampValue / (256 / rampLen) */
+		userInput->glyphTable[grayValue] = asciiRamp[ (rampValue * rampLen) / 256 ];
+	}
+
+	return;
+}
+
+/* Coverage bitmaps of symbols for --shape - 4 x 6 pixels, 4 bits per line from top, left pixel is highest bit */
+static const glyphBitmap_s glyphBitmaps[] = {
+	{ ' ' , 0x000000 } , { '.' , 0x000004 } , { ',' , 0x000048 } , { '\'' , 0x440000 } , { '`' , 0x840000 } ,
+	{ '-' , 0x000E00 } , { '_' , 0x00000F } , { '=' , 0x00E0E0 } , { '~' , 0x005A00 } , { '^' , 0x4A0000 } ,
+	{ '"' , 0xAA0000 } , { ':' , 0x004040 } , { ';' , 0x004048 } , { '!' , 0x444404 } , { '|' , 0x444444 } ,
+	{ '/' , 0x122448 } , { '\\' , 0x844221 } , { '(' , 0x244442 } , { ')' , 0x422224 } , { '[' , 0x644446 } ,
+	{ ']' , 0x622226 } , { '<' , 0x024842 } , { '>' , 0x042124 } , { '+' , 0x004E40 } , { '*' , 0x0A4A00 } ,
+	{ 'x' , 0x000A4A } , { 'o' , 0x006996 } , { 'c' , 0x006886 } , { 'v' , 0x00AAA4 } , { 'u' , 0x00AAAE } ,
+	{ 'n' , 0x00CAAA } , { 'i' , 0x404444 } , { 'T' , 0xE44444 } , { 'L' , 0x88888E } , { 'J' , 0x2222A4 } ,
+	{ 'Y' , 0xAA4444 } , { 'V' , 0xAAAAA4 } , { 'A' , 0x4AAEAA } , { 'H' , 0xAAEAAA } , { 'M' , 0x9F9999 } ,
+	{ 'W' , 0x9999F9 } , { 'N' , 0x9DDBB9 } , { 'O' , 0x699996 } , { '8' , 0x696996 } , { '@' , 0x69BB87 } ,
+	{ '#' , 0x5F5AFA } , { '%' , 0x922449 } , { '&' , 0x4A4BA5 } , { '$' , 0x6C6364 } , { 'X' , 0x996699 } ,
+	{ '7' , 0xF12444 } , { 'F' , 0xF8E888 } , { 'P' , 0xE9E888 } , { 'b' , 0x88E99E } , { 'd' , 0x117997 } ,
+	{ 'E' , 0xF8E88F } , { 'U' , 0x999996 } , { 'K' , 0x9ACCA9 } , { 'B' , 0xE9E99E } , { 'D' , 0xE9999E } ,
+	{ 'G' , 0x788B97 } , { 'S' , 0x78611E } , { 'C' , 0x788887 } , { 'R' , 0xE9ECA9 } , { 'I' , 0xE4444E } ,
+	{ '1' , 0x4C444E } , { '2' , 0x69248F } , { '4' , 0x26AF22 } , { '6' , 0x68E996 } , { '9' , 0x699716 } ,
+	{ '3' , 0xE1611E } , { '5' , 0xF8E11E } , { '?' , 0x692404 }
+};
+
+/********************************************************************************
+ *     Function: initShapeTable 
+ *        Input: userInput - user input data ( invertFlag and asciiRamp are 
+ *                           used )
+ *       Output: /
+ *  Description: This function stores best symbol for each region signature 
+ *               to userInput->shapeTable, so --shape costs one lookup per 
+ *               symbol. Signature holds 2 bit mean of each of 2 x 3 regions
+ *               of symbol. Symbol with least squared difference between its
+ *               ink in each region ( glyphBitmaps ) and darkness of region
+ *               is selected. User ramp limits symbols to those in ramp.
+ ********************************************************************************/
+
+void initShapeTable( userInput_s *userInput )
+{
+	int i;
+	int pix;
+	int glyph;
+	int region;
+	int signature;
+	int glyphInk;
+	int regionInk;
+	int inkDiff;
+	int glyphDist;
+	int bestDist;
+	int useRamp;
+	int numOfGlyphs;
+	uint32_t glyphLine;
+	unsigned char glyphCoverage[sizeof(glyphBitmaps) / sizeof(glyphBitmaps[0])][SHAPE_REGIONS];
+
+	numOfGlyphs = sizeof(glyphBitmaps) / sizeof(glyphBitmaps[0]);
+
+	/* Lit pixels of bitmap in each region ( 2 x 2 pixels ) */
+	for( glyph = 0 ; glyph < numOfGlyphs ; glyph++ ) {
+		memset( glyphCoverage[glyph] , 0 , SHAPE_REGIONS );
+		for( i = 0 ; i < GLYPH_BITMAP_HEIGHT ; i++ ) {
+			glyphLine = (glyphBitmaps[glyph].bitmap >> (GLYPH_BITMAP_WIDTH * (GLYPH_BITMAP_HEIGHT - 1 - i))) & 0xF;
+			for( pix = 0 ; pix < GLYPH_BITMAP_WIDTH ; pix++ ) {
+				if( glyphLine & (0x8 >> pix) ) {
+					glyphCoverage[glyph][(i / 2) * SHAPE_COLS + pix / 2]++;
+				}
+			}
+		}
+	}
+
+	/* Ramp symbols without bitmap are not used, ramp without any known symbol is ignored */
+	useRamp = 0;
+	if( userInput->asciiRamp != NULL ) {
+		for( glyph = 0 ; glyph < numOfGlyphs ; glyph++ ) {
+			if( strchr( userInput->asciiRamp , glyphBitmaps[glyph].glyph ) != NULL ) {
+				useRamp = 1;
+			}
+		}
+	}
+
+	for( signature = 0 ; signature < SHAPE_TABLE_SIZE ; signature++ ) {
+
+		bestDist = -1;
+		for( glyph = 0 ; glyph < numOfGlyphs ; glyph++ ) {
+
+			if( useRamp && (strchr( userInput->asciiRamp , glyphBitmaps[glyph].glyph ) == NULL) ) {
+				continue;
+			}
+
+			/* Ink in eighths of region - black region wants most ink */
+			glyphDist = 0;
+			for( region = 0 ; region < SHAPE_REGIONS ; region++ ) {
+				regionInk = (signature >> (2 * region)) & (SHAPE_LEVELS - 1);
+				regionInk = (userInput->invertFlag == 1) ? (2 * regionInk + 1) : (7 - 2 * regionInk);
+				glyphInk = 2 * glyphCoverage[glyph][region];
+				inkDiff = glyphInk - regionInk;
+				glyphDist = glyphDist + inkDiff * inkDiff;
+			}
+
+			if( (bestDist < 0) || (glyphDist < bestDist) ) {
+				bestDist = glyphDist;
+				userInput->shapeTable[signature] = glyphBitmaps[glyph].glyph;
+			}
+		}
+	}
+
+	return;
+}
+
+/********************************************************************************
+ *     Function: initMaskTable 
+ *        Input: userInput - user input data ( maskMode and invertFlag are 
+ *                           used )
+ *       Output: /
+ *  Description: This function stores UTF-8 symbol for every sub-pixel mask 
+ *               of --braille or --blocks to userInput->maskTable. Bit of 
+ *               mask is set for light sub-pixel, sub-pixels go from left 
+ *               to right and from top. Dark sub-pixels are drawn ( dots or 
+ *               quadrants ), light ones with invert flag.
+ ********************************************************************************/
+
+void initMaskTable( userInput_s *userInput )
+{
+	int mask;
+	int subPixel;
+	int inkMask;
+	int numOfMasks;
+	int codePoint;
+
+	/* Braille dot of each sub-pixel ( dots 1-3 and 7 are left column ) */
+	static const unsigned char brailleDots[8] = { 0x01 , 0x08 , 0x02 , 0x10 , 0x04 , 0x20 , 0x40 , 0x80 };
+
+	/* Block element of each 2 x 2 mask ( upper left is lowest bit ) */
+	static const unsigned short blockSymbols[16] = {
+		0x0020 , 0x2598 , 0x259D , 0x2580 , 0x2596 , 0x258C , 0x259E , 0x259B ,
+		0x2597 , 0x259A , 0x2590 , 0x259C , 0x2584 , 0x2599 , 0x259F , 0x2588
+	};
+
+	numOfMasks = (userInput->maskMode == MASK_BRAILLE) ? 256 : 16;
+
+	for( mask = 0 ; mask < numOfMasks ; mask++ ) {
+
+		inkMask = (userInput->invertFlag == 1) ? mask : (~mask & (numOfMasks - 1));
+
+		if( userInput->maskMode == MASK_BRAILLE ) {
+			codePoint = 0x2800;
+			for( subPixel = 0 ; subPixel < 8 ; subPixel++ ) {
+				if( inkMask & (1 << subPixel) ) {
+					codePoint = codePoint | brailleDots[subPixel];
+				}
+			}
+		} else {
+			codePoint = blockSymbols[inkMask];
+		}
+
+		/* Only space and 3 byte symbols ( U+0800 - U+FFFF ) are used */
+		memset( userInput->maskTable[mask] , 0 , 4 );
+		if( codePoint < 0x80 ) {
+			userInput->maskTable[mask][0] = codePoint;
+			userInput->maskTable[mask][3] = 1;
+		} else {
+			userInput->maskTable[mask][0] = 0xE0 | (codePoint >> 12);
+			userInput->maskTable[mask][1] = 0x80 | ((codePoint >> 6) & 0x3F);
+			userInput->maskTable[mask][2] = 0x80 | (codePoint & 0x3F);
+			userInput->maskTable[mask][3] = 3;
+		}
+	}
+
+	return;
+}
+
+/********************************************************************************
+ *     Function: initColorTable 
+ *        Input: userInput - user input data
+ *       Output: /
+ *  Description: This function stores nearest level of 256-color cube ( 0, 95,
+ *               135, 175, 215, 255 ) for each channel value to 
+ *               userInput->colorLevels
+ ********************************************************************************/
+
+void initColorTable( userInput_s *userInput )
+{
+	int colorValue;
+
+	for( colorValue = 0 ; colorValue < 256 ; colorValue++ ) {
+		if( colorValue < 48 ) {
+			userInput->colorLevels[colorValue] = 0;
+		} else if( colorValue < 115 ) {
+			userInput->colorLevels[colorValue] = 1;
+		} else {
+			userInput->colorLevels[colorValue] = (colorValue - 35) / 40;
+		}
+	}
+
+	return;
+}
+
+/********************************************************************************
+ *     Function: getBuiltinRamp 
+ *        Input: bitGraphic - 1 , 2 , 3 , 4 bit graphic
+ *       Output: Ascii symbols from black to white
+ *  Description: /
+ ********************************************************************************/
+
+char * getBuiltinRamp( int bitGraphic )
+{
+	static char tabel_1[] = "# ";					/* 1 bit graphic */
+	static char tabel_2[] = "#6+ ";					/* 2 bit graphic */	
+	static char tabel_3[] = "#&$21:- ";				/* 3 bit graphic */
+	static char tabel_4[] = "##&8$62I1|:+-.  ";		/* 4 bit graphic */
+
+	switch ( bitGraphic ) {
+		case 1:
+			return tabel_1;
+		case 2:
+			return tabel_2;
+		case 3:
+			return tabel_3;
+		default:
+			return tabel_4;
+	}
+}
+
+
+/********************************************************************************
+ *     Function: ditherInit 
+ *        Input: dither    - dither structure
+ *               lineSize  - size of output line ( getAsciiLineSize )
+ *               userInput - user input data ( ditherMode , bitGraphic , 
+ *                           invertFlag and asciiRamp are used )
+ *       Output: ERROR or OK
+ *  Description: This function prepares dithering of one image. Error 
+ *               diffusion needs only errors carried to current line and to
+ *               next line, one entry more on each side of line.
+ ********************************************************************************/
+
+int ditherInit( dither_s *dither , int lineSize , userInput_s *userInput )
+{
+	dither->ditherMode = userInput->ditherMode;
+	dither->lineNum = 0;
+	dither->invertFlag = userInput->invertFlag;
+	dither->asciiRamp = userInput->asciiRamp;
+	if( dither->asciiRamp == NULL ) {
+		dither->asciiRamp = getBuiltinRamp( userInput->bitGraphic );
+	}
+	dither->numOfLevels = strlen( dither->asciiRamp );
+	dither->lineSize = lineSize + 2;
+	dither->lineErrors = NULL;
+	dither->nextErrors = NULL;
+
+	/* One symbol has nothing to diffuse, ordered path maps every value to it */
+	if( (dither->ditherMode == DITHER_FS) && (dither->numOfLevels < 2) ) {
+		dither->ditherMode = DITHER_BAYER;
+	}
+
+	if( dither->ditherMode == DITHER_FS ) {
+		dither->lineErrors = calloc( dither->lineSize , sizeof(int) );
+		dither->nextErrors = calloc( dither->lineSize , sizeof(int) );
+		if( (dither->lineErrors == NULL) || (dither->nextErrors == NULL) ) {
+			printf("Cannot allocate memory for dithering!\n");
+			ditherDestroy( dither );
+			return ERROR;
+		}
+	}
+
+	return OK;
+}
+
+/********************************************************************************
+ *     Function: ditherLine 
+ *        Input: dither     - dither structure made by ditherInit
+ *               asciiLine  - gray value of each symbol ( line builders 
+ *                            skip glyphTable in dither mode )
+ *               lineLen    - number of symbols
+ *       Output: /
+ *  Description: This function replaces gray values of one output line with 
+ *               ramp symbols. Lines must come in order. Floyd-Steinberg 
+ *               quantizes to nearest ramp level and pushes error ( 1/16 
+ *               units ) 7/16 right and 3/16, 5/16, 1/16 to next line. 
+ *               Bayer adds 4 x 4 matrix threshold before rounding down.
+ ********************************************************************************/
+
+void ditherLine( dither_s *dither , char *asciiLine , int lineLen )
+{
+	int symIndex;
+	int symLevel;
+	int maxLevel;
+	int grayValue;
+	int grayError;
+	int *swapErrors;
+
+	static const unsigned char bayerMatrix[4][4] = {
+		{  0 ,  8 ,  2 , 10 } ,
+		{ 12 ,  4 , 14 ,  6 } ,
+		{  3 , 11 ,  1 ,  9 } ,
+		{ 15 ,  7 , 13 ,  5 }
+	};
+
+	/* Line already has symbols */
+	if( dither->ditherMode == DITHER_NONE ) {
+		return;
+	}
+
+	maxLevel = dither->numOfLevels - 1;
+
+	for( symIndex = 0 ; symIndex < lineLen ; symIndex++ ) {
+
+		grayValue = (unsigned char) asciiLine[symIndex];
+
+		if( dither->ditherMode == DITHER_BAYER ) {
+			symLevel = (grayValue * maxLevel * 32 + (2 * bayerMatrix[dither->lineNum & 3][symIndex & 3] + 1) * 255) / 
+						(255 * 32);
+		} else {
+			/* Value with carried error in 1/16 units ( entry 0 is left of line ) */
+			grayValue = grayValue * 16 + dither->lineErrors[symIndex + 1];
+			if( grayValue < 0 ) {
+				grayValue = 0;
+			} else if( grayValue > 255 * 16 ) {
+				grayValue = 255 * 16;
+			}
+
+			symLevel = (grayValue * maxLevel + 255 * 8) / (255 * 16);
+			grayError = grayValue - symLevel * 255 * 16 / maxLevel;
+
+			dither->lineErrors[symIndex + 2] = dither->lineErrors[symIndex + 2] + grayError * 7 / 16;
+			dither->nextErrors[symIndex] = dither->nextErrors[symIndex] + grayError * 3 / 16;
+			dither->nextErrors[symIndex + 1] = dither->nextErrors[symIndex + 1] + grayError * 5 / 16;
+			dither->nextErrors[symIndex + 2] = dither->nextErrors[symIndex + 2] + grayError / 16;
+		}
+
+		asciiLine[symIndex] = dither->asciiRamp[ (dither->invertFlag == 1) ? (maxLevel - symLevel) : symLevel ];
+	}
+
+	/* Next line becomes current, line after it starts without error */
+	if( dither->ditherMode == DITHER_FS ) {
+		swapErrors = dither->lineErrors;
+		dither->lineErrors = dither->nextErrors;
+		dither->nextErrors = swapErrors;
+		memset( dither->nextErrors , 0 , dither->lineSize * sizeof(int) );
+	}
+
+	dither->lineNum++;
+
+	return;
+}
+
+/********************************************************************************
+ *     Function: ditherDestroy 
+ *        Input: dither - dither structure
+ *       Output: /
+ *  Description: /
+ ********************************************************************************/
+
+void ditherDestroy( dither_s *dither )
+{
+	free( dither->lineErrors );
+	free( dither->nextErrors );
+	dither->lineErrors = NULL;
+	dither->nextErrors = NULL;
+
+	return;
+}
+
+/********************************************************************************
+ *     FUNCTION: makeGrayPixelMap
+ *        INPUT: *grayImageMap  - 2D map for retriving grayscale pixels
+ *               *memArena      - arena for line of RGB pixels
+ *               *imageFile     - opened image file
+ *               *userInput     - user input data struct
+ *               *imageData     - image data struct
+ *       OUTPUT: ERROR or OK
+ *  DESCRIPTION: This function converts .bmp file to 2D gray pixel map
+ ********************************************************************************/
+
+int makeGrayPixelMap( pixelMap_s *grayImageMap , memArena_s *memArena , imageFile_s *imageFile , 
+					userInput_s *userInput , imageData_s *imageData )
+{
+	int line;
+	
+	unsigned char *lineBuffer;	
+	unsigned char *linePixels;	
+	unsigned char *grayLine;
+	
+	/* Allocat memory for whole line of pixels - mapped file is read in place */
+	lineBuffer = NULL;
+	if( (imageFile->fileData == NULL) && (imageFile->pixelData == NULL) ) {
+		lineBuffer = arenaAlloc( memArena , imageData->imgWidthInBytes );
+		if( lineBuffer == NULL ) {
+			printf("Cannot allocate memory for lineBuffer!\n");
+			return ERROR;
+		}
+	}
+
+	/*************************************************************************/
+	/*                           Make gray image map                         */                
+	/*************************************************************************/
+
+	/* Read all lines in file order and store gray pixels in grayImageMap */
+	for( line = imageData->topDown ? 0 : imageData->imgHeight - 1 ; (line >= 0) && (line < imageData->imgHeight) ;
+			line = imageData->topDown ? line + 1 : line - 1 ) {	
+		
+		/* Read on line of pixels */
+		linePixels = bmpReadLines( imageFile , imageData , line , 1 , lineBuffer );
+		if( linePixels == NULL ) {
+			printf("Cannot read form file!\n");
+			return ERROR;
+		}
+
+		/* Convert line of pixels to line of gray pixels ( kernel of pixel format ) */
+		grayLine = PIXEL_MAP_LINE( grayImageMap , line );
+		imageData->bmpFormat->lineToGray( linePixels , grayLine , imageData->imgWidth , userInput->grayMode , imageData );
+	}
+
+	return OK;
+
+}
+
+/********************************************************************************
+ *     FUNCTION: readBandCells
+ *        INPUT: *imageFile    - opened image file
+ *               *cellLine     - symbol sums of one output line
+ *               *bandBuffer   - buffer for one band of RGB pixels 
+ *                               ( NULL when file is mapped )
+ *               firstLine     - first image line of band ( top to bottom )
+ *               *userInput    - user input data struct
+ *               *imageData    - image data struct
+ *       OUTPUT: ERROR or OK
+ *  DESCRIPTION: This function reads one band of symbolHeight lines from .bmp
+ *               file. Each line is converted to gray pixels in one reused 
+ *               line and added to symbol sums, so band is never stored as 
+ *               gray pixels. Band is stored in file as one continuous block,
+ *               so it is read with single read ( or used in place when file
+ *               is mapped ). In color mode raw lines are summed by columns
+ *               too ( makeCellColors ).
+ ********************************************************************************/
+
+int readBandCells( imageFile_s *imageFile , cellLine_s *cellLine , unsigned char *bandBuffer ,
+					int firstLine , userInput_s *userInput , imageData_s *imageData )
+{
+	int pix;
+	int line;
+	int symIndex;
+	int colorBytes;
+	uint32_t symTemp;
+	unsigned char *bandPixels;
+	unsigned char *linePixels;
+	unsigned char *grayPtr;
+
+	bandPixels = bmpReadLines( imageFile , imageData , firstLine , cellLine->symbolHeight , bandBuffer );
+	if( bandPixels == NULL ) {
+		printf("Cannot read form file!\n");
+		return ERROR;
+	}
+
+	memset( cellLine->cellSums , 0 , cellLine->numOfCells * sizeof(uint32_t) );
+
+	/* Color mode - raw bytes of symbols are summed by columns ( B, G, R of each pixel ) */
+	colorBytes = cellLine->numOfCells * cellLine->symbolWidth * 3;
+	if( cellLine->colorColumns != NULL ) {
+		memset( cellLine->colorColumns , 0 , colorBytes * sizeof(uint16_t) );
+	}
+
+	/* Order of lines does not matter for sums - lines are read as stored */
+	for( line = 0 ; line < cellLine->symbolHeight ; line++ ) {	
+
+		linePixels = bandPixels + ((size_t) line * imageData->imgWidthInBytes);
+
+		imageData->bmpFormat->lineToGray( linePixels , cellLine->grayLine , imageData->imgWidth , 
+						userInput->grayMode , imageData );
+
+		/* Colors are summed from B, G, R bytes - other formats are expanded first */
+		if( cellLine->colorColumns != NULL ) {
+			if( imageData->bmpFormat->lineToBgr != NULL ) {
+				imageData->bmpFormat->lineToBgr( linePixels , cellLine->bgrLine , imageData->imgWidth , imageData );
+				linePixels = cellLine->bgrLine;
+			}
+			colorAddLine( linePixels , cellLine->colorColumns , colorBytes );
+		}
+
+		/* Add line to symbol sums */
+		grayPtr = cellLine->grayLine;
+		for( symIndex = 0 ; symIndex < cellLine->numOfCells ; symIndex++ ) {
+			symTemp = 0;
+			for( pix = 0 ; pix < cellLine->symbolWidth ; pix++ ) {
+				symTemp = symTemp + grayPtr[pix];
+			}
+			cellLine->cellSums[symIndex] = cellLine->cellSums[symIndex] + symTemp;
+			grayPtr = grayPtr + cellLine->symbolWidth;
+		}
+	}
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: readResampleLine
+*        INPUT: imageFile    - opened image file
+*               resampleLine - resample line made by createResampleLine
+*               lineBuffer   - buffer for one stored line ( NULL if file is mapped )
+*               outLine      - output line
+*               userInput    - user input data strucure
+*               imageData    - image data structure
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function sums source lines covered by output line. Line 
+*               y covers [y * rows, (y + 1) * rows) and output line covers 
+*               [outLine * height, (outLine + 1) * height), each line is 
+*               added with its overlap as weight. Line on edge of two output
+*               lines is decoded only once.
+********************************************************************************/
+
+int readResampleLine( imageFile_s *imageFile , resampleLine_s *resampleLine , unsigned char *lineBuffer ,
+					int outLine , userInput_s *userInput , imageData_s *imageData )
+{
+	int pix;
+	int line;
+	int lastLine;
+	int colorBytes;
+	uint64_t lineWeight;
+	int64_t outTop;
+	int64_t outBottom;
+	int64_t lineTop;
+	int64_t lineBottom;
+	unsigned char *linePixels;
+
+	outTop = (int64_t) outLine * imageData->imgHeight;
+	outBottom = outTop + imageData->imgHeight;
+	lastLine = (int) ((outBottom - 1) / resampleLine->numOfRows);
+	colorBytes = imageData->imgWidth * 3;
+
+	memset( resampleLine->rowSums , 0 , imageData->imgWidth * sizeof(uint64_t) );
+	if( resampleLine->colorSums != NULL ) {
+		memset( resampleLine->colorSums , 0 , colorBytes * sizeof(uint64_t) );
+	}
+
+	for( line = (int) (outTop / resampleLine->numOfRows) ; line <= lastLine ; line++ ) {
+
+		/* Line on edge was decoded for previous output line */
+		if( line != resampleLine->loadedLine ) {
+
+			linePixels = bmpReadLines( imageFile , imageData , line , 1 , lineBuffer );
+			if( linePixels == NULL ) {
+				printf("Cannot read form file!\n");
+				return ERROR;
+			}
+
+			imageData->bmpFormat->lineToGray( linePixels , resampleLine->grayLine , imageData->imgWidth , 
+							userInput->grayMode , imageData );
+
+			if( resampleLine->colorSums != NULL ) {
+				if( imageData->bmpFormat->lineToBgr != NULL ) {
+					imageData->bmpFormat->lineToBgr( linePixels , resampleLine->bgrLine , imageData->imgWidth , imageData );
+					linePixels = resampleLine->bgrLine;
+				}
+				resampleLine->colorPixels = linePixels;
+			}
+
+			resampleLine->loadedLine = line;
+		}
+
+		lineTop = (int64_t) line * resampleLine->numOfRows;
+		lineBottom = lineTop + resampleLine->numOfRows;
+		lineWeight = ((lineBottom < outBottom) ? lineBottom : outBottom) - ((lineTop > outTop) ? lineTop : outTop);
+
+		for( pix = 0 ; pix < imageData->imgWidth ; pix++ ) {
+			resampleLine->rowSums[pix] = resampleLine->rowSums[pix] + lineWeight * resampleLine->grayLine[pix];
+		}
+
+		if( resampleLine->colorSums != NULL ) {
+			for( pix = 0 ; pix < colorBytes ; pix++ ) {
+				resampleLine->colorSums[pix] = resampleLine->colorSums[pix] + lineWeight * resampleLine->colorPixels[pix];
+			}
+		}
+	}
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: pixelToGray
+*        INPUT: redPix   - color value ( 0 - 255 ) 
+*               greenPix - color value ( 0 - 255 ) 
+*               bluePix  - color value ( 0 - 255 ) 
+*       OUTPUT: Gray pixel value
+*  DESCRIPTION: This function return gray-scale pixel
+********************************************************************************/
+
+static inline unsigned char pixelToGray( unsigned char redPix , unsigned char greenPix , unsigned char bluePix )
+{
+	unsigned char retVal = (int) (redPix + greenPix + bluePix ) / 3;
+	return retVal;
+
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToGray
+*        INPUT: linePixels - line of 24-bit pixels ( B, G, R byte order )
+*               grayLine   - line of gray pixels
+*               widthInPix - number of pixels in line
+*               grayMode   - GRAY_AVERAGE, GRAY_BT601 or GRAY_BT709
+*       OUTPUT: /
+*  DESCRIPTION: This function converts one line of pixels to gray pixels. 
+*               AVX2 or SSSE3 kernel is used when CPU supports it, pixels 
+*               left at the end of line are converted by scalar code.
+********************************************************************************/
+
+void bmpLineToGray( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode )
+{
+	int done;
+
+	done = 0;
+
+#ifdef GRAY_SIMD_X86
+	if( __builtin_cpu_supports("avx2") ) {
+		done = bmpLineToGrayAvx2( linePixels , grayLine , widthInPix , grayMode );
+	} else if( __builtin_cpu_supports("ssse3") ) {
+		done = bmpLineToGraySsse3( linePixels , grayLine , widthInPix , grayMode );
+	}
+#endif
+
+	bmpLineToGrayScalar( linePixels + (done * 3) , grayLine + done , widthInPix - done , grayMode );
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToGrayScalar
+*        INPUT: linePixels - line of 24-bit pixels ( B, G, R byte order )
+*               grayLine   - line of gray pixels
+*               widthInPix - number of pixels in line
+*               grayMode   - GRAY_AVERAGE, GRAY_BT601 or GRAY_BT709
+*       OUTPUT: /
+*  DESCRIPTION: Scalar gray conversion, one pixel at a time
+********************************************************************************/
+
+void bmpLineToGrayScalar( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode )
+{
+	int pixel;
+	unsigned char *pixPtr;
+
+	pixPtr = linePixels;
+
+	switch( grayMode ) {
+		case GRAY_BT601:
+			for( pixel = 0 ; pixel < widthInPix ; pixel++ , pixPtr = pixPtr + 3 ) {
+				grayLine[pixel] = (BT601_B * pixPtr[0] + BT601_G * pixPtr[1] + BT601_R * pixPtr[2] + 128) >> 8;
+			}
+			break;
+
+		case GRAY_BT709:
+			for( pixel = 0 ; pixel < widthInPix ; pixel++ , pixPtr = pixPtr + 3 ) {
+				grayLine[pixel] = (BT709_B * pixPtr[0] + BT709_G * pixPtr[1] + BT709_R * pixPtr[2] + 128) >> 8;
+			}
+			break;
+
+		default:
+			for( pixel = 0 ; pixel < widthInPix ; pixel++ , pixPtr = pixPtr + 3 ) {
+				grayLine[pixel] = pixelToGray( pixPtr[0] , pixPtr[1] , pixPtr[2] );
+			}
+	}
+
+	return;
+}
+
+#ifdef GRAY_SIMD_X86
+
+/********************************************************************************
+*     FUNCTION: grayFromChannels16
+*        INPUT: blue, green, red - 16-bit channel values
+*               grayMode         - GRAY_AVERAGE, GRAY_BT601 or GRAY_BT709
+*       OUTPUT: 16-bit gray values
+*  DESCRIPTION: Divide by 3 is done as fixed-point multiply, weighted luma as
+*               multiply with weights that sum to 256.
+********************************************************************************/
+
+__attribute__((target("ssse3")))
+static inline __m128i grayFromChannels16( __m128i blue , __m128i green , __m128i red , int grayMode )
+{
+	switch( grayMode ) {
+		case GRAY_BT601:
+			return _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( 
+					_mm_mullo_epi16( blue , _mm_set1_epi16( BT601_B ) ),
+					_mm_mullo_epi16( green , _mm_set1_epi16( BT601_G ) ) ),
+					_mm_add_epi16( _mm_mullo_epi16( red , _mm_set1_epi16( BT601_R ) ), 
+					_mm_set1_epi16( 128 ) ) ) , 8 );
+
+		case GRAY_BT709:
+			return _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( 
+					_mm_mullo_epi16( blue , _mm_set1_epi16( BT709_B ) ),
+					_mm_mullo_epi16( green , _mm_set1_epi16( BT709_G ) ) ),
+					_mm_add_epi16( _mm_mullo_epi16( red , _mm_set1_epi16( BT709_R ) ), 
+					_mm_set1_epi16( 128 ) ) ) , 8 );
+
+		default:
+			return _mm_mulhi_epu16( _mm_add_epi16( _mm_add_epi16( blue , green ) , red ) , 
+					_mm_set1_epi16( GRAY_DIV3_MUL ) );
+	}
+}
+
+/********************************************************************************
+*     FUNCTION: splitPixels16
+*        INPUT: linePixels - 16 packed pixels ( 48 bytes )
+*               channels   - returned blue, green and red bytes
+*       OUTPUT: /
+*  DESCRIPTION: Splits 16 packed B, G, R pixels to three channels with pshufb
+********************************************************************************/
+
+__attribute__((target("ssse3")))
+static inline void splitPixels16( unsigned char *linePixels , __m128i *channels )
+{
+	__m128i in0 = _mm_loadu_si128( (__m128i *) linePixels );
+	__m128i in1 = _mm_loadu_si128( (__m128i *) (linePixels + 16) );
+	__m128i in2 = _mm_loadu_si128( (__m128i *) (linePixels + 32) );
+
+	/* Blue */
+	channels[0] = _mm_or_si128( _mm_or_si128(
+		_mm_shuffle_epi8( in0 , _mm_setr_epi8( 0,3,6,9,12,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1 ) ),
+		_mm_shuffle_epi8( in1 , _mm_setr_epi8( -1,-1,-1,-1,-1,-1,2,5,8,11,14,-1,-1,-1,-1,-1 ) ) ),
+		_mm_shuffle_epi8( in2 , _mm_setr_epi8( -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,1,4,7,10,13 ) ) );
+
+	/* Green */
+	channels[1] = _mm_or_si128( _mm_or_si128(
+		_mm_shuffle_epi8( in0 , _mm_setr_epi8( 1,4,7,10,13,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1 ) ),
+		_mm_shuffle_epi8( in1 , _mm_setr_epi8( -1,-1,-1,-1,-1,0,3,6,9,12,15,-1,-1,-1,-1,-1 ) ) ),
+		_mm_shuffle_epi8( in2 , _mm_setr_epi8( -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,2,5,8,11,14 ) ) );
+
+	/* Red */
+	channels[2] = _mm_or_si128( _mm_or_si128(
+		_mm_shuffle_epi8( in0 , _mm_setr_epi8( 2,5,8,11,14,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1 ) ),
+		_mm_shuffle_epi8( in1 , _mm_setr_epi8( -1,-1,-1,-1,-1,1,4,7,10,13,-1,-1,-1,-1,-1,-1 ) ) ),
+		_mm_shuffle_epi8( in2 , _mm_setr_epi8( -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,0,3,6,9,12,15 ) ) );
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToGraySsse3
+*        INPUT: linePixels - line of 24-bit pixels ( B, G, R byte order )
+*               grayLine   - line of gray pixels
+*               widthInPix - number of pixels in line
+*               grayMode   - GRAY_AVERAGE, GRAY_BT601 or GRAY_BT709
+*       OUTPUT: Number of converted pixels ( multiple of 16 )
+*  DESCRIPTION: SSSE3 gray conversion, 16 pixels per iteration
+********************************************************************************/
+
+__attribute__((target("ssse3")))
+int bmpLineToGraySsse3( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode )
+{
+	int pixel;
+	__m128i zero;
+	__m128i grayLo;
+	__m128i grayHi;
+	__m128i channels[3];
+
+	zero = _mm_setzero_si128();
+
+	for( pixel = 0 ; pixel + 16 <= widthInPix ; pixel = pixel + 16 ) {
+
+		splitPixels16( linePixels + (pixel * 3) , channels );
+
+		grayLo = grayFromChannels16( _mm_unpacklo_epi8( channels[0] , zero ),
+									 _mm_unpacklo_epi8( channels[1] , zero ),
+									 _mm_unpacklo_epi8( channels[2] , zero ), grayMode );
+		grayHi = grayFromChannels16( _mm_unpackhi_epi8( channels[0] , zero ),
+									 _mm_unpackhi_epi8( channels[1] , zero ),
+									 _mm_unpackhi_epi8( channels[2] , zero ), grayMode );
+
+		_mm_storeu_si128( (__m128i *) (grayLine + pixel) , _mm_packus_epi16( grayLo , grayHi ) );
+	}
+
+	return pixel;
+}
+
+/********************************************************************************
+*     FUNCTION: grayFromChannels32
+*        INPUT: blue, green, red - 16-bit channel values
+*               grayMode         - GRAY_AVERAGE, GRAY_BT601 or GRAY_BT709
+*       OUTPUT: 16-bit gray values
+*  DESCRIPTION: AVX2 version of grayFromChannels16
+********************************************************************************/
+
+__attribute__((target("avx2")))
+static inline __m256i grayFromChannels32( __m256i blue , __m256i green , __m256i red , int grayMode )
+{
+	switch( grayMode ) {
+		case GRAY_BT601:
+			return _mm256_srli_epi16( _mm256_add_epi16( _mm256_add_epi16( 
+					_mm256_mullo_epi16( blue , _mm256_set1_epi16( BT601_B ) ),
+					_mm256_mullo_epi16( green , _mm256_set1_epi16( BT601_G ) ) ),
+					_mm256_add_epi16( _mm256_mullo_epi16( red , _mm256_set1_epi16( BT601_R ) ), 
+					_mm256_set1_epi16( 128 ) ) ) , 8 );
+
+		case GRAY_BT709:
+			return _mm256_srli_epi16( _mm256_add_epi16( _mm256_add_epi16( 
+					_mm256_mullo_epi16( blue , _mm256_set1_epi16( BT709_B ) ),
+					_mm256_mullo_epi16( green , _mm256_set1_epi16( BT709_G ) ) ),
+					_mm256_add_epi16( _mm256_mullo_epi16( red , _mm256_set1_epi16( BT709_R ) ), 
+					_mm256_set1_epi16( 128 ) ) ) , 8 );
+
+		default:
+			return _mm256_mulhi_epu16( _mm256_add_epi16( _mm256_add_epi16( blue , green ) , red ) , 
+					_mm256_set1_epi16( GRAY_DIV3_MUL ) );
+	}
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToGrayAvx2
+*        INPUT: linePixels - line of 24-bit pixels ( B, G, R byte order )
+*               grayLine   - line of gray pixels
+*               widthInPix - number of pixels in line
+*               grayMode   - GRAY_AVERAGE, GRAY_BT601 or GRAY_BT709
+*       OUTPUT: Number of converted pixels ( multiple of 32 )
+*  DESCRIPTION: AVX2 gray conversion, 32 pixels per iteration. Channels are 
+*               split in 128-bit halves ( pshufb does not cross lanes ), 
+*               arithmetic is done on 16 pixels per register.
+********************************************************************************/
+
+__attribute__((target("avx2")))
+int bmpLineToGrayAvx2( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode )
+{
+	int pixel;
+	__m256i grayLo;
+	__m256i grayHi;
+	__m128i channelsLo[3];
+	__m128i channelsHi[3];
+
+	for( pixel = 0 ; pixel + 32 <= widthInPix ; pixel = pixel + 32 ) {
+
+		splitPixels16( linePixels + (pixel * 3) , channelsLo );
+		splitPixels16( linePixels + (pixel * 3) + 48 , channelsHi );
+
+		grayLo = grayFromChannels32( _mm256_cvtepu8_epi16( channelsLo[0] ),
+									 _mm256_cvtepu8_epi16( channelsLo[1] ),
+									 _mm256_cvtepu8_epi16( channelsLo[2] ), grayMode );
+		grayHi = grayFromChannels32( _mm256_cvtepu8_epi16( channelsHi[0] ),
+									 _mm256_cvtepu8_epi16( channelsHi[1] ),
+									 _mm256_cvtepu8_epi16( channelsHi[2] ), grayMode );
+
+		/* Pack works inside 128-bit lanes, permute restores pixel order */
+		_mm256_storeu_si256( (__m256i *) (grayLine + pixel) , 
+			_mm256_permute4x64_epi64( _mm256_packus_epi16( grayLo , grayHi ) , 0xD8 ) );
+	}
+
+	return pixel;
+}
+
+#endif /* GRAY_SIMD_X86 */
+
+/********************************************************************************
+*     FUNCTION: grayTableIndex
+*        INPUT: grayMode - GRAY_AVERAGE, GRAY_BT601 or GRAY_BT709
+*       OUTPUT: Index of imageData_s.paletteGray table
+*  DESCRIPTION: /
+********************************************************************************/
+
+static inline int grayTableIndex( int grayMode )
+{
+	switch( grayMode ) {
+		case GRAY_BT601:
+			return 1;
+		case GRAY_BT709:
+			return 2;
+		default:
+			return 0;
+	}
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToGray24
+*        INPUT: linePixels - stored line of image
+*               grayLine   - line of gray pixels
+*               widthInPix - number of pixels in line
+*               grayMode   - GRAY_AVERAGE, GRAY_BT601 or GRAY_BT709
+*               imageData  - image data structure
+*       OUTPUT: /
+*  DESCRIPTION: Gray kernel of 24-bit image ( B, G, R bytes )
+********************************************************************************/
+
+void bmpLineToGray24( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode , imageData_s *imageData )
+{
+	bmpLineToGray( linePixels , grayLine , widthInPix , grayMode );
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToGrayDirect
+*        INPUT: linePixels - stored line of image
+*               grayLine   - line of gray pixels
+*               widthInPix - number of pixels in line
+*               grayMode   - GRAY_AVERAGE, GRAY_BT601 or GRAY_BT709
+*               imageData  - image data structure
+*       OUTPUT: /
+*  DESCRIPTION: Gray kernel of 16 and 32-bit images. Pixels are expanded to 
+*               B, G, R bytes in small parts ( lineToBgr kernel of format ),
+*               which stay in cache and are converted by bmpLineToGray.
+********************************************************************************/
+
+void bmpLineToGrayDirect( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode , imageData_s *imageData )
+{
+	int pixel;
+	int partLen;
+	int bytesPerPixel;
+	unsigned char bgrPart[256 * 3];
+
+	bytesPerPixel = imageData->bitDepth / 8;
+
+	for( pixel = 0 ; pixel < widthInPix ; pixel = pixel + partLen ) {
+		partLen = widthInPix - pixel;
+		if( partLen > 256 ) {
+			partLen = 256;
+		}
+		imageData->bmpFormat->lineToBgr( linePixels + (size_t) pixel * bytesPerPixel , bgrPart , partLen , imageData );
+		bmpLineToGray( bgrPart , grayLine + pixel , partLen , grayMode );
+	}
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToGrayPal8
+*        INPUT: linePixels - stored line of image
+*               grayLine   - line of gray pixels
+*               widthInPix - number of pixels in line
+*               grayMode   - GRAY_AVERAGE, GRAY_BT601 or GRAY_BT709
+*               imageData  - image data structure
+*       OUTPUT: /
+*  DESCRIPTION: Gray kernel of 8-bit palette image ( and decoded RLE image ),
+*               gray of each palette index is computed in parseBmpHeader
+********************************************************************************/
+
+void bmpLineToGrayPal8( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode , imageData_s *imageData )
+{
+	int pixel;
+	unsigned char *grayTable;
+
+	grayTable = imageData->paletteGray[ grayTableIndex( grayMode ) ];
+
+	for( pixel = 0 ; pixel < widthInPix ; pixel++ ) {
+		grayLine[pixel] = grayTable[ linePixels[pixel] ];
+	}
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToGrayPal4
+*        INPUT: linePixels - stored line of image
+*               grayLine   - line of gray pixels
+*               widthInPix - number of pixels in line
+*               grayMode   - GRAY_AVERAGE, GRAY_BT601 or GRAY_BT709
+*               imageData  - image data structure
+*       OUTPUT: /
+*  DESCRIPTION: Gray kernel of 4-bit palette image, high nibble is first pixel
+********************************************************************************/
+
+void bmpLineToGrayPal4( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode , imageData_s *imageData )
+{
+	int pixel;
+	unsigned char *grayTable;
+
+	grayTable = imageData->paletteGray[ grayTableIndex( grayMode ) ];
+
+	for( pixel = 0 ; pixel < widthInPix ; pixel++ ) {
+		grayLine[pixel] = grayTable[ (linePixels[pixel >> 1] >> ((pixel & 1) ? 0 : 4)) & 0x0F ];
+	}
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToGrayPal1
+*        INPUT: linePixels - stored line of image
+*               grayLine   - line of gray pixels
+*               widthInPix - number of pixels in line
+*               grayMode   - GRAY_AVERAGE, GRAY_BT601 or GRAY_BT709
+*               imageData  - image data structure
+*       OUTPUT: /
+*  DESCRIPTION: Gray kernel of 1-bit palette image, highest bit is first pixel
+********************************************************************************/
+
+void bmpLineToGrayPal1( unsigned char *linePixels , unsigned char *grayLine , int widthInPix , int grayMode , imageData_s *imageData )
+{
+	int pixel;
+	unsigned char *grayTable;
+
+	grayTable = imageData->paletteGray[ grayTableIndex( grayMode ) ];
+
+	for( pixel = 0 ; pixel < widthInPix ; pixel++ ) {
+		grayLine[pixel] = grayTable[ (linePixels[pixel >> 3] >> (7 - (pixel & 7))) & 0x01 ];
+	}
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToBgr32
+*        INPUT: linePixels - stored line of image
+*               bgrLine    - line of B, G, R bytes
+*               widthInPix - number of pixels in line
+*               imageData  - image data structure
+*       OUTPUT: /
+*  DESCRIPTION: B, G, R kernel of 32-bit image ( B, G, R, A bytes )
+********************************************************************************/
+
+void bmpLineToBgr32( unsigned char *linePixels , unsigned char *bgrLine , int widthInPix , imageData_s *imageData )
+{
+	int pixel;
+
+	for( pixel = 0 ; pixel < widthInPix ; pixel++ , linePixels = linePixels + 4 , bgrLine = bgrLine + 3 ) {
+		bgrLine[0] = linePixels[0];
+		bgrLine[1] = linePixels[1];
+		bgrLine[2] = linePixels[2];
+	}
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToBgr565
+*        INPUT: linePixels - stored line of image
+*               bgrLine    - line of B, G, R bytes
+*               widthInPix - number of pixels in line
+*               imageData  - image data structure
+*       OUTPUT: /
+*  DESCRIPTION: B, G, R kernel of 16-bit 5-6-5 image. Channels are expanded 
+*               to 8 bits by repeating their highest bits.
+********************************************************************************/
+
+void bmpLineToBgr565( unsigned char *linePixels , unsigned char *bgrLine , int widthInPix , imageData_s *imageData )
+{
+	int pixel;
+	unsigned int pixValue;
+
+	for( pixel = 0 ; pixel < widthInPix ; pixel++ , linePixels = linePixels + 2 , bgrLine = bgrLine + 3 ) {
+		pixValue = linePixels[0] | (linePixels[1] << 8);
+		bgrLine[0] = ((pixValue & 0x1F) << 3) | ((pixValue & 0x1F) >> 2);
+		bgrLine[1] = (((pixValue >> 5) & 0x3F) << 2) | (((pixValue >> 5) & 0x3F) >> 4);
+		bgrLine[2] = ((pixValue >> 11) << 3) | ((pixValue >> 11) >> 2);
+	}
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToBgr555
+*        INPUT: linePixels - stored line of image
+*               bgrLine    - line of B, G, R bytes
+*               widthInPix - number of pixels in line
+*               imageData  - image data structure
+*       OUTPUT: /
+*  DESCRIPTION: B, G, R kernel of 16-bit 5-5-5 image ( default 16-bit format )
+********************************************************************************/
+
+void bmpLineToBgr555( unsigned char *linePixels , unsigned char *bgrLine , int widthInPix , imageData_s *imageData )
+{
+	int pixel;
+	unsigned int pixValue;
+
+	for( pixel = 0 ; pixel < widthInPix ; pixel++ , linePixels = linePixels + 2 , bgrLine = bgrLine + 3 ) {
+		pixValue = linePixels[0] | (linePixels[1] << 8);
+		bgrLine[0] = ((pixValue & 0x1F) << 3) | ((pixValue & 0x1F) >> 2);
+		bgrLine[1] = (((pixValue >> 5) & 0x1F) << 3) | (((pixValue >> 5) & 0x1F) >> 2);
+		bgrLine[2] = (((pixValue >> 10) & 0x1F) << 3) | (((pixValue >> 10) & 0x1F) >> 2);
+	}
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToBgrPal8
+*        INPUT: linePixels - stored line of image
+*               bgrLine    - line of B, G, R bytes
+*               widthInPix - number of pixels in line
+*               imageData  - image data structure
+*       OUTPUT: /
+*  DESCRIPTION: B, G, R kernel of 8-bit palette image ( and decoded RLE image )
+********************************************************************************/
+
+void bmpLineToBgrPal8( unsigned char *linePixels , unsigned char *bgrLine , int widthInPix , imageData_s *imageData )
+{
+	int pixel;
+
+	for( pixel = 0 ; pixel < widthInPix ; pixel++ , bgrLine = bgrLine + 3 ) {
+		memcpy( bgrLine , imageData->palette[ linePixels[pixel] ] , 3 );
+	}
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToBgrPal4
+*        INPUT: linePixels - stored line of image
+*               bgrLine    - line of B, G, R bytes
+*               widthInPix - number of pixels in line
+*               imageData  - image data structure
+*       OUTPUT: /
+*  DESCRIPTION: B, G, R kernel of 4-bit palette image
+********************************************************************************/
+
+void bmpLineToBgrPal4( unsigned char *linePixels , unsigned char *bgrLine , int widthInPix , imageData_s *imageData )
+{
+	int pixel;
+
+	for( pixel = 0 ; pixel < widthInPix ; pixel++ , bgrLine = bgrLine + 3 ) {
+		memcpy( bgrLine , imageData->palette[ (linePixels[pixel >> 1] >> ((pixel & 1) ? 0 : 4)) & 0x0F ] , 3 );
+	}
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpLineToBgrPal1
+*        INPUT: linePixels - stored line of image
+*               bgrLine    - line of B, G, R bytes
+*               widthInPix - number of pixels in line
+*               imageData  - image data structure
+*       OUTPUT: /
+*  DESCRIPTION: B, G, R kernel of 1-bit palette image
+********************************************************************************/
+
+void bmpLineToBgrPal1( unsigned char *linePixels , unsigned char *bgrLine , int widthInPix , imageData_s *imageData )
+{
+	int pixel;
+
+	for( pixel = 0 ; pixel < widthInPix ; pixel++ , bgrLine = bgrLine + 3 ) {
+		memcpy( bgrLine , imageData->palette[ (linePixels[pixel >> 3] >> (7 - (pixel & 7))) & 0x01 ] , 3 );
+	}
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: colorAddLine
+*        INPUT: lineBytes  - line of 24-bit pixels ( B, G, R byte order )
+*               columnSums - 16-bit sum of each byte column
+*               numOfBytes - number of bytes added
+*       OUTPUT: /
+*  DESCRIPTION: This function adds each byte of line to its column sum. 
+*               Channels stay interleaved, so bytes are added without 
+*               splitting pixels. 16 bits hold sum of 257 lines, symbol is 
+*               at most 36 lines high. AVX2 or SSE2 kernel is used when CPU 
+*               supports it, bytes left at the end are added by scalar code.
+********************************************************************************/
+
+void colorAddLine( unsigned char *lineBytes , uint16_t *columnSums , int numOfBytes )
+{
+	int done;
+
+	done = 0;
+
+#ifdef GRAY_SIMD_X86
+	if( __builtin_cpu_supports("avx2") ) {
+		done = colorAddLineAvx2( lineBytes , columnSums , numOfBytes );
+	} else if( __builtin_cpu_supports("sse2") ) {
+		done = colorAddLineSse2( lineBytes , columnSums , numOfBytes );
+	}
+#endif
+
+	colorAddLineScalar( lineBytes + done , columnSums + done , numOfBytes - done );
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: colorAddLineScalar
+*        INPUT: lineBytes  - line of 24-bit pixels ( B, G, R byte order )
+*               columnSums - 16-bit sum of each byte column
+*               numOfBytes - number of bytes added
+*       OUTPUT: /
+*  DESCRIPTION: Scalar column sums, one byte at a time
+********************************************************************************/
+
+void colorAddLineScalar( unsigned char *lineBytes , uint16_t *columnSums , int numOfBytes )
+{
+	int i;
+
+	for( i = 0 ; i < numOfBytes ; i++ ) {
+		columnSums[i] = columnSums[i] + lineBytes[i];
+	}
+
+	return;
+}
+
+#ifdef GRAY_SIMD_X86
+
+/********************************************************************************
+*     FUNCTION: colorAddLineSse2
+*        INPUT: lineBytes  - line of 24-bit pixels ( B, G, R byte order )
+*               columnSums - 16-bit sum of each byte column
+*               numOfBytes - number of bytes added
+*       OUTPUT: Number of added bytes ( multiple of 16 )
+*  DESCRIPTION: SSE2 column sums, 16 bytes per iteration
+********************************************************************************/
+
+__attribute__((target("sse2")))
+int colorAddLineSse2( unsigned char *lineBytes , uint16_t *columnSums , int numOfBytes )
+{
+	int i;
+	__m128i zero;
+	__m128i inBytes;
+
+	zero = _mm_setzero_si128();
+
+	for( i = 0 ; i + 16 <= numOfBytes ; i = i + 16 ) {
+
+		inBytes = _mm_loadu_si128( (__m128i *) (lineBytes + i) );
+
+		_mm_storeu_si128( (__m128i *) (columnSums + i) , _mm_add_epi16( 
+			_mm_loadu_si128( (__m128i *) (columnSums + i) ) , _mm_unpacklo_epi8( inBytes , zero ) ) );
+		_mm_storeu_si128( (__m128i *) (columnSums + i + 8) , _mm_add_epi16( 
+			_mm_loadu_si128( (__m128i *) (columnSums + i + 8) ) , _mm_unpackhi_epi8( inBytes , zero ) ) );
+	}
+
+	return i;
+}
+
+/********************************************************************************
+*     FUNCTION: colorAddLineAvx2
+*        INPUT: lineBytes  - line of 24-bit pixels ( B, G, R byte order )
+*               columnSums - 16-bit sum of each byte column
+*               numOfBytes - number of bytes added
+*       OUTPUT: Number of added bytes ( multiple of 32 )
+*  DESCRIPTION: AVX2 column sums, 32 bytes per iteration
+********************************************************************************/
+
+__attribute__((target("avx2")))
+int colorAddLineAvx2( unsigned char *lineBytes , uint16_t *columnSums , int numOfBytes )
+{
+	int i;
+
+	for( i = 0 ; i + 32 <= numOfBytes ; i = i + 32 ) {
+
+		_mm256_storeu_si256( (__m256i *) (columnSums + i) , _mm256_add_epi16( 
+			_mm256_loadu_si256( (__m256i *) (columnSums + i) ) , 
+			_mm256_cvtepu8_epi16( _mm_loadu_si128( (__m128i *) (lineBytes + i) ) ) ) );
+		_mm256_storeu_si256( (__m256i *) (columnSums + i + 16) , _mm256_add_epi16( 
+			_mm256_loadu_si256( (__m256i *) (columnSums + i + 16) ) , 
+			_mm256_cvtepu8_epi16( _mm_loadu_si128( (__m128i *) (lineBytes + i + 16) ) ) ) );
+	}
+
+	return i;
+}
+
+#endif /* GRAY_SIMD_X86 */
+
+/********************************************************************************
+*     FUNCTION: makeCellColors
+*        INPUT: cellLine  - cell line with column sums of band ( readBandCells )
+*               userInput - user input data strucure
+*       OUTPUT: /
+*  DESCRIPTION: This function averages color of each symbol from column sums.
+*               Color is stored as 0xRRGGBB ( COLOR_TRUE ) or as palette index
+*               of nearest cube color ( COLOR_256 , one lookup per channel ).
+********************************************************************************/
+
+void makeCellColors( cellLine_s *cellLine , userInput_s *userInput )
+{
+	int pix;
+	int symIndex;
+	int symArea;
+	uint32_t blueSum;
+	uint32_t greenSum;
+	uint32_t redSum;
+	uint16_t *columnPtr;
+
+	symArea = cellLine->symbolWidth * cellLine->symbolHeight;
+	columnPtr = cellLine->colorColumns;
+
+	for( symIndex = 0 ; symIndex < cellLine->numOfCells ; symIndex++ ) {
+
+		blueSum = 0;
+		greenSum = 0;
+		redSum = 0;
+		for( pix = 0 ; pix < cellLine->symbolWidth ; pix++ , columnPtr = columnPtr + 3 ) {
+			blueSum = blueSum + columnPtr[0];
+			greenSum = greenSum + columnPtr[1];
+			redSum = redSum + columnPtr[2];
+		}
+
+		blueSum = blueSum / symArea;
+		greenSum = greenSum / symArea;
+		redSum = redSum / symArea;
+
+		if( userInput->colorMode == COLOR_256 ) {
+			cellLine->cellColors[symIndex] = COLOR_CUBE_START + 36 * userInput->colorLevels[redSum] + 
+							6 * userInput->colorLevels[greenSum] + userInput->colorLevels[blueSum];
+		} else {
+			cellLine->cellColors[symIndex] = (redSum << 16) | (greenSum << 8) | blueSum;
+		}
+	}
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: storeBmpImageData
+*        INPUT: imageFile - opened image file
+*               imagePath - image location on filesystem
+*               imageData - structure for retrived data
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function retrives data from image header and stores data
+*               in imageData_s
+********************************************************************************/
+
+int storeBmpImageData( imageFile_s *imageFile , char *imagePath , imageData_s *imageData )
+{
+	int retVal;
+
+	/* Check image name */
+	if(	strlen( imagePath ) > IMAGE_NAME_LEN ) {
+		printf("Image path to long to store!\n");
+		return ERROR;
+	}
+
+	retVal = parseBmpHeader( imageFile , imageData );
+	if( retVal == ASCII_ERROR_FORMAT ) {
+		printf("File %s is not .bmp file!\n", imagePath );
+		return ERROR;
+	}
+	if( retVal < 0 ) {
+		printf("File %s is not supported or damaged!\n", imagePath );
+		return ERROR;
+	}
+
+	/* Store image name in structure */	
+	memset( imageData->imgName , 0 , IMAGE_NAME_LEN+1 );
+	strncpy( imageData->imgName , imagePath , IMAGE_NAME_LEN );
+
+	return OK;
+
+}
+
+/********************************************************************************
+*     FUNCTION: parseBmpHeader
+*        INPUT: imageFile - opened image file ( or image in memory )
+*               imageData - structure for retrived data
+*       OUTPUT: ASCII_OK, ASCII_ERROR_FORMAT or ASCII_ERROR_DAMAGED
+*  DESCRIPTION: This function retrives data from image header ( info header,
+*               V4 or V5 header ), selects decode kernels of pixel format, 
+*               reads palette and checks that pixel array is inside of file.
+*               Nothing is printed ( library ).
+********************************************************************************/
+
+int parseBmpHeader( imageFile_s *imageFile , imageData_s *imageData )
+{
+	int64_t infoSize;
+	uint32_t colorMasks[3];
+	unsigned char headerBuffer[BMP_HEADER_SIZE];
+	unsigned char masksBuffer[12];
+	unsigned char *imageHeader;
+	unsigned char *masksData;
+
+	/* Read image header - mapped file is parsed in place */	
+	imageHeader = imageFileRead( imageFile , 0 , BMP_HEADER_SIZE , headerBuffer );
+	if( imageHeader == NULL ) {
+		return ASCII_ERROR_DAMAGED;
+	}
+	
+	/* Check image format */
+	if( !isBmpFormat(imageHeader) ) {
+		return ASCII_ERROR_FORMAT;
+	}
+
+	imageData->imgName[0] = '\0';
+	imageData->outCols = 0;
+	imageData->outRows = 0;
+	imageData->levelScale = 1;
+	imageData->imgWidth = bmpGetWidth(imageHeader);
+	imageData->imgHeight = bmpGetHeight(imageHeader);
+	imageData->imgRawSize = bmpGetRawSize(imageHeader);
+	imageData->pixelOffset = bmpGetOffset(imageHeader);
+	imageData->imgFileSize = bmpGetFileSize(imageHeader);
+	imageData->bitDepth = bmpGetBitDepth(imageHeader);
+	imageData->compression = bmpGetCompression(imageHeader);
+	imageData->numOfColors = byteToInt( imageHeader , BMP_H_NUM_COLORS , 4 );
+
+	infoSize = byteToInt( imageHeader , BMP_H_INFO_SIZE , 4 );
+	if( (infoSize < BMP_INFO_HEADER_MIN) || (infoSize > BMP_INFO_HEADER_MAX) || 
+		(BMP_FILE_HEADER_SIZE + infoSize > imageFile->fileSize) || (imageData->imgWidth <= 0) || (imageData->imgHeight == 0) ||
+		(imageData->imgHeight == INT32_MIN) ) {
+		return ASCII_ERROR_DAMAGED;
+	}
+
+	/* Negative height - first line of image is first in file */
+	imageData->topDown = 0;
+	if( imageData->imgHeight < 0 ) {
+		imageData->imgHeight = -imageData->imgHeight;
+		imageData->topDown = 1;
+	}
+
+	/* Masks follow info header ( or are part of V4 and V5 header ) */
+	memset( colorMasks , 0 , sizeof(colorMasks) );
+	if( imageData->compression == BMP_BITFIELDS ) {
+		masksData = imageFileRead( imageFile , BMP_H_MASKS , 12 , masksBuffer );
+		if( masksData == NULL ) {
+			return ASCII_ERROR_DAMAGED;
+		}
+		colorMasks[0] = byteToInt( masksData , 0 , 4 );
+		colorMasks[1] = byteToInt( masksData , 4 , 4 );
+		colorMasks[2] = byteToInt( masksData , 8 , 4 );
+	}
+
+	imageData->bmpFormat = bmpFindFormat( imageData->bitDepth , imageData->compression , colorMasks );
+	if( (imageData->bmpFormat == NULL) || 
+		(imageData->topDown && (imageData->compression != BMP_RGB) && (imageData->compression != BMP_BITFIELDS)) ) {
+		return ASCII_ERROR_DAMAGED;
+	}
+
+	/* Palette follows info header */
+	if( imageData->bitDepth <= 8 ) {
+		if( bmpReadPalette( imageFile , imageData , BMP_FILE_HEADER_SIZE + infoSize , imageData->numOfColors ) < 0 ) {
+			return ASCII_ERROR_DAMAGED;
+		}
+	}
+
+	/* Bits of one line must fit to int */
+	if( (int64_t) imageData->imgWidth * imageData->bitDepth > INT32_MAX - 31 ) {
+		return ASCII_ERROR_DAMAGED;
+	}
+
+	/* Stored line - RLE image is decoded to one byte per pixel */
+	if( (imageData->compression == BMP_RLE8) || (imageData->compression == BMP_RLE4) ) {
+		imageData->paddedBytes = 0;
+		imageData->imgWidthInBytes = imageData->imgWidth;
+	} else {
+		imageData->paddedBytes = bmpGetPaddedBytes( imageData->imgWidth , imageData->bitDepth );
+		imageData->imgWidthInBytes = bmpGetWidthInBytes( imageData->imgWidth , imageData->bitDepth );
+	}
+
+	if( imageData->pixelOffset < BMP_FILE_HEADER_SIZE + infoSize ) {
+		return ASCII_ERROR_DAMAGED;
+	}
+
+	/* Pixel array must be inside of file ( RLE data is checked while decoding ) */
+	if( (imageData->compression == BMP_RLE8) || (imageData->compression == BMP_RLE4) ) {
+		if( imageData->pixelOffset >= imageFile->fileSize ) {
+			return ASCII_ERROR_DAMAGED;
+		}
+	} else if( imageData->pixelOffset + (int64_t) imageData->imgHeight * imageData->imgWidthInBytes > imageFile->fileSize ) {
+		return ASCII_ERROR_DAMAGED;
+	}
+
+	return ASCII_OK;
+
+}
+
+/* Supported pixel formats - RLE images are decoded to 8-bit lines first */
+static const bmpFormat_s bmpFormats[] = {
+	{ 24 , BMP_RGB , 		{ 0 , 0 , 0 } , 								bmpLineToGray24 , 		NULL },
+	{ 32 , BMP_RGB , 		{ 0 , 0 , 0 } , 								bmpLineToGrayDirect , 	bmpLineToBgr32 },
+	{ 32 , BMP_BITFIELDS , 	{ 0x00FF0000 , 0x0000FF00 , 0x000000FF } , 	bmpLineToGrayDirect , 	bmpLineToBgr32 },
+	{ 16 , BMP_RGB , 		{ 0 , 0 , 0 } , 								bmpLineToGrayDirect , 	bmpLineToBgr555 },
+	{ 16 , BMP_BITFIELDS , 	{ 0x7C00 , 0x03E0 , 0x001F } , 				bmpLineToGrayDirect , 	bmpLineToBgr555 },
+	{ 16 , BMP_BITFIELDS , 	{ 0xF800 , 0x07E0 , 0x001F } , 				bmpLineToGrayDirect , 	bmpLineToBgr565 },
+	{ 8 , BMP_RGB , 		{ 0 , 0 , 0 } , 								bmpLineToGrayPal8 , 	bmpLineToBgrPal8 },
+	{ 8 , BMP_RLE8 , 		{ 0 , 0 , 0 } , 								bmpLineToGrayPal8 , 	bmpLineToBgrPal8 },
+	{ 4 , BMP_RLE4 , 		{ 0 , 0 , 0 } , 								bmpLineToGrayPal8 , 	bmpLineToBgrPal8 },
+	{ 4 , BMP_RGB , 		{ 0 , 0 , 0 } , 								bmpLineToGrayPal4 , 	bmpLineToBgrPal4 },
+	{ 1 , BMP_RGB , 		{ 0 , 0 , 0 } , 								bmpLineToGrayPal1 , 	bmpLineToBgrPal1 }
+};
+
+/********************************************************************************
+*     FUNCTION: bmpFindFormat
+*        INPUT: bitDepth    - bits per pixel
+*               compression - compression of pixel array
+*               colorMasks  - red, green, blue masks ( BMP_BITFIELDS )
+*       OUTPUT: Pixel format or NULL ( not supported )
+*  DESCRIPTION: /
+********************************************************************************/
+
+const bmpFormat_s * bmpFindFormat( int bitDepth , int compression , uint32_t *colorMasks )
+{
+	int i;
+
+	for( i = 0 ; i < (int) (sizeof(bmpFormats) / sizeof(bmpFormats[0])) ; i++ ) {
+		if( (bmpFormats[i].bitDepth == bitDepth) && (bmpFormats[i].compression == compression) &&
+			((compression != BMP_BITFIELDS) || (memcmp( bmpFormats[i].colorMasks , colorMasks , sizeof(bmpFormats[i].colorMasks) ) == 0)) ) {
+			return &bmpFormats[i];
+		}
+	}
+
+	return NULL;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpReadPalette
+*        INPUT: imageFile     - opened image file
+*               imageData     - image data structure
+*               paletteOffset - offset of palette in file
+*               numOfColors   - entries in header ( 0 for all )
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function reads palette ( B, G, R, 0 entries ) and 
+*               computes gray of each palette index for each gray mode, so 
+*               palette images are converted with one lookup per pixel. 
+*               Missing entries are black.
+********************************************************************************/
+
+int bmpReadPalette( imageFile_s *imageFile , imageData_s *imageData , int64_t paletteOffset , int numOfColors )
+{
+	int i;
+	unsigned char paletteBuffer[BMP_MAX_COLORS * 4];
+	unsigned char *paletteData;
+
+	if( (numOfColors <= 0) || (numOfColors > (1 << imageData->bitDepth)) ) {
+		numOfColors = 1 << imageData->bitDepth;
+	}
+	imageData->numOfColors = numOfColors;
+
+	paletteData = imageFileRead( imageFile , paletteOffset , numOfColors * 4 , paletteBuffer );
+	if( paletteData == NULL ) {
+		return ERROR;
+	}
+
+	memset( imageData->palette , 0 , sizeof(imageData->palette) );
+	for( i = 0 ; i < numOfColors ; i++ ) {
+		memcpy( imageData->palette[i] , paletteData + (i * 4) , 3 );
+	}
+
+	/* Same formulas as 24-bit images */
+	bmpLineToGrayScalar( imageData->palette[0] , imageData->paletteGray[0] , BMP_MAX_COLORS , GRAY_AVERAGE );
+	bmpLineToGrayScalar( imageData->palette[0] , imageData->paletteGray[1] , BMP_MAX_COLORS , GRAY_BT601 );
+	bmpLineToGrayScalar( imageData->palette[0] , imageData->paletteGray[2] , BMP_MAX_COLORS , GRAY_BT709 );
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpDecodeRle
+*        INPUT: imageFile - opened image file
+*               imageData - image data structure
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function decodes RLE8 or RLE4 pixel array to 
+*               imageFile->pixelData, one byte ( palette index ) per pixel, 
+*               lines in file order. Compressed lines have no fixed size, so 
+*               bands cannot be read from file directly. Pixels skipped by
+*               delta codes are index 0. Runs outside of image are ignored.
+*               Image can be at most 256 times larger than compressed data.
+********************************************************************************/
+
+int bmpDecodeRle( imageFile_s *imageFile , imageData_s *imageData )
+{
+	int i;
+	int xAxe;
+	int yAxe;
+	int runLen;
+	int runValue;
+	int64_t dataPos;
+	int64_t dataSize;
+	size_t pixelSize;
+
+	unsigned char *dataBuffer;
+	unsigned char *rleData;
+	unsigned char *pixelData;
+
+	dataSize = imageFile->fileSize - imageData->pixelOffset;
+	if( (imageData->imgRawSize > 0) && (imageData->imgRawSize < dataSize) ) {
+		dataSize = imageData->imgRawSize;
+	}
+
+	pixelSize = sizeMultiply( imageData->imgWidth , imageData->imgHeight );
+	if( (pixelSize == SIZE_MAX) || ((uint64_t) pixelSize / 256 > (uint64_t) dataSize) || ((uint64_t) dataSize > SIZE_MAX) ) {
+		return ERROR;
+	}
+
+	/* Compressed data - mapped file is read in place */
+	dataBuffer = NULL;
+	if( imageFile->fileData == NULL ) {
+		dataBuffer = malloc( dataSize );
+		if( dataBuffer == NULL ) {
+			return ERROR;
+		}
+	}
+
+	rleData = imageFileRead( imageFile , imageData->pixelOffset , dataSize , dataBuffer );
+	pixelData = calloc( pixelSize , 1 );
+	if( (rleData == NULL) || (pixelData == NULL) ) {
+		free( dataBuffer );
+		free( pixelData );
+		return ERROR;
+	}
+
+	xAxe = 0;
+	yAxe = 0;
+	dataPos = 0;
+
+	while( (dataPos + 1 < dataSize) && (yAxe < imageData->imgHeight) ) {
+
+		runLen = rleData[dataPos];
+		runValue = rleData[dataPos + 1];
+		dataPos = dataPos + 2;
+
+		/* Encoded run - RLE4 alternates two indexes */
+		if( runLen > 0 ) {
+			for( i = 0 ; (i < runLen) && (xAxe < imageData->imgWidth) ; i++ , xAxe++ ) {
+				if( imageData->compression == BMP_RLE8 ) {
+					pixelData[ (size_t) yAxe * imageData->imgWidth + xAxe ] = runValue;
+				} else {
+					pixelData[ (size_t) yAxe * imageData->imgWidth + xAxe ] = (i & 1) ? (runValue & 0x0F) : (runValue >> 4);
+				}
+			}
+			continue;
+		}
+
+		switch( runValue ) {
+			case 0:							/* End of line */
+				xAxe = 0;
+				yAxe++;
+				break;
+
+			case 1:							/* End of image */
+				yAxe = imageData->imgHeight;
+				break;
+
+			case 2:							/* Delta - move right and up */
+				if( dataPos + 1 >= dataSize ) {
+					yAxe = imageData->imgHeight;
+					break;
+				}
+				xAxe = xAxe + rleData[dataPos];
+				yAxe = yAxe + rleData[dataPos + 1];
+				dataPos = dataPos + 2;
+
+				/* Many deltas must not wrap position ( pixels past line are dropped ) */
+				if( xAxe > imageData->imgWidth ) {
+					xAxe = imageData->imgWidth;
+				}
+				if( yAxe > imageData->imgHeight ) {
+					yAxe = imageData->imgHeight;
+				}
+				break;
+
+			default:						/* Absolute run of runValue indexes, padded to 2 bytes */
+				runLen = (imageData->compression == BMP_RLE8) ? runValue : (runValue + 1) / 2;
+				if( dataPos + runLen > dataSize ) {
+					yAxe = imageData->imgHeight;
+					break;
+				}
+				for( i = 0 ; (i < runValue) && (xAxe < imageData->imgWidth) ; i++ , xAxe++ ) {
+					if( imageData->compression == BMP_RLE8 ) {
+						pixelData[ (size_t) yAxe * imageData->imgWidth + xAxe ] = rleData[dataPos + i];
+					} else {
+						pixelData[ (size_t) yAxe * imageData->imgWidth + xAxe ] = 
+							(i & 1) ? (rleData[dataPos + i / 2] & 0x0F) : (rleData[dataPos + i / 2] >> 4);
+					}
+				}
+				dataPos = dataPos + runLen + (runLen & 1);
+		}
+	}
+
+	free( dataBuffer );
+
+	imageFile->pixelData = pixelData;
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: bmpReadLines
+*        INPUT: imageFile  - opened image file
+*               imageData  - image data structure
+*               firstLine  - first image line ( top to bottom )
+*               numOfLines - number of lines
+*               readBuffer - buffer for numOfLines stored lines ( not used if 
+*                            file is mapped or RLE image is decoded )
+*       OUTPUT: NULL or pointer to lines as stored in file
+*  DESCRIPTION: Lines are one continuous block in file. Bottom-up image 
+*               ( usual ) stores last line of block first, top-down image 
+*               stores lines in forward order.
+********************************************************************************/
+
+unsigned char * bmpReadLines( imageFile_s *imageFile , imageData_s *imageData , int firstLine , int numOfLines , 
+								unsigned char *readBuffer )
+{
+	int64_t storedLine;
+
+	/* INFO: bmp format usually stores first pixel line on the end of file */
+	storedLine = firstLine;
+	if( !imageData->topDown ) {
+		storedLine = (int64_t) imageData->imgHeight - firstLine - numOfLines;
+	}
+
+	if( imageFile->pixelData != NULL ) {
+		return imageFile->pixelData + (size_t) storedLine * imageData->imgWidthInBytes;
+	}
+
+	return imageFileRead( imageFile , imageData->pixelOffset + storedLine * imageData->imgWidthInBytes , 
+							(int64_t) numOfLines * imageData->imgWidthInBytes , readBuffer );
+}
+
+
+/********************************************************************************
+*     FUNCTION: imageFileOpen
+*        INPUT: imagePath - image location on filesystem
+*               imageFile - structure for opened file
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function maps whole image file to memory, so header and 
+*               pixel lines can be used in place. If file cannot be mapped 
+*               ( or on Windows ) it is opened for ordinary reading.
+********************************************************************************/
+
+int imageFileOpen( char *imagePath , imageFile_s *imageFile )
+{
+#ifndef WINDOWS
+	int fileDesc;
+	void *mapData;
+	struct stat fileStat;
+#endif
+
+	imageFile->fileData = NULL;
+	imageFile->fileSize = 0;
+	imageFile->filePtr = NULL;
+	imageFile->pixelData = NULL;
+
+#ifndef WINDOWS
+	fileDesc = open( imagePath , O_RDONLY );
+	if( fileDesc < 0 ) {
+		printf("Cannot open file %s!\n", imagePath );
+		return ERROR;
+	}
+
+	/* Whole file must fit to address space ( 32-bit systems ) */
+	if( (fstat( fileDesc , &fileStat ) == 0) && (fileStat.st_size > 0) && ((uint64_t) fileStat.st_size <= SIZE_MAX) ) {
+
+		mapData = mmap( NULL , fileStat.st_size , PROT_READ , MAP_PRIVATE , fileDesc , 0 );
+		if( mapData != MAP_FAILED ) {
+			/* Pixel lines are read from start to end of file */
+			madvise( mapData , fileStat.st_size , MADV_SEQUENTIAL );
+
+			imageFile->fileData = mapData;
+			imageFile->fileSize = fileStat.st_size;
+			close( fileDesc );					/* Mapping stays valid */
+			return OK;
+		}
+	}
+
+	close( fileDesc );
+#endif
+
+	/* Fallback - ordinary file reading */
+	imageFile->filePtr = fopen( imagePath , READ_BINARY_FILE );
+	if( imageFile->filePtr == NULL ) {
+		printf("Cannot open file %s!\n", imagePath );
+		return ERROR;
+	}
+
+	imageFile->fileSize = FILE_SIZE( imageFile->filePtr );
+	if( imageFile->fileSize < 0 ) {
+		printf("Cannot read file %s!\n", imagePath );
+		fclose( imageFile->filePtr );
+		imageFile->filePtr = NULL;
+		return ERROR;
+	}
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: imageFileRead
+*        INPUT: imageFile  - opened image file
+*               dataOffset - offset in file
+*               dataSize   - number of bytes
+*               readBuffer - buffer for dataSize bytes ( not used if file is 
+*                            mapped, can be NULL )
+*       OUTPUT: NULL or pointer to requested bytes
+*  DESCRIPTION: This function returns pointer to bytes of file. Mapped file is
+*               not copied, otherwise bytes are read to readBuffer.
+********************************************************************************/
+
+unsigned char * imageFileRead( imageFile_s *imageFile , int64_t dataOffset , int64_t dataSize , unsigned char *readBuffer )
+{
+	/* Requested bytes must be inside of file ( checked without overflow ) */
+	if( (dataOffset < 0) || (dataSize < 0) || (dataOffset > imageFile->fileSize) || 
+		(dataSize > imageFile->fileSize - dataOffset) || ((uint64_t) dataSize > SIZE_MAX) ) {
+		return NULL;
+	}
+
+	/* Mapped file */
+	if( imageFile->fileData != NULL ) {
+		return imageFile->fileData + dataOffset;
+	}
+
+	if( FILE_SEEK( imageFile->filePtr , dataOffset ) != 0 ) {
+		return NULL;
+	}
+
+	if( fread( readBuffer , 1 , (size_t) dataSize , imageFile->filePtr ) != (size_t) dataSize ) {
+		return NULL;
+	}
+
+	return readBuffer;
+}
+
+/********************************************************************************
+*     FUNCTION: imageFileClose
+*        INPUT: imageFile - opened image file
+*       OUTPUT: /
+*  DESCRIPTION: This function unmaps or closes image file
+********************************************************************************/
+
+void imageFileClose( imageFile_s *imageFile )
+{
+#ifndef WINDOWS
+	if( imageFile->fileData != NULL ) {
+		munmap( imageFile->fileData , imageFile->fileSize );
+	}
+#endif
+
+	if( imageFile->filePtr != NULL ) {
+		fclose( imageFile->filePtr );
+	}
+
+	free( imageFile->pixelData );
+
+	imageFile->fileData = NULL;
+	imageFile->filePtr = NULL;
+	imageFile->pixelData = NULL;
+
+	return;
+}
+
+
+/********************************************************************************
+ *     FUNCTION: bmpGetWidthInBytes
+ *        INPUT: pixelWidth - width in pixels
+ *               bitDepth   - bits per pixel
+ *       OUTPUT: Width in bytes
+ *  DESCRIPTION: This function returns width of image array in bytes. Whidth is
+ *               affected by number of pixels and zero byte padding.
+ *               In bmp standard number of bytes in one line must be multiple of 
+ *               number 4. If it is not zero bytes are added.
+ ********************************************************************************/
+
+int bmpGetWidthInBytes( int pixelWidth , int bitDepth )
+{
+	return ((pixelWidth * bitDepth + 7) / 8) + bmpGetPaddedBytes( pixelWidth , bitDepth );
+}
+
+
+/********************************************************************************
+ *     FUNCTION: bmpGetPaddedBytes
+ *        INPUT: pixelWidth - width in pixels
+ *               bitDepth   - bits per pixel
+ *       OUTPUT: Padded bytes
+ *  DESCRIPTION: This function returns number of added bytes.
+ *               In bmp standard number of bytes in one line must be multiple of 
+ *               number 4. If it is not, zero bytes are added.
+ ********************************************************************************/
+
+int bmpGetPaddedBytes( int pixelWidth , int bitDepth )
+{
+
+	int byteWidth;
+	int paddedBytes;
+
+	paddedBytes = 0;
+
+	byteWidth = (pixelWidth * bitDepth + 7) / 8;		/* Last byte can be partly used */
+	
+	switch( byteWidth % 4 ) {  
+		case 0 :				/* Nothing padded  */	
+			break;
+
+		case 1 : 
+			paddedBytes = 3;	/* 3 zero bytes padded */
+			break;
+
+		case 2 :
+			paddedBytes = 2;	/* 2 zero bytes padded */
+			break;
+
+		case 3 :
+			paddedBytes = 1;	/* 1 zero bytes padded */
+			break;
+
+		default:
+			printf("Cannot happen!\n");
+
+	}
+
+	return paddedBytes;
+
+}
+
+/********************************************************************************
+ *     FUNCTION: bmpGetFileSize
+ *        INPUT: *imgHeader - pointer to image header
+ *       OUTPUT: Acctual file size
+ *  DESCRIPTION: /
+ ********************************************************************************/
+
+int64_t bmpGetFileSize( unsigned char *imgHeader )
+{
+	return byteToInt( imgHeader , BMP_H_FILE_SIZE , 4 ); 
+}
+
+/********************************************************************************
+ *     FUNCTION: bmpGetOffset
+ *        INPUT: *imgHeader - pointer to image header
+ *       OUTPUT: Offset where the pixel array starts in bmp file 
+ *  DESCRIPTION: /
+ ********************************************************************************/
+
+int64_t bmpGetOffset( unsigned char *imgHeader )
+{
+	return byteToInt( imgHeader , BMP_H_OFFSET , 4 ); 
+}
+
+/********************************************************************************
+ *     FUNCTION: bmpGetWidth
+ *        INPUT: *imgHeader - pointer to image header
+ *       OUTPUT: Image width in pixels
+ *  DESCRIPTION: /
+ ********************************************************************************/
+
+int bmpGetWidth( unsigned char *imgHeader )
+{
+	return (int32_t) byteToInt( imgHeader , BMP_H_WIDTH , 4 ); 
+}
+
+/********************************************************************************
+ *     FUNCTION: bmpGetHeight
+ *        INPUT: *imgHeader - pointer to image header
+ *       OUTPUT: Image height in pixels
+ *  DESCRIPTION: /
+ ********************************************************************************/
+
+int bmpGetHeight( unsigned char *imgHeader )
+{
+	/* Signed - negative height is top-down image */
+	return (int32_t) byteToInt( imgHeader , BMP_H_HEIGHT , 4 ); 
+}
+
+/********************************************************************************
+ *     FUNCTION: bmpGetBitDepth
+ *        INPUT: *imgHeader - pointer to image header
+ *       OUTPUT: Bits per pixel
+ *  DESCRIPTION: /
+ ********************************************************************************/
+
+int bmpGetBitDepth( unsigned char *imgHeader )
+{
+	return byteToInt( imgHeader , BMP_H_BIT_DEPTH , 2 ); 
+}
+
+/********************************************************************************
+ *     FUNCTION: bmpGetCompression
+ *        INPUT: *imgHeader - pointer to image header
+ *       OUTPUT: Compression of pixel array ( BMP_RGB, BMP_RLE8, ... )
+ *  DESCRIPTION: /
+ ********************************************************************************/
+
+int bmpGetCompression( unsigned char *imgHeader )
+{
+	return byteToInt( imgHeader , BMP_H_COMPRESSION , 4 ); 
+}
+
+/********************************************************************************
+ *     FUNCTION: bmpGetRawSize
+ *        INPUT: *imgHeader - pointer to image header
+ *       OUTPUT: Raw size of image data (including padded bytes)
+ *  DESCRIPTION: Returns raw size of image data
+ ********************************************************************************/
+
+int64_t bmpGetRawSize( unsigned char *imgHeader )
+{
+	return byteToInt( imgHeader , BMP_H_RAW_SIZE , 4 ); 
+}
+
+/********************************************************************************
+ *     FUNCTION: byteToInt
+ *        INPUT: *dataArray  - pointer to array of bytes
+ *               dataOffset  - offset in array
+ *               numOfBytes  - number of bytes ( 1 - 4 )
+ *       OUTPUT: Unsigned integer value ( 0 - 4294967295 )
+ *  DESCRIPTION: This function reads given number of bytes starting form offset
+ *               and returns integer value writen in this bytes ( little 
+ *               endian ). Signed fields are cast by caller ( int32_t ).
+ ********************************************************************************/
+
+int64_t byteToInt( unsigned char *dataArray , int dataOffset , int numOfBytes ) 
+{
+	int i;	
+	uint32_t retVal;
+
+	retVal = 0;
+
+	if( (numOfBytes <= 0) || (numOfBytes > 4) ) return 0;
+
+	/* Get value - last byte is highest */
+	for( i = numOfBytes - 1 ; i >= 0 ; i-- ) {
+		retVal = (retVal << 8) | dataArray[ dataOffset+i ];
+	}
+
+	return retVal;
+
+}
+
+/********************************************************************************
+ *     FUNCTION: sizeMultiply
+ *        INPUT: firstSize, secondSize - sizes
+ *       OUTPUT: Product or SIZE_MAX on overflow
+ *  DESCRIPTION: Size that overflows stays SIZE_MAX in following sizeMultiply,
+ *               sizeAdd and arenaBlockSize, so its allocation fails
+ ********************************************************************************/
+
+size_t sizeMultiply( size_t firstSize , size_t secondSize )
+{
+	if( (firstSize != 0) && (secondSize > SIZE_MAX / firstSize) ) {
+		return SIZE_MAX;
+	}
+
+	return firstSize * secondSize;
+}
+
+/********************************************************************************
+ *     FUNCTION: sizeAdd
+ *        INPUT: firstSize, secondSize - sizes
+ *       OUTPUT: Sum or SIZE_MAX on overflow
+ *  DESCRIPTION: /
+ ********************************************************************************/
+
+size_t sizeAdd( size_t firstSize , size_t secondSize )
+{
+	if( secondSize > SIZE_MAX - firstSize ) {
+		return SIZE_MAX;
+	}
+
+	return firstSize + secondSize;
+}
+
+/********************************************************************************
+ *     FUNCTION: isBmpFormat
+ *        INPUT: imgHeader - image header file
+ *       OUTPUT: True (1) or false (0) 
+ *  DESCRIPTION: This function checks image header if file is in BMP format 
+ ********************************************************************************/
+
+int isBmpFormat( unsigned char *imgHeader )
+{
+	if( ( imgHeader[0] == 0x42 ) &&				/* First byte in file  */
+		( imgHeader[1] == 0x4d ) ) { 			/* Second byte in file */
+		return 1;
+	}	
+
+	return 0;
+}
+
+/********************************************************************************
+ *     FUNCTION: printImageInfo
+ *        INPUT: imageData_s - image data holding structure
+ *       OUTPUT: /
+ *  DESCRIPTION: This function prints basic image data
+ ********************************************************************************/
+
+void printImageInfo( imageData_s *imageData )
+{
+
+	printf("-----------------------------------\n");
+	printf("Image info:\n");
+
+	printf(" -    file size: %lld B\n -  image width: %d pixels\n - image height: %d pixels\n",
+			(long long) imageData->imgFileSize , imageData->imgWidth , imageData->imgHeight );
+
+	printf(" - padded bytes: %d B\n - image header: %lld B\n", imageData->paddedBytes,
+						(long long) imageData->pixelOffset );
+
+	printf(" -    bit depth: %d bits\n -  compression: %d\n", imageData->bitDepth , imageData->compression );
+
+	printf("-----------------------------------\n");
+	return;	
+
+}
+
+/********************************************************************************
+ *     Function: helpFunction
+ *        Input: /
+ *       Output: /
+ *  Description: This function prints help for this program
+ ********************************************************************************/
+
+void helpFunction( void )
+{
+
+	printf("========================== HELP ==========================\n");
+	printf(" This program converts .bmp image to ASCII image.\n");
+	printf("      Image is printed on standard output.\n\n");
+
+	printf(" Usage: asciiImage FILE [OPTION] \n");
+	printf("        asciiImage --batch [OPTION] FILE|DIR|- ...\n");
+
+	printf(" Options:\n");
+	printf(" -b, -bitGraphic    ... bit color option: 1 bit .. 4 bit\n");
+	printf(" --batch            ... print many images, each to its own file\n");
+	printf(" -h, --help         ... this menu\n");
+	printf(" --band             ... read image one band at a time ( low memory )\n");
+	printf(" --color            ... colored symbols: 24 ( 24-bit ) or 256 ( 256 colors )\n");
+	printf(" --html             ... print image to .html file\n");
+	printf(" --gzip             ... compress .html or batch file to .gz\n");
+	printf(" --info             ... print image info\n");
+	printf(" --integral         ... average symbols from integral image\n");
+	printf(" --shape            ... symbols matched to shape of 2 x 3 regions of symbol\n");
+	printf(" --dither           ... dithered symbols: fs ( Floyd-Steinberg ) or bayer\n");
+	printf(" --braille          ... UTF-8 braille symbols, 2 x 4 dots in each symbol\n");
+	printf(" --blocks           ... UTF-8 block symbols, 2 x 2 quadrants in each symbol\n");
+	printf(" -i, --invert       ... invert ascii colors\n");
+	printf(" --luma             ... weighted gray: 601 or 709 ( BT.601, BT.709 )\n");
+	printf(" --ramp             ... own symbols from black to white, e.g. \"@%%#*+=-:. \"\n");
+	printf(" -s, --size         ... size option [1-10], all or list ( 2,6,10 ) for file of each size\n");
+	printf(" --serve            ... render images sent to Unix socket ( path )\n");
+	printf(" --stream           ... live print of .bmp frames from standard input\n");
+	printf(" --cache            ... memory limit of --serve result cache in MB\n");
+	printf(" --memory           ... larger images are printed in bands ( MB, 0 for no limit )\n");
+	printf(" --cols, --rows     ... exact output size in symbols ( --cols auto for terminal width )\n");
+	printf(" --aspect           ... symbol height / width for --cols or --rows alone ( default 2 )\n");
+	printf(" --grayCache        ... directory of decoded gray maps, reused by later runs\n");
+	printf(" --grayCacheMb      ... size limit of --grayCache directory in MB ( default 512 )\n");
+	printf(" --stats[=json]     ... print time, bytes and memory of stages to stderr\n");
+	printf(" -t, --threads      ... number of threads ( 0 for all cores )\n\n");
+
+	printf("==========================================================\n");
+
+	return;
+
+}
+
+
+/*************************************************************************/
+/*                            GRAY MAP CACHE                             */                
+/*************************************************************************/
+
+#ifndef WINDOWS
+
+/********************************************************************************
+*     FUNCTION: grayCacheFind
+*        INPUT: grayCache    - cache entry of image
+*               imagePath    - image location on filesystem
+*               imageFile    - opened image file
+*               userInput    - user input data strucure
+*               imageData    - image data structure
+*               grayImageMap - gray pixel map, set on hit
+*       OUTPUT: OK ( hit ) or ERROR ( miss )
+*  DESCRIPTION: This function looks for gray pixel map of image in cache 
+*               directory. Name of cache file is hash of real path, device,
+*               inode, size and modification time of image and gray mode. 
+*               Header must also match sampled content of image. On hit 
+*               cache file stays mapped and map lines are used in place, 
+*               modification time of cache file marks last use. On miss 
+*               cachePath and header are kept for grayCacheStore.
+********************************************************************************/
+
+int grayCacheFind( grayCache_s *grayCache , char *imagePath , imageFile_s *imageFile , userInput_s *userInput , 
+					imageData_s *imageData , pixelMap_s *grayImageMap )
+{
+	int fileDesc;
+	int keyLen;
+	char *realPath;
+	char imageKey[GRAY_CACHE_PATH_LEN + 128];
+	void *mapData;
+
+	struct stat fileStat;
+	grayCacheHeader_s *cacheHeader;
+
+	grayCache->cachePath[0] = '\0';
+	grayCache->mapData = NULL;
+	grayCache->mapSize = 0;
+
+	if( stat( imagePath , &fileStat ) != 0 ) {
+		return ERROR;
+	}
+
+	/* Identity of image file */
+	realPath = realpath( imagePath , NULL );
+	keyLen = snprintf( imageKey , sizeof(imageKey) , "%s|%llu|%llu|%lld|%lld.%09ld|%d" , 
+				(realPath != NULL) ? realPath : imagePath , (unsigned long long) fileStat.st_dev , 
+				(unsigned long long) fileStat.st_ino , (long long) fileStat.st_size , 
+				(long long) fileStat.st_mtim.tv_sec , (long) fileStat.st_mtim.tv_nsec , userInput->grayMode );
+	free( realPath );
+	if( (keyLen < 0) || ((size_t) keyLen >= sizeof(imageKey)) ) {
+		return ERROR;
+	}
+
+	keyLen = snprintf( grayCache->cachePath , GRAY_CACHE_PATH_LEN , "%s/%016llx.gray" , userInput->grayCacheDir , 
+				(unsigned long long) hashBytes64( (unsigned char *) imageKey , keyLen ) );
+	if( (keyLen < 0) || (keyLen >= GRAY_CACHE_PATH_LEN) ) {
+		grayCache->cachePath[0] = '\0';
+		return ERROR;
+	}
+
+	/* Expected header */
+	memset( &grayCache->cacheHeader , 0 , sizeof(grayCacheHeader_s) );
+	memcpy( grayCache->cacheHeader.cacheMagic , GRAY_CACHE_MAGIC , sizeof(GRAY_CACHE_MAGIC) );
+	grayCache->cacheHeader.contentHash = grayCacheContentHash( imageFile );
+	grayCache->cacheHeader.fileSize = fileStat.st_size;
+	grayCache->cacheHeader.fileTime = (int64_t) fileStat.st_mtim.tv_sec * 1000000000 + fileStat.st_mtim.tv_nsec;
+	grayCache->cacheHeader.width = imageData->imgWidth;
+	grayCache->cacheHeader.height = imageData->imgHeight;
+	grayCache->cacheHeader.stride = (int32_t) arenaBlockSize( imageData->imgWidth );
+	grayCache->cacheHeader.grayMode = userInput->grayMode;
+
+	grayCache->mapSize = sizeAdd( sizeof(grayCacheHeader_s) , pixelMapSize( imageData->imgHeight , imageData->imgWidth ) );
+
+	fileDesc = open( grayCache->cachePath , O_RDONLY );
+	if( fileDesc < 0 ) {
+		return ERROR;
+	}
+
+	/* Cache file is replaced only by rename, so its size is final */
+	if( (fstat( fileDesc , &fileStat ) != 0) || ((uint64_t) fileStat.st_size != grayCache->mapSize) ) {
+		close( fileDesc );
+		return ERROR;
+	}
+
+	mapData = mmap( NULL , grayCache->mapSize , PROT_READ , MAP_SHARED , fileDesc , 0 );
+	if( mapData == MAP_FAILED ) {
+		close( fileDesc );
+		return ERROR;
+	}
+
+	cacheHeader = mapData;
+	if( memcmp( cacheHeader , &grayCache->cacheHeader , sizeof(grayCacheHeader_s) ) != 0 ) {
+		munmap( mapData , grayCache->mapSize );
+		close( fileDesc );
+		return ERROR;
+	}
+
+	/* Last use for eviction ( failure only makes entry older ) */
+	futimens( fileDesc , NULL );
+	close( fileDesc );
+
+	grayCache->mapData = mapData;
+
+	grayImageMap->width = cacheHeader->width;
+	grayImageMap->height = cacheHeader->height;
+	grayImageMap->stride = cacheHeader->stride;
+	grayImageMap->pixels = (unsigned char *) mapData + sizeof(grayCacheHeader_s);
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: grayCacheStore
+*        INPUT: grayCache    - cache entry of image ( grayCacheFind miss )
+*               grayImageMap - gray pixel map of image
+*               userInput    - user input data strucure
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function writes header and all map lines ( one block ) to
+*               temporary file, which is renamed to cache file. Other 
+*               processes see either no file or whole file. Cache directory
+*               is then evicted to its size limit.
+********************************************************************************/
+
+int grayCacheStore( grayCache_s *grayCache , pixelMap_s *grayImageMap , userInput_s *userInput )
+{
+	int fileDesc;
+	int pathLen;
+	char tempPath[GRAY_CACHE_PATH_LEN + 32];
+
+	/* Larger than whole cache */
+	if( grayCache->mapSize > (uint64_t) userInput->grayCacheMb * 1024 * 1024 ) {
+		return ERROR;
+	}
+
+	/* Temporary name is unique for process and thread, dot hides it from eviction */
+	pathLen = snprintf( tempPath , sizeof(tempPath) , "%s/.%s.%ld.%lx.tmp" , userInput->grayCacheDir , 
+				grayCache->cachePath + strlen( userInput->grayCacheDir ) + 1 , (long) getpid() , 
+#ifdef USE_THREADS
+				(unsigned long) pthread_self() );
+#else
+				0UL );
+#endif
+	if( (pathLen < 0) || ((size_t) pathLen >= sizeof(tempPath)) ) {
+		return ERROR;
+	}
+
+	fileDesc = open( tempPath , O_WRONLY | O_CREAT | O_EXCL , 0644 );
+	if( fileDesc < 0 ) {
+		fprintf( stderr , " Warrning: cannot write gray cache file %s!\n" , tempPath );
+		return ERROR;
+	}
+
+	if( (fileWriteAll( fileDesc , &grayCache->cacheHeader , sizeof(grayCacheHeader_s) ) < 0) ||
+		(fileWriteAll( fileDesc , grayImageMap->pixels , 
+						pixelMapSize( grayImageMap->height , grayImageMap->width ) ) < 0) ) {
+		fprintf( stderr , " Warrning: cannot write gray cache file %s!\n" , tempPath );
+		close( fileDesc );
+		unlink( tempPath );
+		return ERROR;
+	}
+
+	if( (close( fileDesc ) != 0) || (rename( tempPath , grayCache->cachePath ) != 0) ) {
+		unlink( tempPath );
+		return ERROR;
+	}
+
+	grayCacheEvict( userInput->grayCacheDir , (int64_t) userInput->grayCacheMb * 1024 * 1024 );
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: grayCacheRelease
+*        INPUT: grayCache - cache entry of image
+*       OUTPUT: /
+*  DESCRIPTION: This function unmaps cache file of hit
+********************************************************************************/
+
+void grayCacheRelease( grayCache_s *grayCache )
+{
+	if( grayCache->mapData != NULL ) {
+		munmap( grayCache->mapData , grayCache->mapSize );
+		grayCache->mapData = NULL;
+	}
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: grayCacheEvict
+*        INPUT: cacheDir  - cache directory
+*               sizeLimit - size limit of all cache files in bytes
+*       OUTPUT: /
+*  DESCRIPTION: This function removes least recently used cache files until
+*               cache fits to sizeLimit. Unfinished writes of crashed 
+*               processes are removed after GRAY_CACHE_TMP_AGE. Mapped files
+*               of other processes stay valid after removal.
+********************************************************************************/
+
+void grayCacheEvict( char *cacheDir , int64_t sizeLimit )
+{
+	int i;
+	int nameLen;
+	int numOfFiles;
+	int listSize;
+	int64_t cacheSize;
+	char filePath[GRAY_CACHE_PATH_LEN + 256];
+
+	DIR *dirPtr;
+	struct dirent *dirEntry;
+	struct stat fileStat;
+	grayCacheFile_s *cacheFiles;
+	grayCacheFile_s *newFiles;
+
+	dirPtr = opendir( cacheDir );
+	if( dirPtr == NULL ) {
+		return;
+	}
+
+	cacheFiles = NULL;
+	numOfFiles = 0;
+	listSize = 0;
+	cacheSize = 0;
+
+	while( (dirEntry = readdir( dirPtr )) != NULL ) {
+
+		nameLen = strlen( dirEntry->d_name );
+		if( nameLen >= (int) sizeof(cacheFiles->fileName) ) {
+			continue;
+		}
+
+		snprintf( filePath , sizeof(filePath) , "%s/%s" , cacheDir , dirEntry->d_name );
+		if( stat( filePath , &fileStat ) != 0 ) {
+			continue;								/* Removed by other process */
+		}
+
+		/* Unfinished write */
+		if( (nameLen > 4) && (dirEntry->d_name[0] == '.') && (strcmp( dirEntry->d_name + nameLen - 4 , ".tmp" ) == 0) ) {
+			if( time( NULL ) - fileStat.st_mtime > GRAY_CACHE_TMP_AGE ) {
+				unlink( filePath );
+			}
+			continue;
+		}
+
+		if( (nameLen < 6) || (dirEntry->d_name[0] == '.') || (strcmp( dirEntry->d_name + nameLen - 5 , ".gray" ) != 0) ) {
+			continue;
+		}
+
+		/* List is enlarged by doubling */
+		if( numOfFiles == listSize ) {
+			listSize = (listSize == 0) ? 64 : listSize * 2;
+			newFiles = realloc( cacheFiles , listSize * sizeof(grayCacheFile_s) );
+			if( newFiles == NULL ) {
+				break;
+			}
+			cacheFiles = newFiles;
+		}
+
+		cacheFiles[numOfFiles].fileTime = fileStat.st_mtime;
+		cacheFiles[numOfFiles].fileSize = fileStat.st_size;
+		memcpy( cacheFiles[numOfFiles].fileName , dirEntry->d_name , nameLen + 1 );
+		cacheSize = cacheSize + fileStat.st_size;
+		numOfFiles++;
+	}
+
+	closedir( dirPtr );
+
+	/* Oldest use first */
+	if( cacheSize > sizeLimit ) {
+		qsort( cacheFiles , numOfFiles , sizeof(grayCacheFile_s) , compareCacheFiles );
+		for( i = 0 ; (i < numOfFiles) && (cacheSize > sizeLimit) ; i++ ) {
+			snprintf( filePath , sizeof(filePath) , "%s/%s" , cacheDir , cacheFiles[i].fileName );
+			unlink( filePath );
+			cacheSize = cacheSize - cacheFiles[i].fileSize;
+		}
+	}
+
+	free( cacheFiles );
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: grayCacheContentHash
+*        INPUT: imageFile - opened image file
+*       OUTPUT: 64-bit hash of image content
+*  DESCRIPTION: This function hashes GRAY_CACHE_SAMPLES evenly spaced blocks
+*               of file ( first block has header and palette ). Whole file 
+*               is not read, because reading it is what cache saves. Size 
+*               and time in name of cache file catch ordinary changes.
+********************************************************************************/
+
+uint64_t grayCacheContentHash( imageFile_s *imageFile )
+{
+	int i;
+	int64_t sampleSize;
+	int64_t sampleOffset;
+	uint64_t hashValue;
+	unsigned char sampleBuffer[GRAY_CACHE_SAMPLE_SIZE];
+	unsigned char *samplePtr;
+
+	sampleSize = (imageFile->fileSize < GRAY_CACHE_SAMPLE_SIZE) ? imageFile->fileSize : GRAY_CACHE_SAMPLE_SIZE;
+	hashValue = 0;
+
+	for( i = 0 ; i < GRAY_CACHE_SAMPLES ; i++ ) {
+		sampleOffset = (imageFile->fileSize - sampleSize) / (GRAY_CACHE_SAMPLES - 1) * i;
+		samplePtr = imageFileRead( imageFile , sampleOffset , sampleSize , sampleBuffer );
+		if( samplePtr == NULL ) {
+			return 0;
+		}
+		hashValue = (hashValue * 0x9E3779B97F4A7C15ULL) ^ hashBytes64( samplePtr , sampleSize );
+	}
+
+	return hashValue;
+}
+
+/********************************************************************************
+*     FUNCTION: fileWriteAll
+*        INPUT: fileDesc   - opened file
+*               dataBuffer - data
+*               dataSize   - number of bytes
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: /
+********************************************************************************/
+
+int fileWriteAll( int fileDesc , const void *dataBuffer , size_t dataSize )
+{
+	size_t dataWritten;
+	ssize_t retVal;
+
+	for( dataWritten = 0 ; dataWritten < dataSize ; dataWritten = dataWritten + retVal ) {
+		retVal = write( fileDesc , (const char *) dataBuffer + dataWritten , dataSize - dataWritten );
+		if( retVal < 0 ) {
+			if( errno == EINTR ) {
+				retVal = 0;
+				continue;
+			}
+			return ERROR;
+		}
+	}
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: compareCacheFiles
+*        INPUT: firstArg, secondArg - cache files
+*       OUTPUT: -1, 0 or 1 ( older use first )
+*  DESCRIPTION: Compare function for qsort
+********************************************************************************/
+
+int compareCacheFiles( const void *firstArg , const void *secondArg )
+{
+	time_t firstTime = ((const grayCacheFile_s *) firstArg)->fileTime;
+	time_t secondTime = ((const grayCacheFile_s *) secondArg)->fileTime;
+
+	return (firstTime > secondTime) - (firstTime < secondTime);
+}
+
+#endif
+
+/*************************************************************************/
+/*                              STREAM MODE                              */                
+/*************************************************************************/
+
+#ifndef WINDOWS
+
+/********************************************************************************
+*     FUNCTION: streamImages
+*        INPUT: userInput - user input data strucure
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function prints concatenated .bmp frames from standard 
+*               input. Symbols of previous frame are kept and only changed 
+*               symbols are printed ( with ANSI cursor moves ). When next 
+*               frame is already waiting, current frame is dropped, so 
+*               printing never falls behind input.
+********************************************************************************/
+
+int streamImages( userInput_s *userInput )
+{
+	int retVal;
+	int endOfInput;
+	int numOfLines;
+	int numOfCells;
+	int numOfFrames;
+	int numOfDropped;
+	long frameSize;
+	long nextSize;
+	size_t frameBufSize;
+	size_t nextBufSize;
+	size_t swapSize;
+	size_t textSize;
+	size_t textNeeded;
+	size_t outLen;
+
+	char cursorMove[32];
+	char *newText;
+	char *oldText;
+	char *swapText;
+	unsigned char *frameBuffer;
+	unsigned char *nextBuffer;
+	unsigned char *swapBuffer;
+
+	struct pollfd inputPoll;
+	asciiOptions_s options;
+	outputBuffer_s outBuffer;
+
+	asciiOptionsInit( &options );
+	options.sizeMode = userInput->sizeMode;
+	options.bitGraphic = userInput->bitGraphic;
+	options.invertFlag = userInput->invertFlag;
+	options.grayMode = userInput->grayMode;
+	options.asciiRamp = userInput->asciiRamp;
+
+	/* Terminal output - escape sequences and symbols of one frame in one write */
+	outBuffer.bufData = malloc( STREAM_OUT_BUFFER );
+	if( outBuffer.bufData == NULL ) {
+		printf("Cannot allocate memory for output buffer!\n");
+		return ERROR;
+	}
+	outBuffer.bufSize = STREAM_OUT_BUFFER;
+	outBuffer.bufUsed = 0;
+	outBuffer.htmlMode = 0;
+	outBuffer.colorMode = COLOR_NONE;
+	outBuffer.spanOpen = 0;
+	outBuffer.gzipStream = NULL;
+	outBuffer.outWritten = 0;
+	outBuffer.outFilePtr = stdout;
+	outBuffer.outFilePath[0] = '\0';
+
+	frameBuffer = NULL;
+	frameBufSize = 0;
+	nextBuffer = NULL;
+	nextBufSize = 0;
+	newText = NULL;
+	oldText = NULL;
+	textSize = 0;
+	numOfLines = 0;
+	numOfCells = 0;
+	numOfFrames = 0;
+	numOfDropped = 0;
+	endOfInput = 0;
+	retVal = OK;
+
+	inputPoll.fd = STDIN_FILENO;
+	inputPoll.events = POLLIN;
+
+	/* Hide cursor */
+	outputAppendText( &outBuffer , "\033[?25l" );
+
+	while( !endOfInput ) {
+
+		frameSize = streamReadFrame( STDIN_FILENO , &frameBuffer , &frameBufSize );
+		if( frameSize <= 0 ) {
+			retVal = (frameSize < 0) ? ERROR : OK;
+			break;
+		}
+
+		/* Frames that are already waiting replace current frame */
+		while( (poll( &inputPoll , 1 , 0 ) > 0) && (inputPoll.revents & POLLIN) ) {
+
+			nextSize = streamReadFrame( STDIN_FILENO , &nextBuffer , &nextBufSize );
+			if( nextSize <= 0 ) {
+				endOfInput = 1;
+				retVal = (nextSize < 0) ? ERROR : OK;
+				break;
+			}
+
+			swapBuffer = frameBuffer;
+			frameBuffer = nextBuffer;
+			nextBuffer = swapBuffer;
+			swapSize = frameBufSize;
+			frameBufSize = nextBufSize;
+			nextBufSize = swapSize;
+			frameSize = nextSize;
+			numOfDropped++;
+		}
+
+		/* Text buffers grow to largest frame */
+		if( asciiImageGetSizes( frameBuffer , frameSize , &options , &textNeeded , NULL ) < 0 ) {
+			numOfDropped++;						/* Damaged frame */
+			continue;
+		}
+
+		if( textNeeded > textSize ) {
+			free( newText );
+			free( oldText );
+			newText = malloc( textNeeded );
+			oldText = malloc( textNeeded );
+			textSize = textNeeded;
+			numOfLines = 0;						/* Previous frame is lost */
+		}
+
+		if( (newText == NULL) || (oldText == NULL) ) {
+			printf("Cannot allocate memory for frame!\n");
+			retVal = ERROR;
+			break;
+		}
+
+		if( asciiImageRender( frameBuffer , frameSize , &options , newText , textSize , &outLen ) < 0 ) {
+			numOfDropped++;
+			continue;
+		}
+
+		/*************************************************************************/
+		/*                           Print changes                               */                
+		/*************************************************************************/
+
+		/* All lines have same length */
+		if( (outLen == 0) || ((int) (strchr( newText , '\n' ) - newText) != numOfCells) || 
+			((long) outLen != (long) numOfLines * (numOfCells + 1)) ) {
+
+			/* First frame or new size - whole screen */
+			numOfCells = (outLen > 0) ? (int) (strchr( newText , '\n' ) - newText) : 0;
+			numOfLines = (outLen > 0) ? (int) (outLen / (numOfCells + 1)) : 0;
+
+			outputAppendText( &outBuffer , "\033[H\033[2J" );
+			outputAppendData( &outBuffer , newText , outLen );
+
+		} else {
+			streamDrawDelta( &outBuffer , newText , oldText , numOfLines , numOfCells );
+		}
+
+		/* Cursor below image */
+		snprintf( cursorMove , sizeof(cursorMove) , "\033[%d;1H" , numOfLines + 1 );
+		outputAppendText( &outBuffer , cursorMove );
+
+		if( outputFlush( &outBuffer ) < 0 ) {
+			retVal = ERROR;
+			break;
+		}
+
+		swapText = oldText;
+		oldText = newText;
+		newText = swapText;
+		numOfFrames++;
+	}
+
+	/* Show cursor */
+	outputAppendText( &outBuffer , "\033[?25h" );
+	outputFlush( &outBuffer );
+
+	fprintf( stderr , " Stream: %d frames printed , %d dropped\n" , numOfFrames , numOfDropped );
+
+	free( outBuffer.bufData );
+	free( frameBuffer );
+	free( nextBuffer );
+	free( newText );
+	free( oldText );
+
+	return retVal;
+}
+
+/********************************************************************************
+*     FUNCTION: streamReadFrame
+*        INPUT: inputFd     - input stream
+*               frameBuffer - buffer of frame ( grows when needed )
+*               bufferSize  - size of frameBuffer
+*       OUTPUT: Size of frame, 0 at end of input or ERROR
+*  DESCRIPTION: This function reads one .bmp frame. Frame size is taken from
+*               file size in header ( or from pixel array when it is smaller ).
+********************************************************************************/
+
+long streamReadFrame( int inputFd , unsigned char **frameBuffer , size_t *bufferSize )
+{
+	long retVal;
+	int64_t frameSize;
+	int64_t pixelSize;
+
+	unsigned char imgHeader[BMP_HEADER_SIZE];
+	unsigned char *newBuffer;
+
+	retVal = streamReadAll( inputFd , imgHeader , BMP_HEADER_SIZE );
+	if( retVal == 0 ) {
+		return 0;							/* End of input */
+	}
+	if( (retVal != BMP_HEADER_SIZE) || !isBmpFormat( imgHeader ) ) {
+		fprintf( stderr , "Stream is not sequence of .bmp frames!\n" );
+		return ERROR;
+	}
+
+	/* Size of RLE frame is known only from header */
+	frameSize = bmpGetFileSize( imgHeader );
+	if( (bmpGetCompression( imgHeader ) == BMP_RGB) || (bmpGetCompression( imgHeader ) == BMP_BITFIELDS) ) {
+		pixelSize = bmpGetOffset( imgHeader ) + llabs( (int64_t) bmpGetHeight( imgHeader ) ) * 
+					(((int64_t) bmpGetWidth( imgHeader ) * bmpGetBitDepth( imgHeader ) + 31) / 32 * 4);
+		if( frameSize < pixelSize ) {
+			frameSize = pixelSize;
+		}
+	}
+
+	if( (frameSize < BMP_HEADER_SIZE) || (frameSize > STREAM_MAX_FRAME) ) {
+		fprintf( stderr , "Stream frame is too large or damaged!\n" );
+		return ERROR;
+	}
+
+	if( (size_t) frameSize > *bufferSize ) {
+		newBuffer = realloc( *frameBuffer , frameSize );
+		if( newBuffer == NULL ) {
+			fprintf( stderr , "Cannot allocate memory for frame!\n" );
+			return ERROR;
+		}
+		*frameBuffer = newBuffer;
+		*bufferSize = frameSize;
+	}
+
+	memcpy( *frameBuffer , imgHeader , BMP_HEADER_SIZE );
+
+	retVal = streamReadAll( inputFd , *frameBuffer + BMP_HEADER_SIZE , frameSize - BMP_HEADER_SIZE );
+	if( retVal != frameSize - BMP_HEADER_SIZE ) {
+		fprintf( stderr , "Stream ended inside of frame!\n" );
+		return ERROR;
+	}
+
+	return frameSize;
+}
+
+/********************************************************************************
+*     FUNCTION: streamReadAll
+*        INPUT: inputFd    - input stream
+*               dataBuffer - buffer for data
+*               dataSize   - number of bytes
+*       OUTPUT: Number of read bytes ( less only at end of input ) or ERROR
+*  DESCRIPTION: /
+********************************************************************************/
+
+long streamReadAll( int inputFd , unsigned char *dataBuffer , size_t dataSize )
+{
+	size_t dataRead;
+	ssize_t retVal;
+
+	for( dataRead = 0 ; dataRead < dataSize ; dataRead = dataRead + retVal ) {
+		retVal = read( inputFd , dataBuffer + dataRead , dataSize - dataRead );
+		if( retVal < 0 ) {
+			if( errno == EINTR ) {
+				retVal = 0;
+				continue;
+			}
+			return ERROR;
+		}
+		if( retVal == 0 ) {
+			break;
+		}
+	}
+
+	return dataRead;
+}
+
+/********************************************************************************
+*     FUNCTION: streamDrawDelta
+*        INPUT: outBuffer  - terminal output
+*               newFrame   - lines of new frame
+*               oldFrame   - lines of printed frame ( same size )
+*               numOfLines - number of lines
+*               numOfCells - symbols in line ( without end of line )
+*       OUTPUT: /
+*  DESCRIPTION: This function prints only changed symbols. Each run of 
+*               changed symbols gets one cursor move, runs closer than 
+*               STREAM_MERGE_GAP are joined, because printing few unchanged
+*               symbols is shorter than cursor move.
+********************************************************************************/
+
+void streamDrawDelta( outputBuffer_s *outBuffer , char *newFrame , char *oldFrame , int numOfLines , int numOfCells )
+{
+	int line;
+	int cell;
+	int runStart;
+	int lastChanged;
+
+	char cursorMove[32];
+	char *newLine;
+	char *oldLine;
+
+	for( line = 0 ; line < numOfLines ; line++ ) {
+
+		newLine = newFrame + (size_t) line * (numOfCells + 1);
+		oldLine = oldFrame + (size_t) line * (numOfCells + 1);
+
+		/* Whole line is same - most lines of dashboards */
+		if( memcmp( newLine , oldLine , numOfCells ) == 0 ) {
+			continue;
+		}
+
+		runStart = -1;
+		lastChanged = -1;
+
+		for( cell = 0 ; cell <= numOfCells ; cell++ ) {
+
+			/* End of line closes last run */
+			if( (cell < numOfCells) && (newLine[cell] == oldLine[cell]) ) {
+				continue;
+			}
+
+			if( (runStart >= 0) && ((cell == numOfCells) || (cell - lastChanged > STREAM_MERGE_GAP)) ) {
+				snprintf( cursorMove , sizeof(cursorMove) , "\033[%d;%dH" , line + 1 , runStart + 1 );
+				outputAppendText( outBuffer , cursorMove );
+				outputAppendData( outBuffer , newLine + runStart , lastChanged - runStart + 1 );
+				runStart = -1;
+			}
+
+			if( runStart < 0 ) {
+				runStart = cell;
+			}
+			lastChanged = cell;
+		}
+	}
+
+	return;
+}
+
+#endif /* WINDOWS */
+
+
+/*************************************************************************/
+/*                              SERVE MODE                               */                
+/*************************************************************************/
+
+/********************************************************************************
+*     FUNCTION: hashBytes64
+*        INPUT: dataPtr  - data
+*               dataSize - size of data
+*       OUTPUT: 64-bit hash of data
+*  DESCRIPTION: This function hashes 8 bytes at a time ( multiply and xor 
+*               shift ), it is used as content address of images
+********************************************************************************/
+
+uint64_t hashBytes64( const unsigned char *dataPtr , size_t dataSize )
+{
+	size_t i;
+	uint64_t hashValue;
+	uint64_t dataWord;
+
+	hashValue = 0x9E3779B97F4A7C15ULL ^ dataSize;
+
+	for( i = 0 ; i + 8 <= dataSize ; i = i + 8 ) {
+		memcpy( &dataWord , dataPtr + i , 8 );
+		hashValue = (hashValue ^ dataWord) * 0xFF51AFD7ED558CCDULL;
+		hashValue = hashValue ^ (hashValue >> 32);
+	}
+
+	/* Last bytes */
+	dataWord = 0;
+	memcpy( &dataWord , dataPtr + i , dataSize - i );
+	hashValue = (hashValue ^ dataWord) * 0xC4CEB9FE1A85EC53ULL;
+	hashValue = hashValue ^ (hashValue >> 29);
+
+	return hashValue;
+}
+
+#ifdef USE_THREADS
+
+/********************************************************************************
+*     FUNCTION: serveImages
+*        INPUT: socketPath - path of Unix socket
+*               userInput  - user input data strucure ( --ramp and --cache )
+*       OUTPUT: ERROR ( only when server cannot run )
+*  DESCRIPTION: This function serves images until accept fails. Every 
+*               connection gets its own thread. Requests on connection:
+*                 RENDER <bytes> <size> <bit> <invert> <html> <luma>\n<bmp>
+*                   -> OK <length> HIT|MISS\n<ascii image>
+*                   -> ERROR <code> <description>\n
+*                 STATS\n
+*                   -> STATS requests=.. hits=.. ... p99_us=..\n
+*               Results are cached by content hash of image and options.
+********************************************************************************/
+
+int serveImages( char *socketPath , userInput_s *userInput )
+{
+	int listenFd;
+	int clientFd;
+
+	struct sockaddr_un sockAddr;
+	pthread_t threadId;
+
+	serveJob_s *serveJob;
+	resultCache_s *resultCache;
+
+	if( strlen( socketPath ) >= sizeof(sockAddr.sun_path) ) {
+		printf("Socket path %s is too long!\n", socketPath );
+		return ERROR;
+	}
+
+	memset( &sockAddr , 0 , sizeof(sockAddr) );
+	sockAddr.sun_family = AF_UNIX;
+	strcpy( sockAddr.sun_path , socketPath );
+
+	listenFd = socket( AF_UNIX , SOCK_STREAM , 0 );
+	if( listenFd < 0 ) {
+		printf("Cannot create socket!\n");
+		return ERROR;
+	}
+
+	/* Socket left by previous server */
+	unlink( socketPath );
+
+	if( (bind( listenFd , (struct sockaddr *) &sockAddr , sizeof(sockAddr) ) < 0) || 
+		(listen( listenFd , SERVE_BACKLOG ) < 0) ) {
+		printf("Cannot listen on socket %s!\n", socketPath );
+		close( listenFd );
+		return ERROR;
+	}
+
+	/* Cache is used by all connections for whole life of server */
+	resultCache = malloc( sizeof(resultCache_s) );
+	if( resultCache == NULL ) {
+		printf("Cannot allocate memory for result cache!\n");
+		close( listenFd );
+		return ERROR;
+	}
+	cacheInit( resultCache , (size_t) userInput->cacheSizeMb * 1024 * 1024 );
+
+	printf(" Serving on %s ( cache %d MB )\n", socketPath , userInput->cacheSizeMb );
+	fflush( stdout );
+
+	while( 1 ) {
+
+		clientFd = accept( listenFd , NULL , NULL );
+		if( clientFd < 0 ) {
+			if( (errno == EINTR) || (errno == ECONNABORTED) ) {
+				continue;
+			}
+			printf("Cannot accept connection!\n");
+			break;
+		}
+
+		serveJob = malloc( sizeof(serveJob_s) );
+		if( serveJob == NULL ) {
+			close( clientFd );
+			continue;
+		}
+		serveJob->clientFd = clientFd;
+		serveJob->resultCache = resultCache;
+		serveJob->userInput = userInput;
+
+		if( pthread_create( &threadId , NULL , serveConnection , serveJob ) != 0 ) {
+			close( clientFd );
+			free( serveJob );
+			continue;
+		}
+		pthread_detach( threadId );
+	}
+
+	/* Cache is not freed - running connections may still use it */
+	close( listenFd );
+	unlink( socketPath );
+
+	return ERROR;
+}
+
+/********************************************************************************
+*     FUNCTION: serveConnection
+*        INPUT: jobArg - pointer to serveJob_s ( freed by this thread )
+*       OUTPUT: NULL
+*  DESCRIPTION: Connection thread - answers requests until client closes 
+*               connection or sends bad request. Image and response buffers
+*               are reused for all requests of connection.
+********************************************************************************/
+
+void * serveConnection( void *jobArg )
+{
+	int retVal;
+	int cacheHit;
+	int numOfFields;
+	long imageSize;
+	size_t imageBufSize;
+	size_t responseSize;
+	size_t outLen;
+	double startTime;
+
+	char requestLine[SERVE_LINE_LEN];
+	char responseLine[SERVE_LINE_LEN + 64];
+	char *responseBuffer;
+	unsigned char *imageBuffer;
+	unsigned char *newBuffer;
+
+	serveJob_s serveJob;
+	asciiOptions_s options;
+
+	serveJob = *(serveJob_s *) jobArg;
+	free( jobArg );
+
+	imageBuffer = NULL;
+	imageBufSize = 0;
+	responseBuffer = NULL;
+	responseSize = 0;
+
+	while( socketReadLine( serveJob.clientFd , requestLine , SERVE_LINE_LEN ) == OK ) {
+
+		startTime = getWallTime();
+
+		/* Cache report */
+		if( strcmp( requestLine , "STATS" ) == 0 ) {
+			cacheFormatStats( serveJob.resultCache , responseLine , sizeof(responseLine) );
+			if( socketWriteAll( serveJob.clientFd , responseLine , strlen( responseLine ) ) < 0 ) {
+				break;
+			}
+			continue;
+		}
+
+		asciiOptionsInit( &options );
+		options.asciiRamp = serveJob.userInput->asciiRamp;
+
+		numOfFields = sscanf( requestLine , "RENDER %ld %d %d %d %d %d" , &imageSize , &options.sizeMode , 
+								&options.bitGraphic , &options.invertFlag , &options.htmlMode , &options.grayMode );
+
+		/* Image size is unknown, connection cannot continue */
+		if( (numOfFields != 6) || (imageSize <= 0) || (imageSize > SERVE_MAX_IMAGE) ) {
+			snprintf( responseLine , sizeof(responseLine) , "ERROR %d %s\n" , ASCII_ERROR_ARGUMENT , "bad request" );
+			socketWriteAll( serveJob.clientFd , responseLine , strlen( responseLine ) );
+			break;
+		}
+
+		/* Image buffer grows to largest image of connection */
+		if( (size_t) imageSize > imageBufSize ) {
+			newBuffer = realloc( imageBuffer , imageSize );
+			if( newBuffer == NULL ) {
+				break;
+			}
+			imageBuffer = newBuffer;
+			imageBufSize = imageSize;
+		}
+
+		if( socketReadAll( serveJob.clientFd , imageBuffer , imageSize ) < 0 ) {
+			break;
+		}
+
+		retVal = serveRender( serveJob.resultCache , imageBuffer , imageSize , &options , 
+								&responseBuffer , &responseSize , &outLen , &cacheHit );
+		if( retVal < 0 ) {
+			snprintf( responseLine , sizeof(responseLine) , "ERROR %d %s\n" , retVal , asciiImageErrorString( retVal ) );
+			if( socketWriteAll( serveJob.clientFd , responseLine , strlen( responseLine ) ) < 0 ) {
+				break;
+			}
+			continue;
+		}
+
+		snprintf( responseLine , sizeof(responseLine) , "OK %lu %s\n" , (unsigned long) outLen , cacheHit ? "HIT" : "MISS" );
+		if( (socketWriteAll( serveJob.clientFd , responseLine , strlen( responseLine ) ) < 0) || 
+			(socketWriteAll( serveJob.clientFd , responseBuffer , outLen ) < 0) ) {
+			break;
+		}
+
+		cacheAddLatency( serveJob.resultCache , getWallTime() - startTime );
+	}
+
+	close( serveJob.clientFd );
+	free( imageBuffer );
+	free( responseBuffer );
+
+	return NULL;
+}
+
+/********************************************************************************
+*     FUNCTION: serveRender
+*        INPUT: resultCache    - shared result cache
+*               imageBuffer    - .bmp image
+*               imageSize      - size of image
+*               options        - options of request
+*               responseBuffer - buffer of connection ( grows when needed )
+*               responseSize   - size of responseBuffer
+*               outLen         - length of ascii image in responseBuffer
+*               cacheHit       - 1 if result was cached
+*       OUTPUT: ASCII_OK or library error code
+*  DESCRIPTION: This function copies cached result or renders image with 
+*               library function and stores result in cache. Image is 
+*               rendered without holding cache lock.
+********************************************************************************/
+
+int serveRender( resultCache_s *resultCache , unsigned char *imageBuffer , long imageSize , asciiOptions_s *options , 
+					char **responseBuffer , size_t *responseSize , size_t *outLen , int *cacheHit )
+{
+	int retVal;
+	size_t outSize;
+	uint64_t imageHash;
+
+	char *newBuffer;
+	cacheEntry_s *cacheEntry;
+	cacheKey_s cacheKey;
+	userInput_s checkInput;
+
+	/* Invalid options are rejected before cache lookup, as on cold cache */
+	retVal = libraryInputFromOptions( options , &checkInput );
+	if( retVal < 0 ) {
+		return retVal;
+	}
+
+	imageHash = hashBytes64( imageBuffer , imageSize );
+
+	/* All options that change output ( --ramp is same for whole server ) */
+	cacheKey.sizeMode = checkInput.sizeMode;
+	cacheKey.bitGraphic = checkInput.bitGraphic;
+	cacheKey.invertFlag = checkInput.invertFlag;
+	cacheKey.htmlMode = checkInput.htmlMode;
+	cacheKey.grayMode = checkInput.grayMode;
+
+	/*************************************************************************/
+	/*                             Cached result                             */                
+	/*************************************************************************/
+
+	pthread_mutex_lock( &resultCache->cacheLock );
+
+	resultCache->numOfRequests++;
+
+	cacheEntry = cacheFind( resultCache , imageHash , imageBuffer , imageSize , &cacheKey );
+	if( cacheEntry != NULL ) {
+
+		if( cacheEntry->outLen > *responseSize ) {
+			newBuffer = realloc( *responseBuffer , cacheEntry->outLen );
+			if( newBuffer == NULL ) {
+				pthread_mutex_unlock( &resultCache->cacheLock );
+				return ASCII_ERROR_MEMORY;
+			}
+			*responseBuffer = newBuffer;
+			*responseSize = cacheEntry->outLen;
+		}
+
+		/* Entry can be evicted by other connection after unlock */
+		memcpy( *responseBuffer , cacheEntry->outData , cacheEntry->outLen );
+		*outLen = cacheEntry->outLen;
+		*cacheHit = 1;
+		resultCache->numOfHits++;
+
+		pthread_mutex_unlock( &resultCache->cacheLock );
+		return ASCII_OK;
+	}
+
+	resultCache->numOfMisses++;
+
+	pthread_mutex_unlock( &resultCache->cacheLock );
+
+	/*************************************************************************/
+	/*                             Render image                              */                
+	/*************************************************************************/
+
+	*cacheHit = 0;
+
+	retVal = asciiImageGetSizes( imageBuffer , imageSize , options , &outSize , NULL );
+	if( retVal < 0 ) {
+		return retVal;
+	}
+
+	if( outSize > *responseSize ) {
+		newBuffer = realloc( *responseBuffer , outSize );
+		if( newBuffer == NULL ) {
+			return ASCII_ERROR_MEMORY;
+		}
+		*responseBuffer = newBuffer;
+		*responseSize = outSize;
+	}
+
+	retVal = asciiImageRender( imageBuffer , imageSize , options , *responseBuffer , *responseSize , outLen );
+	if( retVal < 0 ) {
+		return retVal;
+	}
+
+	pthread_mutex_lock( &resultCache->cacheLock );
+	cacheInsert( resultCache , imageHash , imageBuffer , imageSize , &cacheKey , *responseBuffer , *outLen );
+	pthread_mutex_unlock( &resultCache->cacheLock );
+
+	return ASCII_OK;
+}
+
+/********************************************************************************
+*     FUNCTION: socketReadLine
+*        INPUT: socketFd   - connected socket
+*               lineBuffer - buffer for line ( without end of line )
+*               lineSize   - size of lineBuffer
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function reads one request line. Line is read one byte
+*               at a time, so image bytes after it stay in socket.
+********************************************************************************/
+
+int socketReadLine( int socketFd , char *lineBuffer , int lineSize )
+{
+	int lineLen;
+	ssize_t retVal;
+
+	for( lineLen = 0 ; lineLen < lineSize - 1 ; ) {
+
+		retVal = read( socketFd , lineBuffer + lineLen , 1 );
+		if( retVal < 0 ) {
+			if( errno == EINTR ) {
+				continue;
+			}
+			return ERROR;
+		}
+		if( retVal == 0 ) {
+			return ERROR;					/* Connection closed */
+		}
+
+		if( lineBuffer[lineLen] == '\n' ) {
+			lineBuffer[lineLen] = '\0';
+			return OK;
+		}
+		lineLen++;
+	}
+
+	return ERROR;							/* Line too long */
+}
+
+/********************************************************************************
+*     FUNCTION: socketReadAll
+*        INPUT: socketFd   - connected socket
+*               dataBuffer - buffer for data
+*               dataSize   - number of bytes
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: /
+********************************************************************************/
+
+int socketReadAll( int socketFd , void *dataBuffer , size_t dataSize )
+{
+	size_t dataRead;
+	ssize_t retVal;
+
+	for( dataRead = 0 ; dataRead < dataSize ; dataRead = dataRead + retVal ) {
+		retVal = read( socketFd , (char *) dataBuffer + dataRead , dataSize - dataRead );
+		if( retVal < 0 ) {
+			if( errno == EINTR ) {
+				retVal = 0;
+				continue;
+			}
+			return ERROR;
+		}
+		if( retVal == 0 ) {
+			return ERROR;
+		}
+	}
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: socketWriteAll
+*        INPUT: socketFd   - connected socket
+*               dataBuffer - data
+*               dataSize   - number of bytes
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: /
+********************************************************************************/
+
+int socketWriteAll( int socketFd , const void *dataBuffer , size_t dataSize )
+{
+	size_t dataWritten;
+	ssize_t retVal;
+
+	for( dataWritten = 0 ; dataWritten < dataSize ; dataWritten = dataWritten + retVal ) {
+		retVal = send( socketFd , (const char *) dataBuffer + dataWritten , dataSize - dataWritten , MSG_NOSIGNAL );
+		if( retVal < 0 ) {
+			if( errno == EINTR ) {
+				retVal = 0;
+				continue;
+			}
+			return ERROR;
+		}
+	}
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: cacheInit
+*        INPUT: resultCache - result cache
+*               memLimit    - memory limit of cached results in bytes
+*       OUTPUT: /
+*  DESCRIPTION: /
+********************************************************************************/
+
+void cacheInit( resultCache_s *resultCache , size_t memLimit )
+{
+	memset( resultCache , 0 , sizeof(resultCache_s) );
+	resultCache->memLimit = memLimit;
+
+	pthread_mutex_init( &resultCache->cacheLock , NULL );
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: cacheFind
+*        INPUT: resultCache - result cache ( locked )
+*               imageHash   - content hash of image
+*               imageBuffer - bytes of .bmp file
+*               imageSize   - size of image
+*               cacheKey    - rendering options
+*       OUTPUT: Entry or NULL
+*  DESCRIPTION: This function finds result and moves it to front of LRU list.
+*               Image bytes are compared, so hash collision is only a miss.
+********************************************************************************/
+
+cacheEntry_s * cacheFind( resultCache_s *resultCache , uint64_t imageHash , unsigned char *imageBuffer , long imageSize , 
+							cacheKey_s *cacheKey )
+{
+	cacheEntry_s *cacheEntry;
+
+	cacheEntry = resultCache->hashTable[cacheBucket( imageHash , cacheKey )];
+
+	while( cacheEntry != NULL ) {
+		if( (cacheEntry->imageHash == imageHash) && (cacheEntry->imageSize == imageSize) && 
+			cacheKeyEqual( &cacheEntry->cacheKey , cacheKey ) && 
+			(memcmp( cacheEntry->imageData , imageBuffer , imageSize ) == 0) ) {
+			break;
+		}
+		cacheEntry = cacheEntry->hashNext;
+	}
+
+	if( (cacheEntry == NULL) || (cacheEntry == resultCache->lruFirst) ) {
+		return cacheEntry;
+	}
+
+	/* Unlink from LRU list */
+	cacheEntry->lruPrev->lruNext = cacheEntry->lruNext;
+	if( cacheEntry->lruNext != NULL ) {
+		cacheEntry->lruNext->lruPrev = cacheEntry->lruPrev;
+	} else {
+		resultCache->lruLast = cacheEntry->lruPrev;
+	}
+
+	/* Most recently used */
+	cacheEntry->lruPrev = NULL;
+	cacheEntry->lruNext = resultCache->lruFirst;
+	resultCache->lruFirst->lruPrev = cacheEntry;
+	resultCache->lruFirst = cacheEntry;
+
+	return cacheEntry;
+}
+
+/********************************************************************************
+*     FUNCTION: cacheInsert
+*        INPUT: resultCache - result cache ( locked )
+*               imageHash   - content hash of image
+*               imageBuffer - bytes of .bmp file ( copied )
+*               imageSize   - size of image
+*               cacheKey    - rendering options
+*               outData     - rendered image ( copied )
+*               outLen      - length of outData
+*       OUTPUT: /
+*  DESCRIPTION: This function stores copy of result. Least recently used 
+*               results are removed until new result fits in memory limit.
+********************************************************************************/
+
+void cacheInsert( resultCache_s *resultCache , uint64_t imageHash , unsigned char *imageBuffer , long imageSize , 
+					cacheKey_s *cacheKey , char *outData , size_t outLen )
+{
+	int bucket;
+	size_t entrySize;
+
+	cacheEntry_s *cacheEntry;
+
+	entrySize = sizeof(cacheEntry_s) + outLen + (size_t) imageSize;
+	if( entrySize > resultCache->memLimit ) {
+		return;
+	}
+
+	/* Same image rendered by two connections at once */
+	if( cacheFind( resultCache , imageHash , imageBuffer , imageSize , cacheKey ) != NULL ) {
+		return;
+	}
+
+	while( resultCache->memUsed + entrySize > resultCache->memLimit ) {
+		cacheRemove( resultCache , resultCache->lruLast );
+	}
+
+	cacheEntry = malloc( sizeof(cacheEntry_s) );
+	if( cacheEntry == NULL ) {
+		return;
+	}
+	cacheEntry->outData = malloc( outLen + 1 );
+	if( cacheEntry->outData == NULL ) {
+		free( cacheEntry );
+		return;
+	}
+	cacheEntry->imageData = malloc( imageSize );
+	if( cacheEntry->imageData == NULL ) {
+		free( cacheEntry->outData );
+		free( cacheEntry );
+		return;
+	}
+
+	memcpy( cacheEntry->outData , outData , outLen );
+	memcpy( cacheEntry->imageData , imageBuffer , imageSize );
+	cacheEntry->outLen = outLen;
+	cacheEntry->imageHash = imageHash;
+	cacheEntry->imageSize = imageSize;
+	cacheEntry->cacheKey = *cacheKey;
+
+	bucket = cacheBucket( imageHash , cacheKey );
+	cacheEntry->hashNext = resultCache->hashTable[bucket];
+	resultCache->hashTable[bucket] = cacheEntry;
+
+	cacheEntry->lruPrev = NULL;
+	cacheEntry->lruNext = resultCache->lruFirst;
+	if( resultCache->lruFirst != NULL ) {
+		resultCache->lruFirst->lruPrev = cacheEntry;
+	} else {
+		resultCache->lruLast = cacheEntry;
+	}
+	resultCache->lruFirst = cacheEntry;
+
+	resultCache->memUsed = resultCache->memUsed + entrySize;
+	resultCache->numOfEntries++;
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: cacheBucket
+*        INPUT: imageHash   - content hash of image
+*               cacheKey    - rendering options
+*       OUTPUT: Hash table bucket of result
+*  DESCRIPTION: /
+********************************************************************************/
+
+int cacheBucket( uint64_t imageHash , cacheKey_s *cacheKey )
+{
+	uint64_t keyHash;
+
+	keyHash = (uint64_t) cacheKey->sizeMode * 1000003 + (uint64_t) cacheKey->bitGraphic * 10007 + 
+				(uint64_t) cacheKey->invertFlag * 101 + (uint64_t) cacheKey->htmlMode * 11 + (uint64_t) cacheKey->grayMode;
+
+	return (int) ((imageHash ^ (keyHash * 0x9E3779B97F4A7C15ULL)) & (SERVE_HASH_BUCKETS - 1));
+}
+
+/********************************************************************************
+*     FUNCTION: cacheKeyEqual
+*        INPUT: firstKey, secondKey - rendering options
+*       OUTPUT: 1 when all options are same, otherwise 0
+*  DESCRIPTION: /
+********************************************************************************/
+
+int cacheKeyEqual( cacheKey_s *firstKey , cacheKey_s *secondKey )
+{
+	return (firstKey->sizeMode == secondKey->sizeMode) && (firstKey->bitGraphic == secondKey->bitGraphic) &&
+			(firstKey->invertFlag == secondKey->invertFlag) && (firstKey->htmlMode == secondKey->htmlMode) &&
+			(firstKey->grayMode == secondKey->grayMode);
+}
+
+/********************************************************************************
+*     FUNCTION: cacheRemove
+*        INPUT: resultCache - result cache ( locked )
+*               cacheEntry  - entry in cache
+*       OUTPUT: /
+*  DESCRIPTION: This function removes entry from hash table and LRU list and
+*               frees it
+********************************************************************************/
+
+void cacheRemove( resultCache_s *resultCache , cacheEntry_s *cacheEntry )
+{
+	cacheEntry_s **entryLink;
+
+	/* Hash table */
+	entryLink = &resultCache->hashTable[cacheBucket( cacheEntry->imageHash , &cacheEntry->cacheKey )];
+	while( *entryLink != cacheEntry ) {
+		entryLink = &(*entryLink)->hashNext;
+	}
+	*entryLink = cacheEntry->hashNext;
+
+	/* LRU list */
+	if( cacheEntry->lruPrev != NULL ) {
+		cacheEntry->lruPrev->lruNext = cacheEntry->lruNext;
+	} else {
+		resultCache->lruFirst = cacheEntry->lruNext;
+	}
+	if( cacheEntry->lruNext != NULL ) {
+		cacheEntry->lruNext->lruPrev = cacheEntry->lruPrev;
+	} else {
+		resultCache->lruLast = cacheEntry->lruPrev;
+	}
+
+	resultCache->memUsed = resultCache->memUsed - (sizeof(cacheEntry_s) + cacheEntry->outLen + (size_t) cacheEntry->imageSize);
+	resultCache->numOfEntries--;
+
+	free( cacheEntry->imageData );
+	free( cacheEntry->outData );
+	free( cacheEntry );
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: cacheAddLatency
+*        INPUT: resultCache - result cache
+*               requestTime - time of answered request in seconds
+*       OUTPUT: /
+*  DESCRIPTION: /
+********************************************************************************/
+
+void cacheAddLatency( resultCache_s *resultCache , double requestTime )
+{
+	pthread_mutex_lock( &resultCache->cacheLock );
+	resultCache->latencies[resultCache->numOfLatencies % SERVE_LATENCY_SAMPLES] = requestTime;
+	resultCache->numOfLatencies++;
+	pthread_mutex_unlock( &resultCache->cacheLock );
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: cacheFormatStats
+*        INPUT: resultCache - result cache
+*               statsLine   - buffer for report line
+*               lineSize    - size of statsLine
+*       OUTPUT: /
+*  DESCRIPTION: This function makes report with hits, misses, cache size and
+*               latency percentiles of last SERVE_LATENCY_SAMPLES requests
+********************************************************************************/
+
+void cacheFormatStats( resultCache_s *resultCache , char *statsLine , int lineSize )
+{
+	int numOfSamples;
+	long numOfRequests;
+	long numOfHits;
+	long numOfMisses;
+	int numOfEntries;
+	size_t memUsed;
+
+	double *sortedTimes;
+
+	sortedTimes = malloc( SERVE_LATENCY_SAMPLES * sizeof(double) );
+
+	pthread_mutex_lock( &resultCache->cacheLock );
+
+	numOfRequests = resultCache->numOfRequests;
+	numOfHits = resultCache->numOfHits;
+	numOfMisses = resultCache->numOfMisses;
+	numOfEntries = resultCache->numOfEntries;
+	memUsed = resultCache->memUsed;
+
+	numOfSamples = (resultCache->numOfLatencies < SERVE_LATENCY_SAMPLES) ? 
+						(int) resultCache->numOfLatencies : SERVE_LATENCY_SAMPLES;
+	if( sortedTimes != NULL ) {
+		memcpy( sortedTimes , resultCache->latencies , numOfSamples * sizeof(double) );
+	} else {
+		numOfSamples = 0;
+	}
+
+	pthread_mutex_unlock( &resultCache->cacheLock );
+
+	/* Latencies are sorted outside of lock */
+	if( numOfSamples > 0 ) {
+		qsort( sortedTimes , numOfSamples , sizeof(double) , compareDoubles );
+	}
+
+	snprintf( statsLine , lineSize , "STATS requests=%ld hits=%ld misses=%ld entries=%d cache_bytes=%lu "
+				"p50_us=%.0f p90_us=%.0f p99_us=%.0f\n" , numOfRequests , numOfHits , numOfMisses , numOfEntries , 
+				(unsigned long) memUsed , 
+				(numOfSamples > 0) ? sortedTimes[(numOfSamples * 50) / 100] * 1e6 : 0.0 ,
+				(numOfSamples > 0) ? sortedTimes[(numOfSamples * 90) / 100] * 1e6 : 0.0 ,
+				(numOfSamples > 0) ? sortedTimes[(numOfSamples * 99) / 100] * 1e6 : 0.0 );
+
+	free( sortedTimes );
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: compareDoubles
+*        INPUT: firstArg, secondArg - pointers to double
+*       OUTPUT: -1, 0 or 1
+*  DESCRIPTION: Compare function for qsort
+********************************************************************************/
+
+int compareDoubles( const void *firstArg , const void *secondArg )
+{
+	double firstValue = *(const double *) firstArg;
+	double secondValue = *(const double *) secondArg;
+
+	return (firstValue > secondValue) - (firstValue < secondValue);
+}
+
+#endif /* USE_THREADS */
+
+
+/*************************************************************************/
+/*                              LIBRARY                                  */                
+/*************************************************************************/
+
+/********************************************************************************
+*     FUNCTION: asciiOptionsInit
+*        INPUT: options - library options
+*       OUTPUT: /
+*  DESCRIPTION: This function sets same defaults as initUserInput
+********************************************************************************/
+
+void asciiOptionsInit( asciiOptions_s *options )
+{
+	options->sizeMode = 6;
+	options->bitGraphic = 4;
+	options->invertFlag = 0;
+	options->htmlMode = 0;
+	options->grayMode = GRAY_AVERAGE;
+	options->asciiRamp = NULL;
+	options->scratchBuffer = NULL;
+	options->scratchSize = 0;
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: libraryInputFromOptions
+*        INPUT: options   - library options
+*               userInput - user input data strucure ( on stack of caller )
+*       OUTPUT: ASCII_OK or ASCII_ERROR_ARGUMENT
+*  DESCRIPTION: This function checks options and fills user input with them,
+*               including symbol table
+********************************************************************************/
+
+int libraryInputFromOptions( const asciiOptions_s *options , userInput_s *userInput )
+{
+	if( (options->sizeMode < 1) || (options->sizeMode > 10) || 
+		(options->bitGraphic < 1) || (options->bitGraphic > 4) ||
+		((options->grayMode != GRAY_AVERAGE) && (options->grayMode != GRAY_BT601) && (options->grayMode != GRAY_BT709)) ||
+		((options->asciiRamp != NULL) && (options->asciiRamp[0] == '\0')) ) {
+		return ASCII_ERROR_ARGUMENT;
+	}
+
+	initUserInput( userInput );
+
+	userInput->sizeMode = options->sizeMode;
+	userInput->bitGraphic = options->bitGraphic;
+	userInput->invertFlag = (options->invertFlag != 0) ? 1 : 0;
+	userInput->htmlMode = (options->htmlMode != 0) ? 1 : 0;
+	userInput->grayMode = options->grayMode;
+	userInput->asciiRamp = (char *) options->asciiRamp;
+
+	initGlyphTable( userInput );
+
+	return ASCII_OK;
+}
+
+/********************************************************************************
+*     FUNCTION: asciiImageGetSizes
+*        INPUT: bmpData     - .bmp image in memory
+*               bmpSize     - size of bmpData
+*               options     - library options
+*               outSize     - size of output buffer ( or NULL )
+*               scratchSize - size of scratch buffer ( or NULL )
+*       OUTPUT: ASCII_OK or error code
+*  DESCRIPTION: This function returns output size that is enough for any 
+*               content of image ( all symbols escaped in html mode ) and 
+*               size of scratch memory for asciiOptions_s.scratchBuffer
+********************************************************************************/
+
+int asciiImageGetSizes( const unsigned char *bmpData , size_t bmpSize , const asciiOptions_s *options ,
+						size_t *outSize , size_t *scratchSize )
+{
+	int retVal;
+	int symbolWidth;
+	size_t numOfCells;
+
+	userInput_s userInput;
+	imageData_s imageData;
+	imageFile_s imageFile;
+
+	if( (bmpData == NULL) || (options == NULL) ) {
+		return ASCII_ERROR_ARGUMENT;
+	}
+
+	retVal = libraryInputFromOptions( options , &userInput );
+	if( retVal < 0 ) {
+		return retVal;
+	}
+
+	/* Image in memory is used like mapped file */
+	imageFile.fileData = (unsigned char *) bmpData;
+	imageFile.fileSize = bmpSize;
+	imageFile.filePtr = NULL;
+	imageFile.pixelData = NULL;
+
+	retVal = parseBmpHeader( &imageFile , &imageData );
+	if( retVal < 0 ) {
+		return retVal;
+	}
+
+	symbolWidth = getSymbolWidth( userInput.sizeMode );
+
+	/* Same number of symbols as in makeAsciiLine */
+	numOfCells = 0;
+	if( imageData.imgWidth > symbolWidth ) {
+		numOfCells = (imageData.imgWidth - 1) / symbolWidth;
+	}
+
+	if( outSize != NULL ) {
+		*outSize = sizeAdd( sizeMultiply( getAsciiNumOfLines( &userInput , &imageData ) , 
+					(size_t) numOfCells * (userInput.htmlMode ? HTML_ESCAPE_MAX : 1) + 1 ) , 1 );
+		if( userInput.htmlMode ) {
+			*outSize = sizeAdd( *outSize , strlen( HTML_HEADER ) + strlen( HTML_FOOTER ) );
+		}
+	}
+
+	/* Symbol sums and output line of band printing */
+	if( scratchSize != NULL ) {
+		*scratchSize = sizeAdd( sizeAdd( cellLineSize( symbolWidth , &imageData ) , 
+						arenaBlockSize( getAsciiLineSize( &userInput , &imageData ) ) ) , CACHE_LINE_SIZE );
+	}
+
+	return ASCII_OK;
+}
+
+/********************************************************************************
+*     FUNCTION: asciiImageRender
+*        INPUT: bmpData   - .bmp image in memory
+*               bmpSize   - size of bmpData
+*               options   - library options
+*               outBuffer - output buffer of caller
+*               outSize   - size of outBuffer
+*               outLen    - length of output without terminating zero ( or NULL )
+*       OUTPUT: ASCII_OK or error code
+*  DESCRIPTION: This function renders image one band at a time like 
+*               printAsciiImageBanded, but image is read from memory and 
+*               output is written to outBuffer. All state is on stack, in 
+*               scratch memory of caller or in memory allocated for this call,
+*               so function can be called from many threads at once.
+********************************************************************************/
+
+int asciiImageRender( const unsigned char *bmpData , size_t bmpSize , const asciiOptions_s *options ,
+						char *outBuffer , size_t outSize , size_t *outLen )
+{
+	int yAxe;
+	int retVal;
+	int lineLen;
+	int symbolWidth;
+	int symbolHeight;
+	size_t scratchSize;
+
+	char *bufferedLine;
+	void *scratchBlock;
+
+	userInput_s userInput;
+	imageData_s imageData;
+	imageFile_s imageFile;
+	cellLine_s cellLine;
+	memArena_s memArena;
+	outputBuffer_s outBuf;
+
+	/*************************************************************************/
+	/*                           Printing settings                           */                
+	/*************************************************************************/
+
+	if( (outBuffer == NULL) || (outSize == 0) ) {
+		return ASCII_ERROR_ARGUMENT;
+	}
+
+	/* Checks options and image header */
+	retVal = asciiImageGetSizes( bmpData , bmpSize , options , NULL , &scratchSize );
+	if( retVal < 0 ) {
+		return retVal;
+	}
+
+	libraryInputFromOptions( options , &userInput );
+
+	imageFile.fileData = (unsigned char *) bmpData;
+	imageFile.fileSize = bmpSize;
+	imageFile.filePtr = NULL;
+	imageFile.pixelData = NULL;
+	parseBmpHeader( &imageFile , &imageData );
+
+	/* RLE image is decoded to memory of this call */
+	if( (imageData.compression == BMP_RLE8) || (imageData.compression == BMP_RLE4) ) {
+		if( bmpDecodeRle( &imageFile , &imageData ) < 0 ) {
+			return ASCII_ERROR_DAMAGED;
+		}
+	}
+
+	symbolWidth = getSymbolWidth( userInput.sizeMode );
+	symbolHeight = symbolWidth * 2;
+
+	/* Scratch memory of caller or allocated for this call */
+	scratchBlock = NULL;
+	if( options->scratchBuffer != NULL ) {
+		if( options->scratchSize < scratchSize ) {
+			return ASCII_ERROR_BUFFER;
+		}
+		arenaAttach( &memArena , options->scratchBuffer , options->scratchSize );
+	} else {
+		scratchBlock = malloc( scratchSize );
+		if( scratchBlock == NULL ) {
+			return ASCII_ERROR_MEMORY;
+		}
+		arenaAttach( &memArena , scratchBlock , scratchSize );
+	}
+
+	createCellLine( &cellLine , &memArena , symbolWidth , &imageData );
+	bufferedLine = arenaAlloc( &memArena , getAsciiLineSize( &userInput , &imageData ) );
+
+	/* Output buffer without file - last byte is for terminating zero */
+	outBuf.bufData = outBuffer;
+	outBuf.bufSize = outSize - 1;
+	outBuf.bufUsed = 0;
+	outBuf.htmlMode = userInput.htmlMode;
+	outBuf.colorMode = COLOR_NONE;
+	outBuf.spanOpen = 0;
+	outBuf.gzipStream = NULL;
+	outBuf.outWritten = 0;
+	outBuf.outFilePtr = NULL;
+	outBuf.outFilePath[0] = '\0';
+
+	/*************************************************************************/
+	/*                           Print ascii image                           */                
+	/*************************************************************************/
+
+	retVal = ASCII_OK;
+
+	if( userInput.htmlMode ) {
+		if( outputAppendText( &outBuf , HTML_HEADER ) < 0 ) {
+			retVal = ASCII_ERROR_BUFFER;
+		}
+	}
+
+	/* Read one band, print one line */
+	for( yAxe = 0; (retVal == ASCII_OK) && (yAxe < (imageData.imgHeight - symbolHeight)); yAxe = yAxe + symbolHeight ) {
+
+		/* Band is inside of image ( parseBmpHeader ), read from memory cannot fail */
+		readBandCells( &imageFile , &cellLine , NULL , yAxe , &userInput , &imageData );
+
+		lineLen = makeAsciiLineCells( &cellLine , bufferedLine , &userInput );
+		if( outputAppendLine( &outBuf , bufferedLine , lineLen ) < 0 ) {
+			retVal = ASCII_ERROR_BUFFER;
+		}
+	}
+
+	if( (retVal == ASCII_OK) && userInput.htmlMode ) {
+		if( outputAppendText( &outBuf , HTML_FOOTER ) < 0 ) {
+			retVal = ASCII_ERROR_BUFFER;
+		}
+	}
+
+	/*************************************************************************/
+	/*                             Clean up                                  */
+	/*************************************************************************/
+
+	outBuffer[outBuf.bufUsed] = '\0';
+	if( outLen != NULL ) {
+		*outLen = outBuf.bufUsed;
+	}
+
+	free( scratchBlock );
+	free( imageFile.pixelData );
+
+	return retVal;
+}
+
+/********************************************************************************
+*     FUNCTION: asciiImageErrorString
+*        INPUT: errorCode - return code of library function
+*       OUTPUT: Description of return code
+*  DESCRIPTION: /
+********************************************************************************/
+
+const char * asciiImageErrorString( int errorCode )
+{
+	switch( errorCode ) {
+		case ASCII_OK:
+			return "no error";
+		case ASCII_ERROR_ARGUMENT:
+			return "invalid argument or option";
+		case ASCII_ERROR_FORMAT:
+			return "data is not .bmp image";
+		case ASCII_ERROR_DAMAGED:
+			return "image is not supported or damaged";
+		case ASCII_ERROR_BUFFER:
+			return "buffer is too small";
+		case ASCII_ERROR_MEMORY:
+			return "cannot allocate memory";
+		default:
+			return "unknown error";
+	}
+}
+
+
+/*************************************************************************/
+/*                              STATS                                    */                
+/*************************************************************************/
+
+/********************************************************************************
+*     FUNCTION: getWallTime
+*        INPUT: /
+*       OUTPUT: Monotonic time in seconds
+*  DESCRIPTION: /
+********************************************************************************/
+
+double getWallTime( void )
+{
+#ifndef WINDOWS
+	struct timespec timeNow;
+
+	clock_gettime( CLOCK_MONOTONIC , &timeNow );
+
+	return (double) timeNow.tv_sec + (double) timeNow.tv_nsec * 1e-9;
+#else
+	return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/********************************************************************************
+*     FUNCTION: statsInit
+*        INPUT: renderStats - stats structure
+*               statsFormat - STATS_TEXT or STATS_JSON
+*       OUTPUT: /
+*  DESCRIPTION: /
+********************************************************************************/
+
+void statsInit( renderStats_s *renderStats , int statsFormat )
+{
+	memset( renderStats , 0 , sizeof(renderStats_s) );
+	renderStats->statsFormat = statsFormat;
+
+#ifdef USE_THREADS
+	pthread_mutex_init( &renderStats->statsLock , NULL );
+#endif
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: statsAddStage
+*        INPUT: userInput    - user input data strucure ( stats or NULL )
+*               statsStage   - STATS_HEADER .. STATS_EMIT
+*               startTime    - getWallTime at start of stage
+*               bytesRead    - bytes read from image file
+*               bytesWritten - bytes written to output
+*               numOfAllocs  - heap allocations
+*       OUTPUT: /
+*  DESCRIPTION: This function adds one stage of one image to stats. Nothing 
+*               is done without --stats. Header stage counts images.
+********************************************************************************/
+
+void statsAddStage( userInput_s *userInput , int statsStage , double startTime , long bytesRead , 
+					long bytesWritten , long numOfAllocs )
+{
+	double stageTime;
+
+	renderStats_s *renderStats;
+
+	renderStats = userInput->renderStats;
+	if( renderStats == NULL ) {
+		return;
+	}
+
+	stageTime = getWallTime() - startTime;
+
+#ifdef USE_THREADS
+	pthread_mutex_lock( &renderStats->statsLock );
+#endif
+
+	renderStats->stageTime[statsStage] = renderStats->stageTime[statsStage] + stageTime;
+	renderStats->bytesRead[statsStage] = renderStats->bytesRead[statsStage] + bytesRead;
+	renderStats->bytesWritten[statsStage] = renderStats->bytesWritten[statsStage] + bytesWritten;
+	renderStats->numOfAllocs[statsStage] = renderStats->numOfAllocs[statsStage] + numOfAllocs;
+
+	if( statsStage == STATS_HEADER ) {
+		renderStats->numOfImages++;
+	}
+
+#ifdef USE_THREADS
+	pthread_mutex_unlock( &renderStats->statsLock );
+#endif
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: statsPrint
+*        INPUT: renderStats - stats of all images
+*       OUTPUT: /
+*  DESCRIPTION: This function prints stats to stderr as table or as one JSON
+*               object. JSON keys are stable:
+*               { "images", "peak_rss_kb", "stages": { "header", "alloc", 
+*               "gray", "cells", "emit" }, "total" }, each stage and total 
+*               has "wall_s", "bytes_read", "bytes_written" and "allocs".
+*               In batch mode stages are summed over all images ( and 
+*               threads ). Peak memory is -1 where it is not available.
+********************************************************************************/
+
+void statsPrint( renderStats_s *renderStats )
+{
+	int i;
+	long peakMemory;
+
+	double totalTime;
+	long totalRead;
+	long totalWritten;
+	long totalAllocs;
+
+	static const char *stageNames[STATS_NUM_STAGES] = { "header" , "alloc" , "gray" , "cells" , "emit" };
+
+#ifndef WINDOWS
+	struct rusage resUsage;
+
+	/* Linux reports kB */
+	peakMemory = -1;
+	if( getrusage( RUSAGE_SELF , &resUsage ) == 0 ) {
+		peakMemory = resUsage.ru_maxrss;
+	}
+#else
+	peakMemory = -1;
+#endif
+
+	totalTime = 0;
+	totalRead = 0;
+	totalWritten = 0;
+	totalAllocs = 0;
+
+	for( i = 0 ; i < STATS_NUM_STAGES ; i++ ) {
+		totalTime = totalTime + renderStats->stageTime[i];
+		totalRead = totalRead + renderStats->bytesRead[i];
+		totalWritten = totalWritten + renderStats->bytesWritten[i];
+		totalAllocs = totalAllocs + renderStats->numOfAllocs[i];
+	}
+
+	/* Machine readable - one line */
+	if( renderStats->statsFormat == STATS_JSON ) {
+
+		fprintf( stderr , "{\"images\":%d,\"peak_rss_kb\":%ld,\"stages\":{" , 
+					renderStats->numOfImages , peakMemory );
+
+		for( i = 0 ; i < STATS_NUM_STAGES ; i++ ) {
+			fprintf( stderr , "%s\"%s\":{\"wall_s\":%.6f,\"bytes_read\":%ld,\"bytes_written\":%ld,\"allocs\":%ld}" , 
+					(i > 0) ? "," : "" , stageNames[i] , renderStats->stageTime[i] , 
+					renderStats->bytesRead[i] , renderStats->bytesWritten[i] , renderStats->numOfAllocs[i] );
+		}
+
+		fprintf( stderr , "},\"total\":{\"wall_s\":%.6f,\"bytes_read\":%ld,\"bytes_written\":%ld,\"allocs\":%ld}}\n" , 
+					totalTime , totalRead , totalWritten , totalAllocs );
+		return;
+	}
+
+	fprintf( stderr , "-----------------------------------\n");
+	fprintf( stderr , "Stats:\n");
+	fprintf( stderr , " stage     time [ms]     read [B]  written [B]  allocs\n");
+
+	for( i = 0 ; i < STATS_NUM_STAGES ; i++ ) {
+		fprintf( stderr , " %-7s %11.3f %12ld %12ld %7ld\n" , stageNames[i] , renderStats->stageTime[i] * 1e3 , 
+					renderStats->bytesRead[i] , renderStats->bytesWritten[i] , renderStats->numOfAllocs[i] );
+	}
+
+	fprintf( stderr , " %-7s %11.3f %12ld %12ld %7ld\n" , "total" , totalTime * 1e3 , 
+				totalRead , totalWritten , totalAllocs );
+	fprintf( stderr , " images: %d , peak memory: %ld kB\n" , renderStats->numOfImages , peakMemory );
+	fprintf( stderr , "-----------------------------------\n");
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: statsDestroy
+*        INPUT: renderStats - stats structure
+*       OUTPUT: /
+*  DESCRIPTION: /
+********************************************************************************/
+
+void statsDestroy( renderStats_s *renderStats )
+{
+#ifdef USE_THREADS
+	pthread_mutex_destroy( &renderStats->statsLock );
+#endif
+
+	return;
+}
+
+
+/*************************************************************************/
+/*                            BENCHMARK                                  */                
+/*************************************************************************/
+
+#ifdef BENCH
+
+/********************************************************************************
+ *     Function: main
+ *        Input: [WIDTH HEIGHT [REPEATS]]
+ *       Output:
+ *  Description: Benchmark main function. Synthetic images with all four 
+ *               line paddings ( width, width+1, width+2, width+3 ) are 
+ *               written to temporary files and every stage is timed for 
+ *               every size and bit graphic.
+ ********************************************************************************/
+
+int main(int argc, char *argv[])
+{
+	int i;
+	int retVal;
+	int widthInPix;
+	int heightInPix;
+	int numOfRepeats;
+	int imageFd;
+
+	char bmpPath[] = "/tmp/asciiBenchXXXXXX";
+	char imagePath[sizeof(bmpPath)];
+
+	widthInPix = BENCH_WIDTH;
+	heightInPix = BENCH_HEIGHT;
+	numOfRepeats = BENCH_REPEATS;
+
+	if( argc >= 3 ) {
+		widthInPix = atoi( argv[1] );
+		heightInPix = atoi( argv[2] );
+	}
+	if( argc >= 4 ) {
+		numOfRepeats = atoi( argv[3] );
+	}
+
+	if( (widthInPix < 4) || (heightInPix < 1) || (numOfRepeats < 1) ) {
+		printf("Usage: asciiBench [WIDTH HEIGHT [REPEATS]] ( width at least 4 )\n");
+		return 0;
+	}
+
+	/* Width is rounded down to 4 pixels, so widths +0..+3 give all paddings */
+	widthInPix = widthInPix & ~3;
+
+	for( i = 0 ; i < 4 ; i++ ) {
+
+		strcpy( imagePath , bmpPath );
+		imageFd = mkstemp( imagePath );
+		if( imageFd < 0 ) {
+			printf("Cannot create temporary file %s!\n", bmpPath );
+			return 0;
+		}
+		close( imageFd );
+
+		retVal = benchWriteBmp( imagePath , widthInPix + i , heightInPix );
+		if( retVal > 0 ) {
+			benchImage( imagePath , numOfRepeats );
+		}
+
+		unlink( imagePath );
+	}
+
+	return 0;
+}
+
+/********************************************************************************
+*     FUNCTION: benchPutInt
+*        INPUT: dataArray  - array of bytes
+*               dataOffset - offset of first byte
+*               numOfBytes - number of bytes
+*               dataValue  - stored value
+*       OUTPUT: /
+*  DESCRIPTION: This function stores value in little endian ( opposite of 
+*               byteToInt )
+********************************************************************************/
+
+void benchPutInt( unsigned char *dataArray , int dataOffset , int numOfBytes , long dataValue )
+{
+	int i;
+
+	for( i = 0 ; i < numOfBytes ; i++ ) {
+		dataArray[dataOffset + i] = (dataValue >> (8*i)) & 0xFF;
+	}
+
+	return;
+}
+
+/********************************************************************************
+*     FUNCTION: benchWriteBmp
+*        INPUT: bmpPath     - path of created file
+*               widthInPix  - image width
+*               heightInPix - image height
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function writes synthetic 24-bit .bmp image. Pixels are
+*               mix of gradients, so all gray values and symbols are used.
+********************************************************************************/
+
+int benchWriteBmp( char *bmpPath , int widthInPix , int heightInPix )
+{
+	int xAxe;
+	int yAxe;
+	int widthInBytes;
+	long rawSize;
+
+	unsigned char imgHeader[BMP_HEADER_SIZE];
+	unsigned char *linePixels;
+
+	FILE *bmpFilePtr;
+
+	widthInBytes = bmpGetWidthInBytes( widthInPix , 24 );
+	rawSize = (long) widthInBytes * heightInPix;
+
+	/* Header - file header and BITMAPINFOHEADER */
+	memset( imgHeader , 0 , BMP_HEADER_SIZE );
+	imgHeader[0] = 0x42;
+	imgHeader[1] = 0x4d;
+	benchPutInt( imgHeader , BMP_H_FILE_SIZE , 4 , BMP_HEADER_SIZE + rawSize );
+	benchPutInt( imgHeader , BMP_H_OFFSET , 4 , BMP_HEADER_SIZE );
+	benchPutInt( imgHeader , 0x0E , 4 , 40 );						/* Info header size */
+	benchPutInt( imgHeader , BMP_H_WIDTH , 4 , widthInPix );
+	benchPutInt( imgHeader , BMP_H_HEIGHT , 4 , heightInPix );
+	benchPutInt( imgHeader , 0x1A , 2 , 1 );						/* Planes */
+	benchPutInt( imgHeader , 0x1C , 2 , 24 );						/* Bits per pixel */
+	benchPutInt( imgHeader , BMP_H_RAW_SIZE , 4 , rawSize );
+
+	linePixels = calloc( widthInBytes , 1 );
+	if( linePixels == NULL ) {
+		printf("Cannot allocate memory for benchmark image!\n");
+		return ERROR;
+	}
+
+	bmpFilePtr = fopen( bmpPath , "wb" );
+	if( bmpFilePtr == NULL ) {
+		printf("Could not open file %s\n", bmpPath );
+		free( linePixels );
+		return ERROR;
+	}
+
+	fwrite( imgHeader , 1 , BMP_HEADER_SIZE , bmpFilePtr );
+
+	for( yAxe = 0 ; yAxe < heightInPix ; yAxe++ ) {
+		for( xAxe = 0 ; xAxe < widthInPix ; xAxe++ ) {
+			linePixels[3*xAxe]     = (xAxe * 7 + yAxe) & 0xFF;					/* Blue  */
+			linePixels[3*xAxe + 1] = (yAxe * 5 + (xAxe ^ yAxe)) & 0xFF;			/* Green */
+			linePixels[3*xAxe + 2] = ((xAxe * yAxe) >> 4) & 0xFF;				/* Red   */
+		}
+		fwrite( linePixels , 1 , widthInBytes , bmpFilePtr );				/* Padding stays zero */
+	}
+
+	free( linePixels );
+
+	if( fclose( bmpFilePtr ) != 0 ) {
+		printf("Cannot write benchmark image %s!\n", bmpPath );
+		return ERROR;
+	}
+
+	return OK;
+}
+
+/********************************************************************************
+*     FUNCTION: benchImage
+*        INPUT: bmpPath      - synthetic image
+*               numOfRepeats - number of repeats of every stage
+*       OUTPUT: ERROR or OK
+*  DESCRIPTION: This function times header parsing ( storeBmpImageData ), 
+*               decoding ( makeGrayPixelMap ) and for every size and bit 
+*               graphic downsampling ( makeAsciiLine ) and output 
+*               ( printAsciiImage to /dev/null ). Best of repeats is printed
+*               as MB/s of image pixel data and cells/s of printed symbols.
+********************************************************************************/
+
+int benchImage( char *bmpPath , int numOfRepeats )
+{
+	int i;
+	int yAxe;
+	int retVal;
+	int nullFd;
+	int stdoutFd;
+	int sizeMode;
+	int bitGraphic;
+	int symbolWidth;
+	int symbolHeight;
+	long numOfCells;
+	size_t arenaUsed;
+
+	double startTime;
+	double stageTime;
+	double bestTime;
+	double outputTime;
+	double imageMBytes;
+
+	char *bufferedLine;
+
+	imageData_s imageData;
+	imageFile_s imageFile;
+	userInput_s userInput;
+	pixelMap_s grayPixelMap;
+	memArena_s memArena;
+
+	initUserInput( &userInput );
+
+	/*************************************************************************/
+	/*                           Header parsing                              */                
+	/*************************************************************************/
+
+	startTime = getWallTime();
+	for( i = 0 ; i < BENCH_HEADER_LOOPS ; i++ ) {
+		if( imageFileOpen( bmpPath , &imageFile ) < 0 ) {
+			return ERROR;
+		}
+		retVal = storeBmpImageData( &imageFile , bmpPath , &imageData );
+		imageFileClose( &imageFile );
+		if( retVal < 0 ) {
+			return ERROR;
+		}
+	}
+	stageTime = (getWallTime() - startTime) / BENCH_HEADER_LOOPS;
+
+	imageMBytes = (double) imageData.imgHeight * imageData.imgWidthInBytes / 1e6;
+
+	printf("==========================================================\n");
+	printf(" Image %dx%d , padding %d B , %.2f MB\n", imageData.imgWidth , imageData.imgHeight , 
+			imageData.paddedBytes , imageMBytes );
+	printf(" header   : %10.2f us ( open , storeBmpImageData , close )\n", stageTime * 1e6 );
+
+	/*************************************************************************/
+	/*                              Decoding                                 */                
+	/*************************************************************************/
+
+	if( imageFileOpen( bmpPath , &imageFile ) < 0 ) {
+		return ERROR;
+	}
+
+	arenaInit( &memArena );
+	retVal = arenaReserve( &memArena , pixelMapSize( imageData.imgHeight , imageData.imgWidth ) + 
+					arenaBlockSize( imageData.imgWidthInBytes ) + 
+					arenaBlockSize( getAsciiLineSize( &userInput , &imageData ) ) );
+	if( retVal < 0 ) {
+		imageFileClose( &imageFile );
+		return ERROR;
+	}
+
+	createPixelMap( &grayPixelMap , &memArena , imageData.imgHeight , imageData.imgWidth );
+	arenaUsed = memArena.memUsed;
+
+	bestTime = 0;
+	for( i = 0 ; i < numOfRepeats ; i++ ) {
+		memArena.memUsed = arenaUsed;						/* Line buffer is taken again */
+		startTime = getWallTime();
+		retVal = makeGrayPixelMap( &grayPixelMap , &memArena , &imageFile , &userInput , &imageData );
+		stageTime = getWallTime() - startTime;
+		if( retVal < 0 ) {
+			imageFileClose( &imageFile );
+			arenaDestroy( &memArena );
+			return ERROR;
+		}
+		if( (i == 0) || (stageTime < bestTime) ) {
+			bestTime = stageTime;
+		}
+	}
+	imageFileClose( &imageFile );
+	memArena.memUsed = arenaUsed;
+
+	printf(" decode   : %10.2f MB/s\n", imageMBytes / bestTime );
+
+	/*************************************************************************/
+	/*                       Downsampling and output                         */                
+	/*************************************************************************/
+
+	printf(" size bit   downsample MB/s     cells/s    output MB/s     cells/s\n");
+
+	/* Frames are printed to /dev/null - report stays on stdout */
+	nullFd = open( "/dev/null" , O_WRONLY );
+	if( nullFd < 0 ) {
+		arenaDestroy( &memArena );
+		return ERROR;
+	}
+
+	bufferedLine = arenaAlloc( &memArena , getAsciiLineSize( &userInput , &imageData ) );
+	arenaUsed = memArena.memUsed;
+
+	for( sizeMode = 1 ; sizeMode <= 10 ; sizeMode++ ) {
+		for( bitGraphic = 1 ; bitGraphic <= 4 ; bitGraphic++ ) {
+
+			userInput.sizeMode = sizeMode;
+			userInput.bitGraphic = bitGraphic;
+			initGlyphTable( &userInput );
+
+			symbolWidth = getSymbolWidth( sizeMode );
+			symbolHeight = symbolWidth * 2;
+			numOfCells = (long) getAsciiNumOfLines( &userInput , &imageData ) * 
+							( (imageData.imgWidth > symbolWidth) ? (imageData.imgWidth - 1) / symbolWidth : 0 );
+
+			/* Downsampling only */
+			bestTime = 0;
+			for( i = 0 ; i < numOfRepeats ; i++ ) {
+				startTime = getWallTime();
+				for( yAxe = 0; yAxe < (imageData.imgHeight - symbolHeight); yAxe = yAxe + symbolHeight ) {
+					makeAsciiLine( &grayPixelMap , yAxe , symbolWidth , symbolHeight , bufferedLine , &userInput , &imageData );
+				}
+				stageTime = getWallTime() - startTime;
+				if( (i == 0) || (stageTime < bestTime) ) {
+					bestTime = stageTime;
+				}
+			}
+
+			/* Downsampling and output of whole frame */
+			fflush( stdout );
+			stdoutFd = dup( STDOUT_FILENO );
+			dup2( nullFd , STDOUT_FILENO );
+
+			outputTime = 0;
+			for( i = 0 ; i < numOfRepeats ; i++ ) {
+				memArena.memUsed = arenaUsed;
+				startTime = getWallTime();
+				printAsciiImage( &grayPixelMap , NULL , &memArena , &userInput , &imageData );
+				stageTime = getWallTime() - startTime;
+				if( (i == 0) || (stageTime < outputTime) ) {
+					outputTime = stageTime;
+				}
+			}
+
+			fflush( stdout );
+			dup2( stdoutFd , STDOUT_FILENO );
+			close( stdoutFd );
+
+			printf(" %4d %3d   %15.2f %11.3g %14.2f %11.3g\n", sizeMode , bitGraphic , 
+					imageMBytes / bestTime , numOfCells / bestTime ,
+					imageMBytes / outputTime , numOfCells / outputTime );
+		}
+	}
+
+	close( nullFd );
+	arenaDestroy( &memArena );
+
+	return OK;
+}
+
+#endif /* BENCH */
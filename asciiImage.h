@@ -0,0 +1,63 @@
+/* asciiImage.h */
+/*************************************************************************/
+/*                                                                       */
+/*  NAME:                                                                */
+/*      libasciiimage                                                    */
+/*                                                                       */
+/*  DESCRIPTION:                                                         */
+/*      Library interface of asciiImage. Image is given in memory and    */
+/*      ascii image is written to buffer of caller. Library does no I/O, */
+/*      has no global state and can be called from many threads.         */
+/*                                                                       */
+/*  COMPILATION:                                                         */
+/*      /$ gcc -Wall -O2 -DASCII_LIBRARY -fPIC -shared -fvisibility=hidden */
+/*             -o libasciiimage.so asciiImage.c -lm -lpthread            */
+/*                                                                       */
+/*************************************************************************/
+
+#ifndef ASCII_IMAGE_H
+#define ASCII_IMAGE_H
+
+#include <stddef.h>
+
+#if defined(__GNUC__)
+	#define ASCII_API	__attribute__((visibility("default")))
+#else
+	#define ASCII_API
+#endif
+
+/* Return codes */
+#define ASCII_OK				1
+#define ASCII_ERROR_ARGUMENT	(-2)		/* NULL pointer or option out of range */
+#define ASCII_ERROR_FORMAT		(-3)		/* Data is not .bmp image */
+#define ASCII_ERROR_DAMAGED		(-4)		/* Image is not supported or damaged */
+#define ASCII_ERROR_BUFFER		(-5)		/* Output or scratch buffer is too small */
+#define ASCII_ERROR_MEMORY		(-6)		/* Scratch memory cannot be allocated */
+
+/* Options of one rendering ( same meaning as command line options ) */
+struct asciiOptionsStruct {
+	int sizeMode;					/* 1 - 10 */
+	int bitGraphic;					/* 1 - 4 */
+	int invertFlag;
+	int htmlMode;					/* Html document, symbols are escaped */
+	int grayMode;					/* 0 ( average ), 601 or 709 */
+	const char *asciiRamp;			/* Own symbols from black to white or NULL */
+	void *scratchBuffer;			/* Scratch memory of caller or NULL ( allocated ) */
+	size_t scratchSize;
+} typedef asciiOptions_s;
+
+/* Default options - same as command line without options */
+ASCII_API void asciiOptionsInit( asciiOptions_s *options );
+
+/* Output size ( enough for any image content ) and scratch size for image */
+ASCII_API int asciiImageGetSizes( const unsigned char *bmpData , size_t bmpSize , const asciiOptions_s *options ,
+									size_t *outSize , size_t *scratchSize );
+
+/* Render image to outBuffer, output is zero terminated, outLen is without zero */
+ASCII_API int asciiImageRender( const unsigned char *bmpData , size_t bmpSize , const asciiOptions_s *options ,
+									char *outBuffer , size_t outSize , size_t *outLen );
+
+/* Description of return code */
+ASCII_API const char * asciiImageErrorString( int errorCode );
+
+#endif /* ASCII_IMAGE_H */